@@ -9,6 +9,6 @@ public class LagCompensationTarget : TargetRules
 	{
 		Type = TargetType.Game;
 		DefaultBuildSettings = BuildSettingsVersion.V2;
-		ExtraModuleNames.Add("LagCompensation");
+		ExtraModuleNames.AddRange( new string[] { "LagCompensationCore", "LagCompensation" } );
 	}
 }
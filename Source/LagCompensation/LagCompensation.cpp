@@ -4,4 +4,7 @@
 #include "Modules/ModuleManager.h"
 
 IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, LagCompensation, "LagCompensation" );
- 
\ No newline at end of file
+
+DEFINE_LOG_CATEGORY(LogLagCompensation);
+
+CSV_DEFINE_CATEGORY(LagComp, true);
@@ -3,3 +3,10 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+
+DECLARE_LOG_CATEGORY_EXTERN(LogLagCompensation, Log, All);
+
+DECLARE_STATS_GROUP(TEXT("LagCompensation"), STATGROUP_LagComp, STATCAT_Advanced);
+
+CSV_DECLARE_CATEGORY_EXTERN(LagComp);
@@ -1,6 +1,7 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "LagCompensationCharacter.h"
+#include "LagCompensation.h"
 
 #include "AudioWaveFormatParser.h"
 #include "DrawDebugHelpers.h"
@@ -13,6 +14,11 @@
 #include "HeadMountedDisplayFunctionLibrary.h"
 #include "LagCompensationPlayerController.h"
 #include "LCCharacterMovementComponent.h"
+#include "LCDebugDrawSubsystem.h"
+#include "LCProjectileSubsystem.h"
+#include "LCRewindHistorySubsystem.h"
+#include "LCRewindLogSubsystem.h"
+#include "LCShotValidationSubsystem.h"
 #include "Kismet/GameplayStatics.h"
 #include "MotionControllerComponent.h"
 #include "XRMotionControllerBase.h" // for FXRMotionControllerBase::RightHandSourceId
@@ -20,6 +26,12 @@
 
 DEFINE_LOG_CATEGORY_STATIC(LogFPChar, Warning, All);
 
+DECLARE_CYCLE_STAT(TEXT("Saved Position Lookup"), STAT_LagComp_SavedPositionLookup, STATGROUP_LagComp);
+DECLARE_CYCLE_STAT(TEXT("Closest Position Lookup"), STAT_LagComp_ClosestPositionLookup, STATGROUP_LagComp);
+DECLARE_CYCLE_STAT(TEXT("Shot Rewind Time"), STAT_LagComp_ShotRewindTime, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Saved Positions Overwritten"), STAT_LagComp_SavedPositionsOverwritten, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Shots Rejected"), STAT_LagComp_ShotsRejected, STATGROUP_LagComp);
+
 //////////////////////////////////////////////////////////////////////////
 // ALagCompensationCharacter
 
@@ -87,7 +99,33 @@ ALagCompensationCharacter::ALagCompensationCharacter(const FObjectInitializer& O
 	VR_MuzzleLocation->SetRelativeLocation(FVector(0.000004, 53.999992, 10.000000));
 	VR_MuzzleLocation->SetRelativeRotation(FRotator(0.0f, 90.0f, 0.0f));		// Counteract the rotation of the VR gun model.
 
+	// hitboxes for the UE4 mannequin skeleton, its bones point along X
+	Hitboxes.Emplace(TEXT("head"), FVector(8.f, 2.f, 0.f), 11.f, 14.f, ELCHitZone::Head);
+	Hitboxes.Emplace(TEXT("spine_03"), FVector(4.f, 0.f, 0.f), 20.f, 30.f, ELCHitZone::Body);
+	Hitboxes.Emplace(TEXT("pelvis"), FVector(0.f, 0.f, 0.f), 18.f, 26.f, ELCHitZone::Body);
+	Hitboxes.Emplace(TEXT("upperarm_l"), FVector(14.f, 0.f, 0.f), 7.f, 18.f, ELCHitZone::Limb);
+	Hitboxes.Emplace(TEXT("upperarm_r"), FVector(-14.f, 0.f, 0.f), 7.f, 18.f, ELCHitZone::Limb);
+	Hitboxes.Emplace(TEXT("lowerarm_l"), FVector(13.f, 0.f, 0.f), 6.f, 17.f, ELCHitZone::Limb);
+	Hitboxes.Emplace(TEXT("lowerarm_r"), FVector(-13.f, 0.f, 0.f), 6.f, 17.f, ELCHitZone::Limb);
+	Hitboxes.Emplace(TEXT("thigh_l"), FVector(-22.f, 0.f, 0.f), 10.f, 26.f, ELCHitZone::Limb);
+	Hitboxes.Emplace(TEXT("thigh_r"), FVector(22.f, 0.f, 0.f), 10.f, 26.f, ELCHitZone::Limb);
+	Hitboxes.Emplace(TEXT("calf_l"), FVector(-21.f, 0.f, 0.f), 8.f, 25.f, ELCHitZone::Limb);
+	Hitboxes.Emplace(TEXT("calf_r"), FVector(21.f, 0.f, 0.f), 8.f, 25.f, ELCHitZone::Limb);
+
 	MaxSavedPositionAge = 1.f;
+	PositionSampleRate = 60.f;
+	NextPositionSampleTime = 0.f;
+	LastNumOverwritten = 0;
+	bCompactSavedPositions = false;
+	SavedPositionTolerance = 1.f;
+	bHermiteSavedPositions = true;
+	bBatchShots = true;
+	MaxShotsPerBatch = 16;
+	bFireProjectiles = false;
+	PendingShotsBaseTimeStamp = 0.f;
+	MaxClientMoveRate = 120.f;
+	MaxShotMoveWait = 0.25f;
+	RewindHistorySlot = INDEX_NONE;
 }
 
 void ALagCompensationCharacter::BeginPlay()
@@ -110,23 +148,44 @@ void ALagCompensationCharacter::BeginPlay()
 		Mesh1P->SetHiddenInGame(false, true);
 	}
 
-	const FVector SpawnLocation = FVector(5000.f, 5000.f, 0.f);
-	const FRotator SpawnRotation = FRotator::ZeroRotator;
-	FActorSpawnParameters Parms;
-	Parms.Owner = this;
-	Parms.Instigator = this;
-	AActor* TestCapsuleActor = GetWorld()->SpawnActor(AFakeCharacterCapsule::StaticClass(), &SpawnLocation, &SpawnRotation, Parms);
-	TestCapsule = TestCapsuleActor? Cast<AFakeCharacterCapsule>(TestCapsuleActor) : nullptr;
+	// only the server keeps saved positions; one beyond MaxSavedPositionAge is kept for interpolation, plus a
+	// forced sample for a teleport
+	if (HasAuthority())
+	{
+		SavedMoves.Reserve(FMath::CeilToInt(MaxSavedPositionAge * PositionSampleRate) + 2, bCompactSavedPositions);
+		SavedMoves.SetDecimationTolerance(SavedPositionTolerance);
+		SavedMoves.SetHermiteInterpolation(bHermiteSavedPositions);
+		ClientMoves.Reserve(FMath::CeilToInt(MaxSavedPositionAge * MaxClientMoveRate) + 1);
+	}
+
+	ULCRewindHistorySubsystem* RewindHistory = GetWorld()->GetSubsystem<ULCRewindHistorySubsystem>();
+	if (HasAuthority() && RewindHistory)
+	{
+		RewindHistorySlot = RewindHistory->RegisterCharacter(this);
+	}
 }
 
 void ALagCompensationCharacter::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
+	ULCRewindHistorySubsystem* RewindHistory = GetWorld()->GetSubsystem<ULCRewindHistorySubsystem>();
+	if (RewindHistorySlot != INDEX_NONE && RewindHistory)
+	{
+		RewindHistory->UnregisterCharacter(RewindHistorySlot);
+		RewindHistorySlot = INDEX_NONE;
+	}
+
 	Super::EndPlay(EndPlayReason);
 }
 
 void ALagCompensationCharacter::Tick(float DeltaSeconds)
 {
 	Super::Tick(DeltaSeconds);
+
+	FlushPendingShots();
+	if (ShotsAwaitingMove.Num() > 0)
+	{
+		UpdateShotsAwaitingMove();
+	}
 }
 
 void ALagCompensationCharacter::DrawDebugMove(FSavedMovePtr Move)
@@ -169,95 +228,129 @@ void ALagCompensationCharacter::AutoFire()
 	OnFire();
 }
 
-void ALagCompensationCharacter::DrawDebugRewind(FVector_NetQuantize TargetLocation, FVector_NetQuantize RewindLocation,
-	float TargetCapsuleHeight, FVector HitPoint, FVector StartLocation, FVector EndLocation)
+bool ALagCompensationCharacter::FindClosestPosition(const FVector& Position, float MinTime, float MaxTime, FLCClosestSavedPosition& OutClosest) const
 {
-	DrawDebugLine(GetWorld(), StartLocation, HitPoint, FColor::Magenta, true);
-	DrawDebugSphere(GetWorld(), HitPoint, 5.f, 10, FColor::Orange, true);
-	DrawDebugCapsule(GetWorld(), TargetLocation, TargetCapsuleHeight, 33.f, FQuat::Identity, FColor::Black, true);
-	DrawDebugCapsule(GetWorld(), RewindLocation, TargetCapsuleHeight - 20, 33.f, FQuat::Identity, FColor::White, true);
+	SCOPE_CYCLE_COUNTER(STAT_LagComp_ClosestPositionLookup);
+
+	if (!SavedMoves.FindClosestTime(Position, OutClosest, MinTime, MaxTime))
+	{
+		return false;
+	}
+	UE_LOG(LogLagCompensation, VeryVerbose, TEXT("%s: closest position to %s is %s at index %d and time %f"),
+		*GetName(), *Position.ToString(), *OutClosest.Position.ToString(), OutClosest.Index, OutClosest.Time);
+	return true;
 }
 
-void ALagCompensationCharacter::ClientDrawDebugCapsule_Implementation(FVector Location, float HalfHeight, FColor DrawColor)
+void ALagCompensationCharacter::SamplePosition(float WorldTime)
 {
-	DrawDebugCapsule(GetWorld(), Location, HalfHeight, 33.f, FQuat::Identity, DrawColor, true);
+	// a little slack so a tick landing exactly on the sample time is not skipped over float rounding
+	if (WorldTime + KINDA_SMALL_NUMBER < NextPositionSampleTime)
+	{
+		return;
+	}
+
+	RecordSavedPosition(WorldTime, false);
+
+	// keep the rate when ticks are faster, don't catch up after a hitch
+	const float SampleInterval = PositionSampleRate > 0.f ? 1.f / PositionSampleRate : 0.f;
+	NextPositionSampleTime = FMath::Max(NextPositionSampleTime + SampleInterval, WorldTime);
 }
 
-void ALagCompensationCharacter::ClientDrawDebugRewind_Implementation(FVector_NetQuantize TargetLocation,
-                                                                     FVector_NetQuantize RewindLocation, float TargetCapsuleHeight, FVector HitPoint, FVector StartLocation, FVector EndLocation)
+void ALagCompensationCharacter::NotifyTeleported()
 {
-	DrawDebugRewind(TargetLocation, RewindLocation, TargetCapsuleHeight, HitPoint, StartLocation, EndLocation);
+	if (!HasAuthority())
+	{
+		return;
+	}
+
+	RecordSavedPosition(GetWorld()->GetTimeSeconds(), true);
+
+	ULCRewindHistorySubsystem* RewindHistory = GetWorld()->GetSubsystem<ULCRewindHistorySubsystem>();
+	if (RewindHistorySlot != INDEX_NONE && RewindHistory)
+	{
+		RewindHistory->NotifyTeleported(RewindHistorySlot);
+	}
 }
 
-void ALagCompensationCharacter::FindClosestPosition(FVector Position)
+void ALagCompensationCharacter::RecordSavedPosition(float WorldTime, bool bTeleported)
 {
-	if(Position == FVector::ZeroVector) return;
-	FVector ClosestPosition = Position - 1000.f;
-	int ClosestPositionIndex = 0;
-	float MinDistance = 10000000000000;
-	
-	for (int32 i = SavedMoves.Num() - 1; i >= 0; i--)
-	{
-		if(FVector::Dist(SavedMoves[i].Position, Position) < MinDistance)
+	if (SavedMoves.Capacity() == 0)
+	{
+		return;
+	}
+
+	// the timestamp of the last move performed, a shot's move timestamp maps to this sample or one around it
+	const ULCCharacterMovementComponent* MovementComponent = Cast<ULCCharacterMovementComponent>(GetMovementComponent());
+	SavedMoves.Add(FSavedPosition(GetActorLocation(), GetViewRotation(), bTeleported, WorldTime,
+		MovementComponent ? MovementComponent->GetCurrentSynchTime() : 0.f, GetVelocity()));
+
+	// the history is sized to hold MaxSavedPositionAge, it only overwrites when positions come in faster than expected
+	const int32 NumOverwritten = SavedMoves.GetNumOverwritten();
+	if (NumOverwritten != LastNumOverwritten)
+	{
+		INC_DWORD_STAT_BY(STAT_LagComp_SavedPositionsOverwritten, NumOverwritten - LastNumOverwritten);
+		if (LastNumOverwritten == 0)
 		{
-			MinDistance = FVector::Dist(SavedMoves[i].Position, Position);
-			ClosestPositionIndex = i;
-			ClosestPosition = SavedMoves[i].Position;
+			UE_LOG(LogLagCompensation, Warning, TEXT("%s: saved position history of %d entries is full, it covers less than MaxSavedPositionAge (%.2f s)"),
+				*GetName(), SavedMoves.Capacity(), MaxSavedPositionAge);
 		}
+		LastNumOverwritten = NumOverwritten;
+	}
+
+	ULCRewindLogSubsystem* RewindLog = GetWorld()->GetSubsystem<ULCRewindLogSubsystem>();
+	if (RewindLog && RewindLog->IsRecording())
+	{
+		RewindLog->RecordPosition(this, SavedMoves.Last());
 	}
-	UE_LOG(LogTemp, Log, TEXT("TargetPosition: %s"), *ClosestPosition.ToString());
-	UE_LOG(LogTemp, Log, TEXT("%s: closest position is at index %d and time %f"), *GetName(), ClosestPositionIndex, SavedMoves[ClosestPositionIndex].Time);
+
+	// maintain one position beyond MaxSavedPositionAge for interpolation
+	SavedMoves.PopOlderThan(WorldTime - MaxSavedPositionAge);
 }
 
-void ALagCompensationCharacter::GetPositionForTime(float PredictionTime, FVector& OutPosition, ALagCompensationPlayerController* DebugViewer)
+void ALagCompensationCharacter::RecordMove()
 {
-	FVector TargetLocation = GetActorLocation();
-	float TargetTime = GetWorld()->GetTimeSeconds() - PredictionTime;
-	float Percent = 0.999f;
-	if (PredictionTime > 0.f)
+	const ULCCharacterMovementComponent* MovementComponent = Cast<ULCCharacterMovementComponent>(GetMovementComponent());
+	if (MovementComponent == nullptr)
 	{
-		for (int32 i = SavedMoves.Num() - 1; i >= 0; i--)
-		{
-			//DrawDebugSphere(GetWorld(), SavedMoves[i].Position, 5.f, 12, FColor::Red, true);
-			TargetLocation = SavedMoves[i].Position;
-			if (SavedMoves[i].Time < TargetTime)
-			{
-				if (!SavedMoves[i].bTeleported && (i < SavedMoves.Num() - 1))
-				{
-					if (SavedMoves[i + 1].Time == SavedMoves[i].Time)
-					{
-						TargetLocation = SavedMoves[i + 1].Position;
-					}
-					else
-					{
-						Percent = (TargetTime - SavedMoves[i].Time) / (SavedMoves[i + 1].Time - SavedMoves[i].Time);
-						TargetLocation = SavedMoves[i].Position + Percent * (SavedMoves[i + 1].Position - SavedMoves[i].Position);
-						//UE_LOG(LogTemp, Log, TEXT("%s: Location found at i = %d + %f percents (%d i's overall count). Time is %f"), *GetName(), i, Percent, SavedMoves.Num(), SavedMoves[i].Time + Percent * (SavedMoves[i + 1].Time - SavedMoves[i].Time));
-					}
-				}
-				break;
-			}
-		}
+		return;
+	}
+
+	ClientMoves.Add(MovementComponent->GetCurrentSynchTime(), GetWorld()->GetTimeSeconds(), GetActorLocation());
+	if (ShotsAwaitingMove.Num() > 0)
+	{
+		UpdateShotsAwaitingMove();
 	}
-	OutPosition = TargetLocation;
 }
 
-void ALagCompensationCharacter::PositionUpdated()
+bool ALagCompensationCharacter::MapMoveTimeStamp(float TimeStamp, float& OutTime, FVector* OutPosition) const
 {
-	const float WorldTime = GetWorld()->GetTimeSeconds();
-	ULCCharacterMovementComponent* MovementComponent = Cast<ULCCharacterMovementComponent>(GetMovementComponent());
-	if (GetCharacterMovement())
+	FVector Location;
+	if (ClientMoves.Find(TimeStamp, OutTime, Location))
 	{
-		new(SavedMoves)FSavedPosition(GetActorLocation(), GetViewRotation(),
-			GetCharacterMovement()->bJustTeleported,WorldTime,
-			(MovementComponent ? MovementComponent->GetCurrentSynchTime() : 0.f));
+		if (OutPosition)
+		{
+			*OutPosition = Location;
+		}
+		return true;
 	}
 
-	// maintain one position beyond MaxSavedPositionAge for interpolation
-	if (SavedMoves.Num() > 1 && SavedMoves[1].Time < WorldTime - MaxSavedPositionAge)
+	if (SavedMoves.MapTimeStampToTime(TimeStamp, OutTime, OutPosition))
+	{
+		return true;
+	}
+
+	// the server's own characters fire in the current tick, before it is recorded
+	const ULCCharacterMovementComponent* MovementComponent = Cast<ULCCharacterMovementComponent>(GetMovementComponent());
+	if (MovementComponent && TimeStamp == MovementComponent->GetCurrentSynchTime() && ClientMoves.IsAfterNewest(TimeStamp))
 	{
-		SavedMoves.RemoveAt(0);
+		OutTime = GetWorld()->GetTimeSeconds();
+		if (OutPosition)
+		{
+			*OutPosition = GetActorLocation();
+		}
+		return true;
 	}
+	return false;
 }
 
 void ALagCompensationCharacter::OnFire()
@@ -269,7 +362,7 @@ void ALagCompensationCharacter::OnFire()
 		ALagCompensationPlayerController* LagCompensationPC = GetOwner() ? Cast<ALagCompensationPlayerController>(GetController()) : nullptr;
 		float PredictionTime = LagCompensationPC ? LagCompensationPC->GetPredictionTime() : 0.f;
 		
-		UE_LOG(LogTemp, Log, TEXT("%s's PredictionTime is %e"), *GetName(), PredictionTime);
+		UE_LOG(LogLagCompensation, Verbose, TEXT("%s's PredictionTime is %e"), *GetName(), PredictionTime);
 		
 		const FRotator Rotation = GetControlRotation();
         const FVector StartLocation = ((FirstPersonCameraComponent != nullptr) ? FirstPersonCameraComponent->GetComponentLocation() : GetActorLocation()) + Rotation.RotateVector(GunOffset);
@@ -283,14 +376,13 @@ void ALagCompensationCharacter::OnFire()
 		//throwing a trace just to see where we're actually firing a shot
 		
 		UKismetSystemLibrary::LineTraceSingle(GetWorld(), StartLocation, EndLocation, ETraceTypeQuery::TraceTypeQuery1,
-            false, ActorsToIgnore, EDrawDebugTrace::ForDuration, OutHit, true);
+            false, ActorsToIgnore, ULCDebugDrawSubsystem::GetTraceDrawType(), OutHit, true);
 		
 		ALagCompensationCharacter* HitCharacter = OutHit.Actor.Get() ? Cast<ALagCompensationCharacter>(OutHit.Actor.Get()) : nullptr;
 		
 		if(GetLocalRole() == ROLE_AutonomousProxy || GetLocalRole() == ROLE_Authority && IsLocallyControlled())
 		{
-			OnFire_Server(PredictionTime, StartLocation, EndLocation, Cast<ALagCompensationPlayerController>(this->GetController()),
-				HitCharacter, HitCharacter ? HitCharacter->GetActorLocation() : FVector::ZeroVector);
+			AddPendingShot(StartLocation, EndLocation, PredictionTime, HitCharacter, HitCharacter ? HitCharacter->GetActorLocation() : FVector::ZeroVector);
 		}
 	}
 
@@ -312,86 +404,217 @@ void ALagCompensationCharacter::OnFire()
 	}
 }
 
-void ALagCompensationCharacter::OnFire_Server_Implementation(float PredictionAmount, FVector StartLocation,
-	FVector EndLocation, ALagCompensationPlayerController* FireInitiator, ALagCompensationCharacter* Victim,
-	FVector ClientPosition)
+void ALagCompensationCharacter::AddPendingShot(const FVector& StartLocation, const FVector& EndLocation, float PredictionTime, ALagCompensationCharacter* HitCharacter, const FVector& ClientPosition)
+{
+	ULCCharacterMovementComponent* MovementComponent = Cast<ULCCharacterMovementComponent>(GetMovementComponent());
+	const float ClientTimeStamp = MovementComponent ? MovementComponent->GetCurrentSynchTime() : 0.f;
+	if (PendingShots.Num() == 0)
+	{
+		PendingShotsBaseTimeStamp = ClientTimeStamp;
+	}
+	else if (!FLCShotPacket::FitsTimeStampDelta(PendingShotsBaseTimeStamp, ClientTimeStamp))
+	{
+		// timestamps were reset or the batch is older than the packet deltas reach, they can't go backwards or
+		// past 6.5 s
+		FlushPendingShots();
+		PendingShotsBaseTimeStamp = ClientTimeStamp;
+	}
+
+	// our position after the move with this timestamp, the server has it in its saved positions too
+	PendingShots.Add(FLCShotPacket::Make(GetActorLocation(), PendingShotsBaseTimeStamp, ClientTimeStamp, PredictionTime,
+		StartLocation, EndLocation, HitCharacter, ClientPosition));
+	if (!bBatchShots || PendingShots.Num() >= MaxShotsPerBatch)
+	{
+		FlushPendingShots();
+	}
+}
+
+void ALagCompensationCharacter::FlushPendingShots()
+{
+	if (PendingShots.Num() > 0)
+	{
+		if (SendShotsOverride.IsBound())
+		{
+			SendShotsOverride.Execute(PendingShotsBaseTimeStamp, PendingShots);
+		}
+		else
+		{
+			OnFire_Server(PendingShotsBaseTimeStamp, PendingShots);
+		}
+		PendingShots.Reset();
+	}
+}
+
+void ALagCompensationCharacter::OnFire_Server_Implementation(float BaseTimeStamp, const TArray<FLCShotPacket>& Shots)
+{
+	ReceiveShots(BaseTimeStamp, Shots);
+}
+
+void ALagCompensationCharacter::ReceiveShots(float BaseTimeStamp, const TArray<FLCShotPacket>& Shots)
+{
+	for (int32 ShotIndex = 0; ShotIndex < FMath::Min(Shots.Num(), MaxShotsPerBatch); ShotIndex++)
+	{
+		HandleShot(Shots[ShotIndex], BaseTimeStamp);
+	}
+}
+
+void ALagCompensationCharacter::HandleShot(const FLCShotPacket& Packet, float BaseTimeStamp)
 {
 	UWorld* const World = GetWorld();
-	if (World != nullptr)
+	ULCShotValidationSubsystem* ShotValidation = World ? World->GetSubsystem<ULCShotValidationSubsystem>() : nullptr;
+	if (ShotValidation != nullptr)
 	{
+		if (Packet.IsSaturated())
+		{
+			INC_DWORD_STAT(STAT_LagComp_ShotsRejected);
+			UE_LOG(LogLagCompensation, Verbose, TEXT("%s: rejected a shot whose origin or timestamp is out of the packet's range"), *GetName());
+			return;
+		}
+
+		const float PredictionAmount = Packet.GetPredictionAmount();
+		const float ClientTimeStamp = Packet.GetClientTimeStamp(BaseTimeStamp);
 		float CurrentTime = World->GetTimeSeconds();
-		UE_LOG(LogTemp, Log, TEXT("%s: \nTimeStamp5: Client fired in %f, now is %f, diff: %f"), *GetName(), CurrentTime - PredictionAmount, CurrentTime, PredictionAmount);
+		UE_LOG(LogLagCompensation, Verbose, TEXT("%s: \nTimeStamp5: Client fired in %f, now is %f, diff: %f"), *GetName(), CurrentTime - PredictionAmount, CurrentTime, PredictionAmount);
+
+		// the shot origin is relative to where we were after the move it was fired in. Decoding it against any
+		// other position moves the shot, so a move we can't find (older than the saved positions, or lost on
+		// its way here) rejects the shot
+		float MoveTime;
+		FVector ShooterPosition;
+		bool bMapped;
+		{
+			SCOPE_CYCLE_COUNTER(STAT_LagComp_SavedPositionLookup);
+			bMapped = MapMoveTimeStamp(ClientTimeStamp, MoveTime, &ShooterPosition);
+		}
+		if (!bMapped && ClientMoves.IsAfterNewest(ClientTimeStamp) && ShotsAwaitingMove.Num() < MaxShotsPerBatch)
+		{
+			// the shot overtook its move, it is handled once the move has been performed
+			ShotsAwaitingMove.Add({ Packet, BaseTimeStamp, CurrentTime });
+			return;
+		}
+		if (!bMapped)
+		{
+			INC_DWORD_STAT(STAT_LagComp_ShotsRejected);
+			UE_LOG(LogLagCompensation, Log, TEXT("%s: rejected a shot fired in move %f, the move is not in the saved positions"), *GetName(), ClientTimeStamp);
+			return;
+		}
 
-		FHitResult OutHit;
-		
-		TArray<AActor*> ActorsToIgnore;
-		ActorsToIgnore.Empty();
-		
-		FVector ClientRewoundPosition;
+		//the shot is validated together with all other shots of this tick
+		FLCPendingShot Shot;
+		Shot.Shooter = this;
+		Shot.Victim = Packet.Victim;
+		Shot.ShooterSlot = RewindHistorySlot;
+		Shot.StartLocation = Packet.GetStartLocation(ShooterPosition);
+		Shot.EndLocation = Packet.GetEndLocation(ShooterPosition);
+		Shot.ClientPosition = Packet.ClientPosition;
+		Shot.ServerTime = CurrentTime;
+		Shot.ClientTimeStamp = ClientTimeStamp;
+		Shot.PredictionAmount = PredictionAmount;
+		Shot.RewindTime = GetShotRewindTime(PredictionAmount, ClientTimeStamp, MoveTime);
+
+		ULCProjectileSubsystem* Projectiles = World->GetSubsystem<ULCProjectileSubsystem>();
+		if (bFireProjectiles && ProjectileClass && Projectiles)
+		{
+			Projectiles->SpawnProjectile(ProjectileClass, this, Shot.StartLocation, (Shot.EndLocation - Shot.StartLocation).Rotation(), Shot.RewindTime);
+			return;
+		}
+		ShotValidation->QueueShot(Shot);
+	}
+}
 
-		bool bPositionFound = false;
-		bool bClientHit = IsValid(Victim);
-		for (TActorIterator<ALagCompensationCharacter> ActorItr(World); ActorItr; ++ActorItr)
+void ALagCompensationCharacter::UpdateShotsAwaitingMove()
+{
+	const float CurrentTime = GetWorld()->GetTimeSeconds();
+	TArray<FShotAwaitingMove> Shots = MoveTemp(ShotsAwaitingMove);
+	for (const FShotAwaitingMove& Shot : Shots)
+	{
+		const float ClientTimeStamp = Shot.Packet.GetClientTimeStamp(Shot.BaseTimeStamp);
+		if (!ClientMoves.IsAfterNewest(ClientTimeStamp))
 		{
-			//get the rewind position of a player
-			(*ActorItr)->GetPositionForTime(PredictionAmount, ClientRewoundPosition, FireInitiator);
-
-			/*
-			if(bClientHit && (*ActorItr) == Victim)
-			{
-				(*ActorItr)->FindClosestPosition(ClientPosition);
-			}
-			*/
-
-			//put a capsule in the rewind position of a player
-			//TestCapsule->SetActorLocation(CurrentCapsuleLocation);
-			(*ActorItr)->TestCapsule->SetActorLocation(ClientRewoundPosition);
-			ActorsToIgnore.Add(*ActorItr);
+			HandleShot(Shot.Packet, Shot.BaseTimeStamp);
 		}
-		
+		else if (CurrentTime - Shot.ArrivalTime > MaxShotMoveWait)
+		{
+			INC_DWORD_STAT(STAT_LagComp_ShotsRejected);
+			UE_LOG(LogLagCompensation, Log, TEXT("%s: rejected a shot fired in move %f, the move did not arrive within %.2f s"), *GetName(), ClientTimeStamp, MaxShotMoveWait);
+		}
+		else
+		{
+			ShotsAwaitingMove.Add(Shot);
+		}
+	}
+}
 
-		
-		//fire a trace from a given spot (yup the player can cheat here. checking against the current muzzle
-		//location could help)
-		bool bHitOccurred = UKismetSystemLibrary::LineTraceSingle(GetWorld(), StartLocation, EndLocation, ETraceTypeQuery::TraceTypeQuery1,
-	false, ActorsToIgnore, EDrawDebugTrace::ForDuration, OutHit, true);
+float ALagCompensationCharacter::GetShotRewindTime(float PredictionAmount, float ClientTimeStamp, float MoveTime) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_LagComp_ShotRewindTime);
 
-		ALagCompensationCharacter* HitActor = (Cast<ALagCompensationCharacter>(OutHit.Actor.Get()->GetOwner()));
-		
-		bool ServerRegisterHit = bHitOccurred && HitActor;
-		
-		if(ServerRegisterHit)
+	const float CurrentTime = GetWorld()->GetTimeSeconds();
+	const ULCShotValidationSubsystem* ShotValidation = GetWorld()->GetSubsystem<ULCShotValidationSubsystem>();
+	const ALagCompensationPlayerController* LagCompensationPC = Cast<ALagCompensationPlayerController>(GetController());
+
+	const ELCRewindTimeMode Mode = ShotValidation ? ShotValidation->GetRewindTimeMode() : ELCRewindTimeMode::ClientPing;
+	if (Mode == ELCRewindTimeMode::Adaptive && LagCompensationPC && LagCompensationPC->HasTimingEstimate())
+	{
+		return FMath::Min(LagCompensationPC->GetAdaptiveRewindTime(ClientTimeStamp), CurrentTime) - LagCompensationPC->GetInterpolationDelay();
+	}
+
+	if (Mode == ELCRewindTimeMode::ClientPing)
+	{
+		return CurrentTime - PredictionAmount;
+	}
+
+	// the client saw the world as it was one round trip before the server performed the move it fired in,
+	// rendered another interpolation delay late. Characters the server controls see the world as it is
+	const float ShotMoveTime = FMath::Min(MoveTime, CurrentTime);
+	return LagCompensationPC ? ShotMoveTime - LagCompensationPC->GetServerRoundTripTime() - LagCompensationPC->GetInterpolationDelay() : ShotMoveTime;
+}
+
+void ALagCompensationCharacter::OnShotValidated(const FLCPendingShot& Shot, const FLCShotResult& Result, ALagCompensationCharacter* HitActor)
+{
+	ALagCompensationCharacter* Victim = Shot.Victim.Get();
+	bool bClientHit = Victim != nullptr;
+
+	bool ServerRegisterHit = HitActor != nullptr;
+
+	// per shot logs are Verbose, ULCShotValidationSubsystem keeps the hit agreement stats
+	if(ServerRegisterHit)
+	{
+		//we hit the player's rewound position!
+
+		if(!bClientHit)
 		{
-			//we hit something and it's a FakeCapsule representing the player's rewound position!
+			UE_LOG(LogLagCompensation, Verbose, TEXT("%s: Server: Due to an inconsistent nature of network delays we hit %s on the SERVER but missed on the CLIENT"), *GetName(), *HitActor->GetName());
+		}
+
+		UE_LOG(LogLagCompensation, Verbose, TEXT("%s: Server: hit %s (%s)"), *GetName(), *HitActor->GetName(), *StaticEnum<ELCHitZone>()->GetNameStringByValue((int64)Result.HitZone));
 			
+#if ENABLE_DRAW_DEBUG
+		ULCDebugDrawSubsystem* DebugDraw = GetWorld()->GetSubsystem<ULCDebugDrawSubsystem>();
+		if (DebugDraw && ULCDebugDrawSubsystem::IsEnabled())
+		{
 			UCapsuleComponent* ActorCapsule = HitActor->GetCapsuleComponent();
 			FVector CurrentCapsuleLocation = ActorCapsule ? ActorCapsule->GetComponentLocation() : HitActor->GetActorLocation();
 			float ActorCapsuleHalfHeight = ActorCapsule ? ActorCapsule->GetScaledCapsuleHalfHeight() : 96.f;
 
-			FVector HitRewoundPostion = OutHit.Actor.Get()->GetActorLocation();
-
-			if(!bClientHit)
-			{
-				UE_LOG(LogTemp, Warning, TEXT("%s: Server: Due to an inconsistent nature of network delays we hit %s on the SERVER but missed on the CLIENT"), *GetName(), *OutHit.Actor.Get()->GetName());
-			}
-				
-			DrawDebugCapsule(GetWorld(), ClientPosition, ActorCapsuleHalfHeight + 20.f, 33.f, FQuat::Identity, FColor::Blue, true);
-			DrawDebugRewind(CurrentCapsuleLocation, HitRewoundPostion, ActorCapsuleHalfHeight, OutHit.Location, StartLocation, EndLocation);
-				
-			ClientDrawDebugCapsule(ClientPosition, ActorCapsuleHalfHeight + 20, FColor::Yellow);
-			ClientDrawDebugRewind(CurrentCapsuleLocation, HitRewoundPostion, ActorCapsuleHalfHeight, OutHit.Location, StartLocation, EndLocation);
-				
-		}
-			
-		if((HitActor) == Victim && bClientHit && !(ServerRegisterHit) && bHitOccurred)
-		{
-			UE_LOG(LogTemp, Warning, TEXT("%s: Server: Due to an inconsistent nature of network delays we hit %s on CLIENT but missed on the SERVER"), *GetName(), *Victim->GetName());
-		}
-
-		for (TActorIterator<ALagCompensationCharacter> ActorItr(World); ActorItr; ++ActorItr)
-		{
-			TestCapsule->SetActorLocation(FVector(5000.f, 5000.f, 0.f));
+			FVector HitRewoundPostion = Result.RewoundPosition;
+			FVector HitLocation = Shot.StartLocation + Result.HitTime * (Shot.EndLocation - Shot.StartLocation);
+
+			FLCRewindDebugRecord Record;
+			Record.ClientPosition = Shot.ClientPosition;
+			Record.CurrentPosition = CurrentCapsuleLocation;
+			Record.RewoundPosition = HitRewoundPostion;
+			Record.StartLocation = Shot.StartLocation;
+			Record.HitLocation = HitLocation;
+			Record.HalfHeight = (uint16)FMath::Clamp(FMath::RoundToInt(ActorCapsuleHalfHeight), 0, (int32)MAX_uint16);
+			DebugDraw->AddRewind(Cast<ALagCompensationPlayerController>(GetController()), Record);
 		}
+#endif
+	}
+		
+	if(bClientHit && HitActor != Victim)
+	{
+		UE_LOG(LogLagCompensation, Verbose, TEXT("%s: Server: Due to an inconsistent nature of network delays we hit %s on CLIENT but missed on the SERVER"), *GetName(), *Victim->GetName());
 	}
 }
 
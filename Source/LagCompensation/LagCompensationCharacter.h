@@ -3,12 +3,17 @@
 #pragma once
 
 #include "CoreMinimal.h"
-#include "FakeCharacterCapsule.h"
 #include "GameFramework/Character.h"
 #include "GameFramework/CharacterMovementComponent.h"
+#include "LCClientMoveHistory.h"
+#include "LCHitbox.h"
+#include "LCSavedPositionHistory.h"
+#include "LCShotPacket.h"
 #include "LagCompensationCharacter.generated.h"
 
 class ALagCompensationPlayerController;
+struct FLCPendingShot;
+struct FLCShotResult;
 class UInputComponent;
 class USkeletalMeshComponent;
 class USceneComponent;
@@ -17,33 +22,8 @@ class UMotionControllerComponent;
 class UAnimMontage;
 class USoundBase;
 
-USTRUCT(BlueprintType)
-struct FSavedPosition
-{
-	GENERATED_USTRUCT_BODY()
-
-	FSavedPosition() : Position(FVector(0.f)), Rotation(FRotator(0.f)), bTeleported(false), Time(0.f), TimeStamp(0.f) {};
-
-	FSavedPosition(FVector InPos, FRotator InRot, bool InTeleported, float InTime, float InTimeStamp) : Position(InPos), Rotation(InRot), bTeleported(InTeleported), Time(InTime), TimeStamp(InTimeStamp) {};
-
-	/** Position of player at time Time. */
-	UPROPERTY()
-	FVector Position;
-
-	/** Rotation of player at time Time. */
-	UPROPERTY()
-	FRotator Rotation;
-
-	/** true if teleport occurred getting to current position (so don't interpolate) */
-	UPROPERTY()
-	bool bTeleported;
-
-	/** Current server world time when this position was updated. */
-	float Time;
-
-	/** Client timestamp associated with this position. */
-	float TimeStamp;
-};
+/** Sends a batch of shots to the server, see ALagCompensationCharacter::SendShotsOverride. */
+DECLARE_DELEGATE_TwoParams(FLCSendShotsDelegate, float /*BaseTimeStamp*/, const TArray<FLCShotPacket>& /*Shots*/);
 
 UCLASS(config=Game)
 class ALagCompensationCharacter : public ACharacter
@@ -87,6 +67,67 @@ class ALagCompensationCharacter : public ACharacter
 	UPROPERTY()
 	float MaxSavedPositionAge;
 
+	/**
+	 * Saved positions recorded per second on the server, at most one per server tick whatever rate the
+	 * owning client moves at. Also sizes the saved position history.
+	 */
+	UPROPERTY(Config)
+	float PositionSampleRate;
+
+	/** Server time the next saved position is due. */
+	float NextPositionSampleTime;
+
+	/** SavedMoves.GetNumOverwritten() when it was last checked, see RecordSavedPosition. */
+	int32 LastNumOverwritten;
+
+	/** Store saved positions with the compact encoding, about half the memory for 1/16 cm of error. */
+	UPROPERTY(Config)
+	bool bCompactSavedPositions;
+
+	/** Saved positions within this many cm of the line between their neighbours are dropped, 0 keeps them all. */
+	UPROPERTY(Config)
+	float SavedPositionTolerance;
+
+	/**
+	 * Rewind along the Hermite curve of the saved positions and velocities instead of straight lines. Follows
+	 * turns and jumps closely enough that 30 samples per second rewind about as well as 60 do linearly, so
+	 * PositionSampleRate can be halved; LagComp.CoreBenchmark compares them.
+	 */
+	UPROPERTY(Config)
+	bool bHermiteSavedPositions;
+
+	/** Slot of this character in the world's ULCRewindHistorySubsystem, INDEX_NONE when not recorded. */
+	int32 RewindHistorySlot;
+
+	/** Send the shots of a frame together, in one RPC, instead of one RPC per shot. */
+	UPROPERTY(Config)
+	bool bBatchShots;
+
+	/** Shots the server accepts in one RPC, the rest are dropped. */
+	UPROPERTY(Config)
+	int32 MaxShotsPerBatch;
+
+	/** Client: shots waiting for FlushPendingShots, and the timestamp of the first one. */
+	TArray<FLCShotPacket> PendingShots;
+	float PendingShotsBaseTimeStamp;
+
+	/** Moves per second ClientMoves holds over MaxSavedPositionAge, older ones are only found at saved positions. */
+	UPROPERTY(Config)
+	float MaxClientMoveRate;
+
+	/** Seconds a shot that arrived before the move it was fired in waits for it, then it is dropped. */
+	UPROPERTY(Config)
+	float MaxShotMoveWait;
+
+	/** Server: a shot waiting for its move, see MaxShotMoveWait. */
+	struct FShotAwaitingMove
+	{
+		FLCShotPacket Packet;
+		float BaseTimeStamp;
+		float ArrivalTime;
+	};
+	TArray<FShotAwaitingMove> ShotsAwaitingMove;
+
 public:
 	ALagCompensationCharacter(const FObjectInitializer& ObjectInitializer);
 
@@ -116,6 +157,13 @@ public:
 	UPROPERTY(EditDefaultsOnly, Category=Projectile)
 	TSubclassOf<class ALagCompensationProjectile> ProjectileClass;
 
+	/**
+	 * Shots fire a ProjectileClass projectile on the server instead of an instant trace. The projectile starts
+	 * at the shot's rewind time and is fast-forwarded against rewound characters, see ULCProjectileSubsystem.
+	 */
+	UPROPERTY(EditDefaultsOnly, Category=Projectile)
+	bool bFireProjectiles;
+
 	/** Sound to play each time we fire */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category=Gameplay)
 	USoundBase* FireSound;
@@ -128,22 +176,90 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
 	uint8 bUsingMotionControllers : 1;
 
-	UPROPERTY()
-	TArray<FSavedPosition> SavedMoves;
+	/** Capsules on the bones of Mesh that shots are tested against when the server records hitboxes. */
+	UPROPERTY(EditDefaultsOnly, Category=Gameplay)
+	TArray<FLCHitboxDefinition> Hitboxes;
+
+	/** Recent positions of this character, oldest first. */
+	FLCSavedPositionHistory SavedMoves;
+
+	/** Server: every move performed recently, to place the shots fired in them. */
+	FLCClientMoveHistory ClientMoves;
+
+	/**
+	 * Server: records the move just performed, and handles the shots that were waiting for it. Called after
+	 * every client move, and once per tick for characters moved by the server.
+	 */
+	void RecordMove();
+
+	/**
+	 * Server: where along its saved positions this character came closest to Position, a victim location a
+	 * client reported, between MinTime and MaxTime.
+	 * @return false if there is no saved position in the time range
+	 */
+	bool FindClosestPosition(const FVector& Position, float MinTime, float MaxTime, FLCClosestSavedPosition& OutClosest) const;
+
+	/** Server: records a saved position if one is due at PositionSampleRate. Called once per server tick. */
+	void SamplePosition(float WorldTime);
+
+	/** Server: records the position the character was just teleported to, so it is not interpolated into. */
+	void NotifyTeleported();
+
+	/**
+	 * Server: maps the timestamp of a move of this character to the server time it was performed at and the
+	 * location it left the character at, from ClientMoves or, for older moves, the saved positions.
+	 */
+	bool MapMoveTimeStamp(float TimeStamp, float& OutTime, FVector* OutPosition = nullptr) const;
+
+	/**
+	 * Server: time a shot fired by this character should be validated at, see ELCRewindTimeMode. MoveTime is
+	 * the server time the shot's move was performed at.
+	 */
+	float GetShotRewindTime(float PredictionAmount, float ClientTimeStamp, float MoveTime) const;
+
+	/** Server: called with the outcome of a shot fired by this character, HitActor is null on a miss. */
+	void OnShotValidated(const FLCPendingShot& Shot, const FLCShotResult& Result, ALagCompensationCharacter* HitActor);
+
+	/** Slot of this character in the world's rewind history, INDEX_NONE when not recorded. */
+	int32 GetRewindHistorySlot() const { return RewindHistorySlot; }
 
-	void FindClosestPosition(FVector Position);
-	void GetPositionForTime(float Time, FVector& OutPosition, ALagCompensationPlayerController* DebugViewer);
+	/**
+	 * Adds a shot to the batch sent to the server at the end of the tick.
+	 * @param PredictionTime	client side prediction time, see ALagCompensationPlayerController::GetPredictionTime
+	 * @param HitCharacter		character the shot hit on this side, if any
+	 */
+	void AddPendingShot(const FVector& StartLocation, const FVector& EndLocation, float PredictionTime, ALagCompensationCharacter* HitCharacter, const FVector& ClientPosition);
 
-	virtual void PositionUpdated();
+	/** Server: queues a batch of shots for validation, as if it came in through OnFire_Server. */
+	void ReceiveShots(float BaseTimeStamp, const TArray<FLCShotPacket>& Shots);
+
+	/** Called with the shot batches instead of the OnFire_Server RPC when bound. The benchmark uses it to delay and drop them. */
+	FLCSendShotsDelegate SendShotsOverride;
 
 protected:
 	
 	/** Fires a projectile. */
 	void OnFire();
 	
+	/** Sends the shots fired since the last flush in one RPC. */
+	void FlushPendingShots();
+
+	/** Shots fired by the client, timestamps are relative to BaseTimeStamp. */
 	UFUNCTION(Server, Unreliable)
-	void OnFire_Server(float PredictionAmount, FVector StartLocation, FVector EndLocation, ALagCompensationPlayerController* FireInitiator, ALagCompensationCharacter* Victim, FVector ClientPosition);
-	void OnFire_Server_Implementation(float PredictionAmount, FVector StartLocation, FVector EndLocation, ALagCompensationPlayerController* FireInitiator, ALagCompensationCharacter* Victim, FVector ClientPosition);
+	void OnFire_Server(float BaseTimeStamp, const TArray<FLCShotPacket>& Shots);
+	void OnFire_Server_Implementation(float BaseTimeStamp, const TArray<FLCShotPacket>& Shots);
+
+	/** Adds the current position to SavedMoves and the rewind log. */
+	void RecordSavedPosition(float WorldTime, bool bTeleported);
+
+	/**
+	 * Server: decodes a shot and queues it for validation. A shot whose move has not arrived yet waits for it,
+	 * saturated packets and shots fired in a move MapMoveTimeStamp can't find are dropped.
+	 */
+	void HandleShot(const FLCShotPacket& Packet, float BaseTimeStamp);
+
+	/** Server: handles the shots whose move has arrived, and drops the ones that waited longer than MaxShotMoveWait. */
+	void UpdateShotsAwaitingMove();
 
 	/** Resets HMD orientation and position in VR. */
 	void OnResetVR();
@@ -166,8 +282,6 @@ protected:
 	 */
 	void LookUpAtRate(float Rate);
 
-	UPROPERTY()
-	AFakeCharacterCapsule* TestCapsule;
 	
 protected:
 	// APawn interface
@@ -183,15 +297,5 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void AutoFire();
 
-	void DrawDebugRewind(FVector_NetQuantize TargetLocation, FVector_NetQuantize RewindLocation,
-		float TargetCapsuleHeight, FVector HitPoint, FVector StartLocation, FVector EndLocation);
-		
-	UFUNCTION(Client, Unreliable)
-	void ClientDrawDebugRewind(FVector_NetQuantize TargetLocation, FVector_NetQuantize RewindLocation,
-    		float TargetCapsuleHeight, FVector HitPoint, FVector StartLocation, FVector EndLocation);
-
-	UFUNCTION(Client, Unreliable)
-	void ClientDrawDebugCapsule(FVector Location, float HalfHeight, FColor DrawColor);
-
 };
 
@@ -1,6 +1,8 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "LagCompensationProjectile.h"
+#include "LagCompensation.h"
+#include "LagCompensationCharacter.h"
 #include "GameFramework/ProjectileMovementComponent.h"
 #include "Components/SphereComponent.h"
 
@@ -29,10 +31,21 @@ ALagCompensationProjectile::ALagCompensationProjectile()
 
 	// Die after 3 seconds by default
 	InitialLifeSpan = 3.0f;
+
+	// the server fires lag compensated projectiles, clients only see them
+	bReplicates = true;
+	SetReplicatingMovement(true);
 }
 
 void ALagCompensationProjectile::OnHit(UPrimitiveComponent* HitComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit)
 {
+	ALagCompensationCharacter* HitCharacter = Cast<ALagCompensationCharacter>(OtherActor);
+	if (HitCharacter && HitCharacter != GetInstigator() && HasAuthority())
+	{
+		OnCharacterHit(HitCharacter, Hit.ImpactPoint);
+		return;
+	}
+
 	// Only add impulse and destroy projectile if we hit a physics
 	if ((OtherActor != nullptr) && (OtherActor != this) && (OtherComp != nullptr) && OtherComp->IsSimulatingPhysics())
 	{
@@ -40,4 +53,10 @@ void ALagCompensationProjectile::OnHit(UPrimitiveComponent* HitComp, AActor* Oth
 
 		Destroy();
 	}
-}
\ No newline at end of file
+}
+
+void ALagCompensationProjectile::OnCharacterHit(ALagCompensationCharacter* HitCharacter, const FVector& HitLocation)
+{
+	UE_LOG(LogLagCompensation, Verbose, TEXT("%s: projectile hit %s at %s"), *GetNameSafe(GetInstigator()), *HitCharacter->GetName(), *HitLocation.ToString());
+	Destroy();
+}
@@ -6,6 +6,7 @@
 #include "GameFramework/Actor.h"
 #include "LagCompensationProjectile.generated.h"
 
+class ALagCompensationCharacter;
 class USphereComponent;
 class UProjectileMovementComponent;
 
@@ -29,6 +30,9 @@ public:
 	UFUNCTION()
 	void OnHit(UPrimitiveComponent* HitComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit);
 
+	/** Server: called when the projectile hits a character, live or rewound by ULCProjectileSubsystem. */
+	virtual void OnCharacterHit(ALagCompensationCharacter* HitCharacter, const FVector& HitLocation);
+
 	/** Returns CollisionComp subobject **/
 	USphereComponent* GetCollisionComp() const { return CollisionComp; }
 	/** Returns ProjectileMovement subobject **/
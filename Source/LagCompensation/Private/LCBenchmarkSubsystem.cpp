@@ -0,0 +1,486 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCBenchmarkSubsystem.h"
+
+#include "AIController.h"
+#include "Engine/NetDriver.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "GameFramework/GameModeBase.h"
+#include "GameFramework/PlayerStart.h"
+#include "LagCompensation/LagCompensation.h"
+#include "LagCompensation/LagCompensationCharacter.h"
+#include "LCCharacterMovementComponent.h"
+#include "LCRewindHistorySubsystem.h"
+#include "LCShotValidationSubsystem.h"
+#include "Misc/CommandLine.h"
+
+namespace LCBenchmark
+{
+	/** A fired shot and a validated one are the same if their move timestamps match to the packet's precision. */
+	constexpr float TimeStampMatchTolerance = 0.0005f;
+
+	/** Shots without a result after this many seconds were lost or rejected. */
+	constexpr float MaxShotAge = 10.f;
+
+	static float GetPercentile(TArray<float> Values, float Percentile)
+	{
+		if (Values.Num() == 0)
+		{
+			return 0.f;
+		}
+		Values.Sort();
+		return Values[FMath::Clamp(FMath::FloorToInt(Percentile * Values.Num()), 0, Values.Num() - 1)];
+	}
+
+#if !UE_BUILD_SHIPPING
+	static void Run(const TArray<FString>& Args, UWorld* World)
+	{
+		ULCBenchmarkSubsystem* Benchmark = World ? World->GetSubsystem<ULCBenchmarkSubsystem>() : nullptr;
+		if (Benchmark == nullptr || World->GetNetMode() == NM_Client)
+		{
+			UE_LOG(LogLagCompensation, Warning, TEXT("LagComp.Benchmark only runs on a server"));
+			return;
+		}
+
+		if (Args.Num() > 0 && Args[0] == TEXT("stop"))
+		{
+			Benchmark->StopBenchmark();
+		}
+		else if (!Benchmark->IsRunning())
+		{
+			Benchmark->StartBenchmark(Args);
+		}
+	}
+
+	static FAutoConsoleCommandWithWorldAndArgs RunCommand(
+		TEXT("LagComp.Benchmark"),
+		TEXT("Runs the lag compensation benchmark with bots. Arguments: [bots] [seconds] [latency ms] [jitter ms] [loss %], or stop."),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&Run));
+#endif
+}
+
+ULCBenchmarkSubsystem::ULCBenchmarkSubsystem()
+	: ArenaCenter(FVector::ZeroVector)
+	, bRunning(false)
+	, ConfiguredRewindTimeMode(ELCRewindTimeMode::ClientPing)
+	, bExitWhenDone(false)
+	, StartTime(0.f)
+	, EndTime(0.f)
+	, StartProcessingTime(0.0)
+	, StartShotsValidated(0)
+	, ShotsFired(0)
+	, ShotsLost(0)
+	, ShotsValidated(0)
+	, ShotsAgreed(0)
+	, ClientHits(0)
+	, ServerHits(0)
+{
+	NumBots = 16;
+	Duration = 30.f;
+	Latency = 100.f;
+	Jitter = 20.f;
+	PacketLoss = 1.f;
+	FireInterval = 0.1f;
+	AimError = 40.f;
+	ArenaRadius = 1500.f;
+}
+
+bool ULCBenchmarkSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+#if UE_BUILD_SHIPPING
+	return false;
+#else
+	UWorld* World = Cast<UWorld>(Outer);
+	return World && World->IsGameWorld();
+#endif
+}
+
+float ULCBenchmarkSubsystem::GetFireToResultTime(float Percentile) const
+{
+	return LCBenchmark::GetPercentile(FireToResultTimes, Percentile);
+}
+
+void ULCBenchmarkSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Collection.InitializeDependency(ULCShotValidationSubsystem::StaticClass());
+	Super::Initialize(Collection);
+
+	PostActorTickHandle = FWorldDelegates::OnWorldPostActorTick.AddUObject(this, &ULCBenchmarkSubsystem::OnWorldPostActorTick);
+}
+
+void ULCBenchmarkSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldPostActorTick.Remove(PostActorTickHandle);
+	if (bRunning)
+	{
+		StopBenchmark();
+	}
+
+	Super::Deinitialize();
+}
+
+void ULCBenchmarkSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	const TCHAR* CommandLine = FCommandLine::Get();
+	if (InWorld.GetNetMode() != NM_Client && FParse::Param(CommandLine, TEXT("LagCompBenchmark")))
+	{
+		FParse::Value(CommandLine, TEXT("LagCompBots="), NumBots);
+		FParse::Value(CommandLine, TEXT("LagCompDuration="), Duration);
+		FParse::Value(CommandLine, TEXT("LagCompLatency="), Latency);
+		FParse::Value(CommandLine, TEXT("LagCompJitter="), Jitter);
+		FParse::Value(CommandLine, TEXT("LagCompLoss="), PacketLoss);
+		bExitWhenDone = true;
+		StartBenchmark(TArray<FString>());
+	}
+}
+
+void ULCBenchmarkSubsystem::StartBenchmark(const TArray<FString>& Args)
+{
+	UWorld* World = GetWorld();
+	ULCShotValidationSubsystem* ShotValidation = World->GetSubsystem<ULCShotValidationSubsystem>();
+	if (bRunning || ShotValidation == nullptr)
+	{
+		return;
+	}
+
+	if (Args.Num() > 0) NumBots = FCString::Atoi(*Args[0]);
+	if (Args.Num() > 1) Duration = FCString::Atof(*Args[1]);
+	if (Args.Num() > 2) Latency = FCString::Atof(*Args[2]);
+	if (Args.Num() > 3) Jitter = FCString::Atof(*Args[3]);
+	if (Args.Num() > 4) PacketLoss = FCString::Atof(*Args[4]);
+	NumBots = FMath::Max(NumBots, 2);
+
+	// same bots and shots for the same settings
+	Random.Initialize(1234);
+	ShotsFired = ShotsLost = ShotsValidated = ShotsAgreed = ClientHits = ServerHits = 0;
+	FireToResultTimes.Reset();
+	QueueToResultTimes.Reset();
+	InFlight.Reset();
+
+	SpawnBots();
+	ApplyPacketSimulation(true);
+
+	// the bots' moves are stamped with world time and they have no controller to measure a connection with, so
+	// only the prediction time they send stands for the latency they shoot through
+	ConfiguredRewindTimeMode = ShotValidation->GetRewindTimeMode();
+	ShotValidation->SetRewindTimeMode(ELCRewindTimeMode::ClientPing);
+
+	StartTime = World->GetTimeSeconds();
+	EndTime = StartTime + Duration;
+	StartProcessingTime = ShotValidation->GetTotalProcessingTime();
+	StartShotsValidated = ShotValidation->GetTotalShotsValidated();
+	ShotValidatedHandle = ShotValidation->OnShotValidated.AddUObject(this, &ULCBenchmarkSubsystem::HandleShotValidated);
+	bRunning = true;
+
+	UE_LOG(LogLagCompensation, Display, TEXT("Benchmark started: %d bots for %.1f s, %.0f ms round trip + up to %.0f ms jitter each way, %.1f%% loss"),
+		Bots.Num(), Duration, Latency, Jitter, PacketLoss);
+}
+
+void ULCBenchmarkSubsystem::StopBenchmark()
+{
+	if (!bRunning)
+	{
+		return;
+	}
+
+	bRunning = false;
+	LogReport();
+
+	if (ULCShotValidationSubsystem* ShotValidation = GetWorld()->GetSubsystem<ULCShotValidationSubsystem>())
+	{
+		ShotValidation->OnShotValidated.Remove(ShotValidatedHandle);
+		ShotValidation->SetRewindTimeMode(ConfiguredRewindTimeMode);
+	}
+	ApplyPacketSimulation(false);
+
+	for (FBot& Bot : Bots)
+	{
+		if (ALagCompensationCharacter* Character = Bot.Character.Get())
+		{
+			Character->SendShotsOverride.Unbind();
+			if (AController* Controller = Character->GetController())
+			{
+				Controller->Destroy();
+			}
+			Character->Destroy();
+		}
+	}
+	Bots.Reset();
+	InFlight.Reset();
+
+	if (bExitWhenDone)
+	{
+		FPlatformMisc::RequestExit(false);
+	}
+}
+
+void ULCBenchmarkSubsystem::SpawnBots()
+{
+	UWorld* World = GetWorld();
+
+	UClass* BotClass = ALagCompensationCharacter::StaticClass();
+	const AGameModeBase* GameMode = World->GetAuthGameMode();
+	if (GameMode && GameMode->DefaultPawnClass && GameMode->DefaultPawnClass->IsChildOf(ALagCompensationCharacter::StaticClass()))
+	{
+		BotClass = GameMode->DefaultPawnClass;
+	}
+
+	ArenaCenter = FVector(0.f, 0.f, 200.f);
+	for (TActorIterator<APlayerStart> It(World); It; ++It)
+	{
+		ArenaCenter = It->GetActorLocation();
+		break;
+	}
+
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+
+	for (int32 Index = 0; Index < NumBots; Index++)
+	{
+		const float Angle = 2.f * PI * Index / NumBots;
+		const FVector Location = ArenaCenter + FVector(FMath::Cos(Angle), FMath::Sin(Angle), 0.f) * ArenaRadius * 0.5f;
+		ALagCompensationCharacter* Character = World->SpawnActor<ALagCompensationCharacter>(BotClass, Location, FRotator::ZeroRotator, SpawnParameters);
+		if (Character == nullptr)
+		{
+			continue;
+		}
+
+		Character->AIControllerClass = AAIController::StaticClass();
+		Character->SpawnDefaultController();
+		Character->SendShotsOverride.BindUObject(this, &ULCBenchmarkSubsystem::SendShots, Bots.Num());
+
+		FBot& Bot = Bots.AddDefaulted_GetRef();
+		Bot.Character = Character;
+		Bot.MoveDirection = FVector::ZeroVector;
+		Bot.NextTurnTime = 0.f;
+		Bot.NextFireTime = World->GetTimeSeconds() + Random.FRand() * FireInterval;
+	}
+}
+
+void ULCBenchmarkSubsystem::OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	if (!bRunning || World != GetWorld())
+	{
+		return;
+	}
+
+	const float WorldTime = World->GetTimeSeconds();
+	if (WorldTime >= EndTime)
+	{
+		StopBenchmark();
+		return;
+	}
+
+	for (int32 BotIndex = 0; BotIndex < Bots.Num(); BotIndex++)
+	{
+		TickBot(BotIndex, WorldTime);
+	}
+
+	DeliverShots(WorldTime);
+}
+
+void ULCBenchmarkSubsystem::TickBot(int32 BotIndex, float WorldTime)
+{
+	FBot& Bot = Bots[BotIndex];
+	ALagCompensationCharacter* Character = Bot.Character.Get();
+	if (Character == nullptr)
+	{
+		return;
+	}
+
+	// run in a random direction for a while, back towards the center when too far out
+	if (WorldTime >= Bot.NextTurnTime)
+	{
+		const FVector ToCenter = (ArenaCenter - Character->GetActorLocation()) * FVector(1.f, 1.f, 0.f);
+		Bot.MoveDirection = ToCenter.Size() > ArenaRadius ? ToCenter.GetSafeNormal() : FVector(Random.GetUnitVector() * FVector(1.f, 1.f, 0.f)).GetSafeNormal();
+		Bot.NextTurnTime = WorldTime + Random.FRandRange(0.5f, 2.f);
+	}
+	Character->AddMovementInput(Bot.MoveDirection, 1.f);
+
+	if (WorldTime >= Bot.NextFireTime)
+	{
+		FireShot(BotIndex, WorldTime);
+		Bot.NextFireTime += FireInterval;
+	}
+}
+
+void ULCBenchmarkSubsystem::FireShot(int32 BotIndex, float WorldTime)
+{
+	const ULCRewindHistorySubsystem* RewindHistory = GetWorld()->GetSubsystem<ULCRewindHistorySubsystem>();
+	ALagCompensationCharacter* Shooter = Bots[BotIndex].Character.Get();
+	if (RewindHistory == nullptr || Shooter == nullptr)
+	{
+		return;
+	}
+
+	// the world as the bot's client shows it, one downlink delay old
+	TArray<int32> Slots;
+	TArray<ALagCompensationCharacter*> Characters;
+	int32 ShooterIndex = INDEX_NONE;
+	for (const FBot& Bot : Bots)
+	{
+		ALagCompensationCharacter* Character = Bot.Character.Get();
+		if (Character && Character->GetRewindHistorySlot() != INDEX_NONE)
+		{
+			if (Character == Shooter)
+			{
+				ShooterIndex = Slots.Num();
+			}
+			Slots.Add(Character->GetRewindHistorySlot());
+			Characters.Add(Character);
+		}
+	}
+	if (Slots.Num() < 2)
+	{
+		return;
+	}
+
+	FLCCapsuleBatch ClientView;
+	RewindHistory->RewindSlots(WorldTime - SampleDelay(), Slots, ClientView);
+
+	int32 TargetIndex = Random.RandHelper(Slots.Num() - 1);
+	if (TargetIndex >= ShooterIndex && ShooterIndex != INDEX_NONE)
+	{
+		TargetIndex++;
+	}
+
+	const FVector StartLocation = Shooter->GetPawnViewLocation();
+	const FVector AimPoint = ClientView.GetCenter(TargetIndex) + Random.GetUnitVector() * Random.FRandRange(0.f, AimError);
+	const FVector EndLocation = StartLocation + (AimPoint - StartLocation).GetSafeNormal() * 10000.f;
+
+	float HitTime;
+	const int32 HitIndex = FLCRewindMath::SegmentCapsuleBatchIntersection(StartLocation, EndLocation, ClientView, ShooterIndex, HitTime);
+	ALagCompensationCharacter* HitCharacter = HitIndex != INDEX_NONE ? Characters[HitIndex] : nullptr;
+
+	// the client's prediction time, its ping, is the average round trip
+	const float PredictionTime = (Latency + Jitter) * 0.001f;
+	Shooter->AddPendingShot(StartLocation, EndLocation, PredictionTime, HitCharacter, HitCharacter ? ClientView.GetCenter(HitIndex) : FVector::ZeroVector);
+
+	// the move timestamp goes with the shot, it is how the result is matched to when the shot was fired
+	TArray<TPair<float, float>>& ShotsAwaitingResult = Bots[BotIndex].ShotsAwaitingResult;
+	ShotsAwaitingResult.RemoveAll([WorldTime](const TPair<float, float>& Fired) { return Fired.Value < WorldTime - LCBenchmark::MaxShotAge; });
+	if (const ULCCharacterMovementComponent* MovementComponent = Cast<ULCCharacterMovementComponent>(Shooter->GetMovementComponent()))
+	{
+		ShotsAwaitingResult.Emplace(MovementComponent->GetCurrentSynchTime(), WorldTime);
+	}
+
+	ShotsFired++;
+	ClientHits += HitCharacter ? 1 : 0;
+}
+
+void ULCBenchmarkSubsystem::SendShots(float BaseTimeStamp, const TArray<FLCShotPacket>& Shots, int32 BotIndex)
+{
+	if (Random.FRand() * 100.f < PacketLoss)
+	{
+		ShotsLost += Shots.Num();
+		return;
+	}
+
+	FDelayedShots& Delayed = InFlight.AddDefaulted_GetRef();
+	Delayed.Shooter = Bots[BotIndex].Character;
+	Delayed.DeliveryTime = GetWorld()->GetTimeSeconds() + SampleDelay();
+	Delayed.BaseTimeStamp = BaseTimeStamp;
+	Delayed.Shots = Shots;
+}
+
+void ULCBenchmarkSubsystem::DeliverShots(float WorldTime)
+{
+	for (int32 Index = 0; Index < InFlight.Num();)
+	{
+		FDelayedShots& Delayed = InFlight[Index];
+		if (Delayed.DeliveryTime > WorldTime)
+		{
+			Index++;
+			continue;
+		}
+
+		if (ALagCompensationCharacter* Shooter = Delayed.Shooter.Get())
+		{
+			Shooter->ReceiveShots(Delayed.BaseTimeStamp, Delayed.Shots);
+		}
+		InFlight.RemoveAtSwap(Index, 1, false);
+	}
+}
+
+void ULCBenchmarkSubsystem::HandleShotValidated(const FLCPendingShot& Shot, const FLCShotResult& Result, ALagCompensationCharacter* HitCharacter)
+{
+	const ALagCompensationCharacter* Shooter = Shot.Shooter.Get();
+	const int32 BotIndex = Bots.IndexOfByPredicate([Shooter](const FBot& Bot) { return Bot.Character == Shooter; });
+	if (BotIndex == INDEX_NONE)
+	{
+		return;
+	}
+
+	ShotsValidated++;
+	ServerHits += HitCharacter ? 1 : 0;
+	ShotsAgreed += HitCharacter == Shot.Victim.Get() ? 1 : 0;
+	QueueToResultTimes.Add((FPlatformTime::Seconds() - Shot.QueuedTime) * 1000.0);
+
+	// shots fired in the same move are interchangeable, they left at the same time
+	TArray<TPair<float, float>>& ShotsAwaitingResult = Bots[BotIndex].ShotsAwaitingResult;
+	const int32 FiredIndex = ShotsAwaitingResult.IndexOfByPredicate([&Shot](const TPair<float, float>& Fired)
+	{
+		return FMath::Abs(Fired.Key - Shot.ClientTimeStamp) <= LCBenchmark::TimeStampMatchTolerance;
+	});
+	if (FiredIndex != INDEX_NONE)
+	{
+		FireToResultTimes.Add((GetWorld()->GetTimeSeconds() - ShotsAwaitingResult[FiredIndex].Value) * 1000.f);
+		ShotsAwaitingResult.RemoveAt(FiredIndex, 1, false);
+	}
+}
+
+float ULCBenchmarkSubsystem::SampleDelay()
+{
+	return (Latency * 0.5f + Random.FRandRange(0.f, Jitter)) * 0.001f;
+}
+
+void ULCBenchmarkSubsystem::ApplyPacketSimulation(bool bEnable)
+{
+#if DO_ENABLE_NET_TEST
+	if (UNetDriver* NetDriver = GetWorld()->GetNetDriver())
+	{
+		FPacketSimulationSettings Settings;
+		if (bEnable)
+		{
+			// the net driver lags what it sends, each side adds half the round trip
+			Settings.PktLag = FMath::RoundToInt(Latency * 0.5f);
+			Settings.PktLagVariance = FMath::RoundToInt(Jitter);
+			Settings.PktLoss = FMath::RoundToInt(PacketLoss);
+		}
+		NetDriver->SetPacketSimulationSettings(Settings);
+	}
+#endif
+}
+
+void ULCBenchmarkSubsystem::LogReport() const
+{
+	const ULCShotValidationSubsystem* ShotValidation = GetWorld()->GetSubsystem<ULCShotValidationSubsystem>();
+	const float Elapsed = FMath::Max(GetWorld()->GetTimeSeconds() - StartTime, KINDA_SMALL_NUMBER);
+	const int64 ShotsProcessed = ShotValidation ? ShotValidation->GetTotalShotsValidated() - StartShotsValidated : 0;
+	const double ProcessingTime = ShotValidation ? ShotValidation->GetTotalProcessingTime() - StartProcessingTime : 0.0;
+
+	UE_LOG(LogLagCompensation, Display, TEXT("Benchmark: %d bots, %.1f s, %.0f ms round trip + up to %.0f ms jitter each way, %.1f%% loss"),
+		Bots.Num(), Elapsed, Latency, Jitter, PacketLoss);
+	UE_LOG(LogLagCompensation, Display, TEXT("  shots: %d fired, %d lost, %d validated, %.1f validated/s"),
+		ShotsFired, ShotsLost, ShotsValidated, ShotsValidated / Elapsed);
+	UE_LOG(LogLagCompensation, Display, TEXT("  validation cost: %.2f us/shot, %.0f shots/s of game thread time"),
+		ShotsProcessed > 0 ? ProcessingTime * 1000000.0 / ShotsProcessed : 0.0, ProcessingTime > 0.0 ? ShotsProcessed / ProcessingTime : 0.0);
+	using LCBenchmark::GetPercentile;
+	UE_LOG(LogLagCompensation, Display, TEXT("  shot latency, fire to result: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms"),
+		GetPercentile(FireToResultTimes, 0.5f), GetPercentile(FireToResultTimes, 0.9f), GetPercentile(FireToResultTimes, 0.99f), GetPercentile(FireToResultTimes, 1.f));
+	UE_LOG(LogLagCompensation, Display, TEXT("  queued to result on the server (real time): p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms"),
+		GetPercentile(QueueToResultTimes, 0.5f), GetPercentile(QueueToResultTimes, 0.9f), GetPercentile(QueueToResultTimes, 0.99f), GetPercentile(QueueToResultTimes, 1.f));
+	UE_LOG(LogLagCompensation, Display, TEXT("  hit agreement: %.1f%% (%d client hits, %d server hits)"),
+		ShotsValidated > 0 ? 100.f * ShotsAgreed / ShotsValidated : 100.f, ClientHits, ServerHits);
+
+	// the bots are moved and shoot on the server, their latency is simulated here and not by the net driver
+	const UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	UE_LOG(LogLagCompensation, Display, TEXT("  not exercised by the bots: client move timestamps, MoveTimeStamp and Adaptive rewind times (shots ran as ClientPing, configured %s), shots waiting for or rejected for their move"),
+		*UEnum::GetValueAsString(ConfiguredRewindTimeMode));
+	UE_LOG(LogLagCompensation, Display, TEXT("  net driver packet simulation: %d client connections, none of them bots"),
+		NetDriver ? NetDriver->ClientConnections.Num() : 0);
+}
@@ -5,10 +5,12 @@
 
 #include "DrawDebugHelpers.h"
 #include "LagCompensation/LagCompensationCharacter.h"
+#include "LagCompensationPlayerController.h"
 
 float ULCCharacterMovementComponent::GetCurrentMovementTime() const
 {
-	return ((GetOwner()->GetLocalRole() == ROLE_AutonomousProxy) || (GetNetMode() == NM_DedicatedServer) || ((GetNetMode() == NM_ListenServer) && !CharacterOwner->IsLocallyControlled()))
+	// server side AI and the listen server's own pawn are not driven by client moves and use the world time
+	return ((GetOwner()->GetLocalRole() == ROLE_AutonomousProxy) || (((GetNetMode() == NM_DedicatedServer) || (GetNetMode() == NM_ListenServer)) && !CharacterOwner->IsLocallyControlled()))
 		? CurrentServerMoveTime
 		: CharacterOwner->GetWorld()->GetTimeSeconds();
 }
@@ -28,22 +30,36 @@ float ULCCharacterMovementComponent::GetCurrentSynchTime() const
 
 
 
-void ULCCharacterMovementComponent::PerformMovement(float DeltaTime)
+void ULCCharacterMovementComponent::OnTeleported()
 {
-	Super::PerformMovement(DeltaTime);
+	Super::OnTeleported();
 
-	ALagCompensationCharacter* Owner = CharacterOwner? Cast<ALagCompensationCharacter>(CharacterOwner) : nullptr;
-	if(Owner)
+	ALagCompensationCharacter* Owner = CharacterOwner ? Cast<ALagCompensationCharacter>(CharacterOwner) : nullptr;
+	if (Owner)
 	{
-		Owner->PositionUpdated();
+		Owner->NotifyTeleported();
 	}
 }
 
 void ULCCharacterMovementComponent::MoveAutonomous(float ClientTimeStamp, float DeltaTime, uint8 CompressedFlags,
 	const FVector& NewAccel)
 {
+	// set before the move is performed, the next saved position carries this timestamp
+	CurrentServerMoveTime = ClientTimeStamp;
+
 	Super::MoveAutonomous(ClientTimeStamp, DeltaTime, CompressedFlags, NewAccel);
 
-	CurrentServerMoveTime = ClientTimeStamp;
+	// every move is recorded, shots may be fired in moves between two saved positions
+	ALagCompensationCharacter* LagCompensationCharacter = Cast<ALagCompensationCharacter>(CharacterOwner);
+	if (LagCompensationCharacter)
+	{
+		LagCompensationCharacter->RecordMove();
+	}
+
+	ALagCompensationPlayerController* LagCompensationPC = CharacterOwner ? Cast<ALagCompensationPlayerController>(CharacterOwner->GetController()) : nullptr;
+	if (LagCompensationPC)
+	{
+		LagCompensationPC->OnClientMovePerformed(ClientTimeStamp);
+	}
 }
 
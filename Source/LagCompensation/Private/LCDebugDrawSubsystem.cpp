@@ -0,0 +1,183 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCDebugDrawSubsystem.h"
+
+#include "DrawDebugHelpers.h"
+#include "Engine/World.h"
+#include "LagCompensationPlayerController.h"
+
+#if ENABLE_DRAW_DEBUG
+static TAutoConsoleVariable<int32> CVarLagCompDebugDraw(
+	TEXT("LagComp.DebugDraw"),
+	1,
+	TEXT("Draws shot traces and server rewinds. 0: off, 1: on."));
+#endif
+
+ULCDebugDrawSubsystem::ULCDebugDrawSubsystem()
+	: NextDrawn(0)
+	, TimeSinceFlush(0.f)
+{
+	FlushInterval = 0.25f;
+	MaxRecordsPerFlush = 16;
+	MaxDrawnRewinds = 32;
+}
+
+bool ULCDebugDrawSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+#if ENABLE_DRAW_DEBUG
+	UWorld* World = Cast<UWorld>(Outer);
+	return World && World->IsGameWorld();
+#else
+	return false;
+#endif
+}
+
+void ULCDebugDrawSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	PostActorTickHandle = FWorldDelegates::OnWorldPostActorTick.AddUObject(this, &ULCDebugDrawSubsystem::OnWorldPostActorTick);
+}
+
+void ULCDebugDrawSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldPostActorTick.Remove(PostActorTickHandle);
+	Pending.Reset();
+	Drawn.Reset();
+
+	Super::Deinitialize();
+}
+
+bool ULCDebugDrawSubsystem::IsEnabled()
+{
+#if ENABLE_DRAW_DEBUG
+	return CVarLagCompDebugDraw.GetValueOnGameThread() != 0;
+#else
+	return false;
+#endif
+}
+
+EDrawDebugTrace::Type ULCDebugDrawSubsystem::GetTraceDrawType()
+{
+	return IsEnabled() ? EDrawDebugTrace::ForDuration : EDrawDebugTrace::None;
+}
+
+void ULCDebugDrawSubsystem::AddRewind(ALagCompensationPlayerController* Shooter, const FLCRewindDebugRecord& Record)
+{
+#if ENABLE_DRAW_DEBUG
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	AddDrawn(Record, false);
+
+	// a listen server's own shots are already drawn above
+	if (Shooter == nullptr || Shooter->IsLocalController())
+	{
+		return;
+	}
+
+	FPendingRecords* ShooterRecords = Pending.FindByPredicate([Shooter](const FPendingRecords& Entry) { return Entry.Shooter == Shooter; });
+	if (ShooterRecords == nullptr)
+	{
+		ShooterRecords = &Pending.AddDefaulted_GetRef();
+		ShooterRecords->Shooter = Shooter;
+	}
+	if (ShooterRecords->Records.Num() >= MaxRecordsPerFlush)
+	{
+		ShooterRecords->Records.RemoveAt(0, 1, false);
+	}
+	ShooterRecords->Records.Add(Record);
+#endif
+}
+
+void ULCDebugDrawSubsystem::AddRemoteRewinds(const TArray<FLCRewindDebugRecord>& Records)
+{
+#if ENABLE_DRAW_DEBUG
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	for (const FLCRewindDebugRecord& Record : Records)
+	{
+		AddDrawn(Record, true);
+	}
+#endif
+}
+
+void ULCDebugDrawSubsystem::AddDrawn(const FLCRewindDebugRecord& Record, bool bRemote)
+{
+	if (MaxDrawnRewinds <= 0)
+	{
+		return;
+	}
+
+	if (Drawn.Num() < MaxDrawnRewinds)
+	{
+		Drawn.Add({ Record, bRemote });
+	}
+	else
+	{
+		Drawn[NextDrawn] = { Record, bRemote };
+		NextDrawn = (NextDrawn + 1) % Drawn.Num();
+	}
+}
+
+void ULCDebugDrawSubsystem::OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+#if ENABLE_DRAW_DEBUG
+	if (World != GetWorld())
+	{
+		return;
+	}
+
+	TimeSinceFlush += DeltaSeconds;
+	if (TimeSinceFlush >= FlushInterval)
+	{
+		TimeSinceFlush = 0.f;
+		Flush();
+	}
+
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	// single frame primitives, the line batcher is emptied every frame
+	for (const FDrawnRewind& Rewind : Drawn)
+	{
+		const FLCRewindDebugRecord& Record = Rewind.Record;
+		const float HalfHeight = Record.HalfHeight;
+		DrawDebugCapsule(World, Record.ClientPosition, HalfHeight + 20.f, 33.f, FQuat::Identity, Rewind.bRemote ? FColor::Yellow : FColor::Blue);
+		DrawDebugLine(World, Record.StartLocation, Record.HitLocation, FColor::Magenta);
+		DrawDebugSphere(World, Record.HitLocation, 5.f, 10, FColor::Orange);
+		DrawDebugCapsule(World, Record.CurrentPosition, HalfHeight, 33.f, FQuat::Identity, FColor::Black);
+		DrawDebugCapsule(World, Record.RewoundPosition, HalfHeight - 20.f, 33.f, FQuat::Identity, FColor::White);
+	}
+#endif
+}
+
+void ULCDebugDrawSubsystem::Flush()
+{
+#if ENABLE_DRAW_DEBUG
+	for (int32 Index = Pending.Num() - 1; Index >= 0; Index--)
+	{
+		FPendingRecords& ShooterRecords = Pending[Index];
+		ALagCompensationPlayerController* Shooter = ShooterRecords.Shooter.Get();
+		if (Shooter == nullptr)
+		{
+			Pending.RemoveAtSwap(Index);
+			continue;
+		}
+
+		if (ShooterRecords.Records.Num() > 0)
+		{
+			Shooter->ClientDrawDebugRewinds(ShooterRecords.Records);
+			ShooterRecords.Records.Reset();
+		}
+	}
+#endif
+}
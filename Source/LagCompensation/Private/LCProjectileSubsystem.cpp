@@ -0,0 +1,250 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCProjectileSubsystem.h"
+
+#include "Components/SphereComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/ProjectileMovementComponent.h"
+#include "LagCompensation/LagCompensation.h"
+#include "LagCompensation/LagCompensationCharacter.h"
+#include "LagCompensation/LagCompensationProjectile.h"
+#include "LCRewindHistorySubsystem.h"
+
+DECLARE_CYCLE_STAT(TEXT("Projectile Catch Up"), STAT_LagComp_ProjectileCatchUp, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Projectile Sub-steps"), STAT_LagComp_ProjectileSubSteps, STATGROUP_LagComp);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Projectiles Catching Up"), STAT_LagComp_ProjectilesCatchingUp, STATGROUP_LagComp);
+
+ULCProjectileSubsystem::ULCProjectileSubsystem()
+{
+	MaxForwardTime = 0.25f;
+	SubStepTime = 1.f / 60.f;
+	MaxSubStepsPerTick = 64;
+}
+
+bool ULCProjectileSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	UWorld* World = Cast<UWorld>(Outer);
+	return World && World->IsGameWorld();
+}
+
+void ULCProjectileSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Collection.InitializeDependency(ULCRewindHistorySubsystem::StaticClass());
+	Super::Initialize(Collection);
+
+	PostActorTickHandle = FWorldDelegates::OnWorldPostActorTick.AddUObject(this, &ULCProjectileSubsystem::OnWorldPostActorTick);
+}
+
+void ULCProjectileSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldPostActorTick.Remove(PostActorTickHandle);
+	CatchingUp.Reset();
+
+	Super::Deinitialize();
+}
+
+ALagCompensationProjectile* ULCProjectileSubsystem::SpawnProjectile(TSubclassOf<ALagCompensationProjectile> ProjectileClass, ALagCompensationCharacter* Shooter,
+	const FVector& Location, const FRotator& Rotation, float FireTime)
+{
+	UWorld* World = GetWorld();
+	if (ProjectileClass == nullptr || World->GetNetMode() == NM_Client)
+	{
+		return nullptr;
+	}
+
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.Owner = Shooter;
+	SpawnParameters.Instigator = Shooter;
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButDontSpawnIfColliding;
+	ALagCompensationProjectile* Projectile = World->SpawnActor<ALagCompensationProjectile>(ProjectileClass, Location, Rotation, SpawnParameters);
+	if (Projectile == nullptr)
+	{
+		return nullptr;
+	}
+
+	const float CurrentTime = World->GetTimeSeconds();
+	UProjectileMovementComponent* ProjectileMovement = Projectile->GetProjectileMovement();
+	if (FireTime >= CurrentTime || ProjectileMovement == nullptr)
+	{
+		return Projectile;
+	}
+
+	// the subsystem moves it until it has caught up
+	ProjectileMovement->SetComponentTickEnabled(false);
+
+	FCatchUp& CatchUp = CatchingUp.AddDefaulted_GetRef();
+	CatchUp.Projectile = Projectile;
+	CatchUp.ShooterSlot = Shooter ? Shooter->GetRewindHistorySlot() : INDEX_NONE;
+	CatchUp.Time = FMath::Max(FireTime, CurrentTime - MaxForwardTime);
+	CatchUp.Location = Projectile->GetActorLocation();
+	CatchUp.Velocity = ProjectileMovement->Velocity;
+	return Projectile;
+}
+
+void ULCProjectileSubsystem::OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	if (World != GetWorld() || CatchingUp.Num() == 0)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_LagComp_ProjectileCatchUp);
+	CSV_SCOPED_TIMING_STAT(LagComp, ProjectileCatchUp);
+
+	// the characters' bounds over everything caught up this tick, and the live characters the world sweeps ignore
+	const float CurrentTime = World->GetTimeSeconds();
+	const ULCRewindHistorySubsystem* RewindHistory = World->GetSubsystem<ULCRewindHistorySubsystem>();
+	FCollisionQueryParams CharacterParams(SCENE_QUERY_STAT(LagCompProjectileCatchUp), false);
+	SlotBounds.Reset();
+	if (RewindHistory)
+	{
+		float FromTime = CurrentTime;
+		for (const FCatchUp& CatchUp : CatchingUp)
+		{
+			FromTime = FMath::Min(FromTime, CatchUp.Time);
+		}
+		RewindHistory->ComputeSweptBounds(FromTime, CurrentTime, SlotBounds);
+
+		for (int32 Slot = 0; Slot < RewindHistory->GetNumSlots(); Slot++)
+		{
+			if (const ALagCompensationCharacter* Character = RewindHistory->GetCharacter(Slot))
+			{
+				CharacterParams.AddIgnoredActor(Character);
+			}
+		}
+	}
+
+	int32 SubStepsLeft = MaxSubStepsPerTick;
+	for (int32 Index = 0; Index < CatchingUp.Num() && SubStepsLeft > 0;)
+	{
+		FCatchUp& CatchUp = CatchingUp[Index];
+		if (!CatchUp.Projectile.IsValid())
+		{
+			CatchingUp.RemoveAt(Index, 1, false);
+			continue;
+		}
+
+		FCollisionQueryParams QueryParams = CharacterParams;
+		QueryParams.AddIgnoredActor(CatchUp.Projectile.Get());
+
+		bool bFlying = true;
+		while (bFlying && CatchUp.Time < CurrentTime && SubStepsLeft > 0)
+		{
+			bFlying = SubStep(CatchUp, FMath::Min(SubStepTime, CurrentTime - CatchUp.Time), QueryParams);
+			SubStepsLeft--;
+		}
+
+		if (!bFlying || CatchUp.Time >= CurrentTime)
+		{
+			FinishCatchUp(CatchUp);
+			CatchingUp.RemoveAt(Index, 1, false);
+			continue;
+		}
+
+		// out of sub-steps, it carries on next tick from where it got to
+		UpdateActor(CatchUp);
+		Index++;
+	}
+
+	const int32 NumSubSteps = MaxSubStepsPerTick - SubStepsLeft;
+	INC_DWORD_STAT_BY(STAT_LagComp_ProjectileSubSteps, NumSubSteps);
+	SET_DWORD_STAT(STAT_LagComp_ProjectilesCatchingUp, CatchingUp.Num());
+	CSV_CUSTOM_STAT(LagComp, ProjectileSubSteps, NumSubSteps, ECsvCustomStatOp::Set);
+}
+
+bool ULCProjectileSubsystem::SubStep(FCatchUp& CatchUp, float DeltaTime, const FCollisionQueryParams& QueryParams)
+{
+	ALagCompensationProjectile* Projectile = CatchUp.Projectile.Get();
+	const UProjectileMovementComponent* ProjectileMovement = Projectile->GetProjectileMovement();
+	const float Radius = Projectile->GetCollisionComp()->GetScaledSphereRadius();
+
+	// same integration as the movement component, without bounces
+	const FVector Gravity(0.f, 0.f, ProjectileMovement->GetGravityZ());
+	const FVector Start = CatchUp.Location;
+	const FVector End = Start + CatchUp.Velocity * DeltaTime + 0.5f * Gravity * FMath::Square(DeltaTime);
+	CatchUp.Velocity += Gravity * DeltaTime;
+	if (ProjectileMovement->GetMaxSpeed() > 0.f)
+	{
+		CatchUp.Velocity = CatchUp.Velocity.GetClampedToMaxSize(ProjectileMovement->GetMaxSpeed());
+	}
+
+	// only the characters whose bounds the sub-step passes through are rewound
+	const FBox SubStepBounds = FBox(Start.ComponentMin(End), Start.ComponentMax(End)).ExpandBy(Radius);
+	Slots.Reset();
+	for (int32 Slot = 0; Slot < SlotBounds.Num(); Slot++)
+	{
+		if (Slot != CatchUp.ShooterSlot && SlotBounds[Slot].IsValid && SlotBounds[Slot].Intersect(SubStepBounds))
+		{
+			Slots.Add(Slot);
+		}
+	}
+
+	// characters where they were halfway through the sub-step; a sphere against a capsule is a segment
+	// against the capsule grown by the sphere radius
+	ALagCompensationCharacter* HitCharacter = nullptr;
+	float HitTime = 1.f;
+	const ULCRewindHistorySubsystem* RewindHistory = GetWorld()->GetSubsystem<ULCRewindHistorySubsystem>();
+	if (RewindHistory && Slots.Num() > 0)
+	{
+		RewindHistory->RewindSlots(CatchUp.Time + 0.5f * DeltaTime, Slots, Capsules);
+		for (int32 Index = 0; Index < Capsules.Num(); Index++)
+		{
+			Capsules.Radius[Index] += Radius;
+			Capsules.HalfHeight[Index] += Radius;
+		}
+		const int32 HitIndex = FLCRewindMath::SegmentCapsuleBatchIntersection(Start, End, Capsules, INDEX_NONE, HitTime);
+		if (HitIndex != INDEX_NONE)
+		{
+			HitCharacter = RewindHistory->GetCharacter(Slots[HitIndex]);
+		}
+	}
+
+	// world geometry, the live characters are where they are now and not in the way
+	FHitResult WorldHit;
+	const UPrimitiveComponent* Collision = Projectile->GetCollisionComp();
+	const bool bWorldHit = GetWorld()->SweepSingleByChannel(WorldHit, Start, End, FQuat::Identity, Collision->GetCollisionObjectType(),
+		FCollisionShape::MakeSphere(Radius), QueryParams, FCollisionResponseParams(Collision->GetCollisionResponseToChannels()));
+
+	if (HitCharacter && (!bWorldHit || HitTime <= WorldHit.Time))
+	{
+		CatchUp.Location = FMath::Lerp(Start, End, HitTime);
+		UpdateActor(CatchUp);
+		UE_LOG(LogLagCompensation, Verbose, TEXT("%s: hit %s rewound %.3f s"), *Projectile->GetName(), *HitCharacter->GetName(), GetWorld()->GetTimeSeconds() - CatchUp.Time);
+		Projectile->OnCharacterHit(HitCharacter, CatchUp.Location);
+		return false;
+	}
+	if (bWorldHit)
+	{
+		// leave it just short of the wall, the movement component bounces it off on its next tick
+		CatchUp.Location = WorldHit.Location;
+		CatchUp.Time += DeltaTime * WorldHit.Time;
+		return false;
+	}
+
+	CatchUp.Location = End;
+	CatchUp.Time += DeltaTime;
+	return true;
+}
+
+void ULCProjectileSubsystem::UpdateActor(const FCatchUp& CatchUp)
+{
+	ALagCompensationProjectile* Projectile = CatchUp.Projectile.Get();
+	const UProjectileMovementComponent* ProjectileMovement = Projectile->GetProjectileMovement();
+	Projectile->SetActorLocationAndRotation(CatchUp.Location, ProjectileMovement->bRotationFollowsVelocity ? CatchUp.Velocity.Rotation() : Projectile->GetActorRotation());
+}
+
+void ULCProjectileSubsystem::FinishCatchUp(const FCatchUp& CatchUp)
+{
+	ALagCompensationProjectile* Projectile = CatchUp.Projectile.Get();
+	if (Projectile == nullptr || Projectile->IsPendingKillPending())
+	{
+		return;
+	}
+
+	UpdateActor(CatchUp);
+	UProjectileMovementComponent* ProjectileMovement = Projectile->GetProjectileMovement();
+	ProjectileMovement->Velocity = CatchUp.Velocity;
+	ProjectileMovement->UpdateComponentVelocity();
+	ProjectileMovement->SetComponentTickEnabled(true);
+}
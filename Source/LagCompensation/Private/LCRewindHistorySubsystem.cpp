@@ -0,0 +1,872 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCRewindHistorySubsystem.h"
+
+#include "Components/CapsuleComponent.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "Engine/World.h"
+#include "LagCompensation/LagCompensation.h"
+#include "LagCompensation/LagCompensationCharacter.h"
+#include "LCQuantization.h"
+
+DECLARE_CYCLE_STAT(TEXT("Record Frame"), STAT_LagComp_RecordFrame, STATGROUP_LagComp);
+DECLARE_CYCLE_STAT(TEXT("Record Hitboxes"), STAT_LagComp_RecordHitboxes, STATGROUP_LagComp);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("History Frames"), STAT_LagComp_HistoryFrames, STATGROUP_LagComp);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Recorded Characters"), STAT_LagComp_RecordedCharacters, STATGROUP_LagComp);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Saved Positions"), STAT_LagComp_SavedPositions, STATGROUP_LagComp);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Saved Positions Per Character (max)"), STAT_LagComp_MaxSavedPositions, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("History Read Retries"), STAT_LagComp_HistoryReadRetries, STATGROUP_LagComp);
+DECLARE_MEMORY_STAT(TEXT("Rewind History"), STAT_LagComp_HistoryMemory, STATGROUP_LagComp);
+DECLARE_MEMORY_STAT(TEXT("Hitbox History"), STAT_LagComp_HitboxMemory, STATGROUP_LagComp);
+DECLARE_MEMORY_STAT(TEXT("Saved Position History"), STAT_LagComp_SavedPositionMemory, STATGROUP_LagComp);
+
+namespace LCRewindHistory
+{
+	/** Hitbox centers are stored relative to the actor in 1/32 cm steps. */
+	constexpr float HitboxPositionScale = 32.f;
+	constexpr float HitboxPositionInvScale = 1.f / HitboxPositionScale;
+
+	/** Rows of the frame ring that are never part of the published window, see FLCRewindHistoryFrames. */
+	constexpr int32 ReaderSlackFrames = 4;
+
+	/** Times a reader reads the published window again after the game thread overwrote part of it. */
+	constexpr int32 MaxReadAttempts = 4;
+
+	/**
+	 * Calls Read with the head row and frame count of the published window until no frame it may have looked at
+	 * was overwritten meanwhile, and returns what Read returned. NoHistory if there are no frames, Contended if
+	 * every attempt was overwritten.
+	 */
+	template<typename FunctionType>
+	static ELCRewindReadResult ReadPublished(const FLCRewindHistoryFrames& Rows, FunctionType Read)
+	{
+		for (int32 Attempt = 0; Attempt < MaxReadAttempts; Attempt++)
+		{
+			const uint64 Window = Rows.PublishedWindow.load(std::memory_order_acquire);
+			const uint32 OldestEpoch = (uint32)Window;
+			const int32 Count = (int32)(Window >> 32);
+			if (Count == 0)
+			{
+				return ELCRewindReadResult::NoHistory;
+			}
+
+			const ELCRewindReadResult Result = Read((int32)(OldestEpoch & (uint32)Rows.FrameMask), Count);
+
+			// the rows only held the window if no write has reached the oldest of them since
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (Rows.WriteEpoch.load(std::memory_order_relaxed) - OldestEpoch <= (uint32)Rows.FrameMask)
+			{
+				return Result;
+			}
+			INC_DWORD_STAT(STAT_LagComp_HistoryReadRetries);
+		}
+		return ELCRewindReadResult::Contended;
+	}
+}
+
+FLCRewindHistoryFrames::FLCRewindHistoryFrames()
+	: SlotCapacity(0)
+	, bHermite(false)
+	, FrameMask(0)
+	, WriteEpoch(0)
+	, PublishedWindow(0)
+	, bRetired(false)
+{
+}
+
+int32 FLCRewindHistoryFrames::FindLastFrameBefore(int32 Head, int32 Count, float TargetTime) const
+{
+	int32 Low = 0;
+	int32 High = Count;
+	while (Low < High)
+	{
+		const int32 Mid = Low + (High - Low) / 2;
+		if (FrameTimes[GetRow(Head, Mid)] < TargetTime)
+		{
+			Low = Mid + 1;
+		}
+		else
+		{
+			High = Mid;
+		}
+	}
+	return Low - 1;
+}
+
+void FLCRewindHistoryFrames::GetRewindFrames(int32 Head, int32 Count, float TargetTime, int32& OutRowA, int32& OutRowB, float& OutAlpha) const
+{
+	const int32 Frame = FindLastFrameBefore(Head, Count, TargetTime);
+	if (Frame == INDEX_NONE)
+	{
+		// everything we have is newer than the target time, use the oldest frame
+		OutRowA = OutRowB = GetRow(Head, 0);
+		OutAlpha = 0.f;
+	}
+	else if (Frame == Count - 1)
+	{
+		OutRowA = OutRowB = GetRow(Head, Frame);
+		OutAlpha = 0.f;
+	}
+	else
+	{
+		OutRowA = GetRow(Head, Frame);
+		OutRowB = GetRow(Head, Frame + 1);
+		OutAlpha = (TargetTime - FrameTimes[OutRowA]) / (FrameTimes[OutRowB] - FrameTimes[OutRowA]);
+	}
+}
+
+FVector FLCRewindHistoryFrames::RewindSlotRows(int32 Slot, int32 RowA, int32 RowB, float Alpha) const
+{
+	const int32 A = RowA * SlotCapacity + Slot;
+	const int32 B = RowB * SlotCapacity + Slot;
+	const FVector PositionA(PositionX[A], PositionY[A], PositionZ[A]);
+	if ((Flags[B] & FrameFlag_Valid) == 0 || (Flags[B] & FrameFlag_Teleported) != 0)
+	{
+		return PositionA;
+	}
+
+	const FVector PositionB(PositionX[B], PositionY[B], PositionZ[B]);
+	if (!bHermite || RowA == RowB)
+	{
+		return PositionA + Alpha * (PositionB - PositionA);
+	}
+
+	// same curve as FLCSavedPositionHistory::InterpolatePosition, the tangents scaled to the frame interval
+	const float Duration = FrameTimes[RowB] - FrameTimes[RowA];
+	return FMath::CubicInterp(PositionA, FVector(VelocityX[A], VelocityY[A], VelocityZ[A]) * Duration,
+		PositionB, FVector(VelocityX[B], VelocityY[B], VelocityZ[B]) * Duration, Alpha);
+}
+
+void FLCRewindHistoryFrames::RewindSlots(int32 Head, int32 Count, float TargetTime, const TArray<int32>& Slots, TArrayView<const FLCRewindSlotState> SlotStates,
+	FLCCapsuleBatch& OutCapsules) const
+{
+	OutCapsules.SetNum(Slots.Num());
+
+	int32 RowA = 0, RowB = 0;
+	float Alpha = 0.f;
+	if (Count > 0)
+	{
+		GetRewindFrames(Head, Count, TargetTime, RowA, RowB, Alpha);
+	}
+
+	for (int32 i = 0; i < Slots.Num(); i++)
+	{
+		const int32 Slot = Slots[i];
+		const FLCRewindSlotState& State = SlotStates[Slot];
+		if (Count == 0 || Slot >= SlotCapacity || (Flags[RowA * SlotCapacity + Slot] & FrameFlag_Valid) == 0)
+		{
+			OutCapsules.Set(i, State.Location, State.Radius, State.HalfHeight);
+		}
+		else
+		{
+			OutCapsules.Set(i, RewindSlotRows(Slot, RowA, RowB, Alpha), State.Radius, HalfHeight[RowA * SlotCapacity + Slot]);
+		}
+	}
+}
+
+void FLCRewindHistoryFrames::ComputeSweptBounds(int32 Head, int32 Count, float FromTime, float ToTime, TArrayView<const FLCRewindSlotState> SlotStates,
+	TArray<FBox>& OutBounds) const
+{
+	const int32 NumSlots = SlotStates.Num();
+	OutBounds.Init(FBox(FVector(BIG_NUMBER), FVector(-BIG_NUMBER)), NumSlots);
+	TArray<float, TInlineAllocator<64>> MaxHalfHeight;
+	MaxHalfHeight.SetNumZeroed(NumSlots);
+
+	if (Count > 0)
+	{
+		// include the frames just outside the window, those are what positions inside it are interpolated from
+		const int32 FirstFrame = FMath::Max(FindLastFrameBefore(Head, Count, FromTime), 0);
+		const int32 LastFrame = FMath::Min(FindLastFrameBefore(Head, Count, ToTime) + 1, Count - 1);
+		const int32 NumRecordedSlots = FMath::Min(NumSlots, SlotCapacity);
+
+		for (int32 Frame = FirstFrame; Frame <= LastFrame; Frame++)
+		{
+			const int32 RowStart = GetRow(Head, Frame) * SlotCapacity;
+			const float FrameTime = FrameTimes[GetRow(Head, Frame)];
+			const float ThirdBefore = Frame > FirstFrame ? (FrameTime - FrameTimes[GetRow(Head, Frame - 1)]) / 3.f : 0.f;
+			const float ThirdAfter = Frame < LastFrame ? (FrameTimes[GetRow(Head, Frame + 1)] - FrameTime) / 3.f : 0.f;
+			for (int32 Slot = 0; Slot < NumRecordedSlots; Slot++)
+			{
+				if ((Flags[RowStart + Slot] & FrameFlag_Valid) == 0)
+				{
+					continue;
+				}
+
+				const FVector Position(PositionX[RowStart + Slot], PositionY[RowStart + Slot], PositionZ[RowStart + Slot]);
+				OutBounds[Slot].Min = OutBounds[Slot].Min.ComponentMin(Position);
+				OutBounds[Slot].Max = OutBounds[Slot].Max.ComponentMax(Position);
+				MaxHalfHeight[Slot] = FMath::Max(MaxHalfHeight[Slot], HalfHeight[RowStart + Slot]);
+
+				// the curves into and out of the frame stay within the hull of their Bezier control points
+				if (bHermite)
+				{
+					const FVector Velocity(VelocityX[RowStart + Slot], VelocityY[RowStart + Slot], VelocityZ[RowStart + Slot]);
+					const FVector Before = Position - Velocity * ThirdBefore;
+					const FVector After = Position + Velocity * ThirdAfter;
+					OutBounds[Slot].Min = OutBounds[Slot].Min.ComponentMin(Before).ComponentMin(After);
+					OutBounds[Slot].Max = OutBounds[Slot].Max.ComponentMax(Before).ComponentMax(After);
+				}
+			}
+		}
+	}
+
+	for (int32 Slot = 0; Slot < NumSlots; Slot++)
+	{
+		const FLCRewindSlotState& State = SlotStates[Slot];
+		if (!State.bOccupied)
+		{
+			OutBounds[Slot] = FBox(ForceInit);
+			continue;
+		}
+
+		float SlotHalfHeight = MaxHalfHeight[Slot];
+		if (SlotHalfHeight == 0.f)
+		{
+			// nothing recorded in the window, rewinding falls back to the current location
+			OutBounds[Slot] = FBox(State.Location, State.Location);
+			SlotHalfHeight = State.HalfHeight;
+		}
+
+		OutBounds[Slot] = OutBounds[Slot].ExpandBy(FVector(State.Radius, State.Radius, SlotHalfHeight));
+	}
+}
+
+int32 FLCRewindHistoryFrames::BeginFrame(uint32 Epoch, float Time)
+{
+	const int32 Row = (int32)(Epoch & (uint32)FrameMask);
+	BeginWrite(Epoch);
+	FrameTimes[Row] = Time;
+	return Row;
+}
+
+void FLCRewindHistoryFrames::WriteSlot(int32 Row, int32 Slot, const FVector& Position, const FVector& Velocity, float InYaw, float InHalfHeight, uint8 SlotFlags)
+{
+	const int32 Index = Row * SlotCapacity + Slot;
+	PositionX[Index] = Position.X;
+	PositionY[Index] = Position.Y;
+	PositionZ[Index] = Position.Z;
+	VelocityX[Index] = Velocity.X;
+	VelocityY[Index] = Velocity.Y;
+	VelocityZ[Index] = Velocity.Z;
+	Yaw[Index] = InYaw;
+	HalfHeight[Index] = InHalfHeight;
+	Flags[Index] = SlotFlags;
+}
+
+void FLCRewindHistoryFrames::EndFrame(uint32 Epoch, int32 Count)
+{
+	Publish(Epoch + 1 - (uint32)Count, Count);
+}
+
+void FLCRewindHistoryFrames::ClearSlotHistory(int32 Slot, uint32& NextEpoch, int32 Count)
+{
+	// clearing the slot writes every row. Moving the epochs keeps every frame in its row but puts WriteEpoch
+	// past any window a reader may hold
+	NextEpoch += (uint32)FrameMask + 1;
+	BeginWrite(NextEpoch - 1);
+	for (int32 Row = 0; Row <= FrameMask; Row++)
+	{
+		Flags[Row * SlotCapacity + Slot] = 0;
+	}
+	Publish(NextEpoch - (uint32)Count, Count);
+}
+
+void FLCRewindHistoryFrames::BeginWrite(uint32 Epoch)
+{
+	WriteEpoch.store(Epoch, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void FLCRewindHistoryFrames::Publish(uint32 OldestEpoch, int32 Count)
+{
+	PublishedWindow.store(((uint64)Count << 32) | OldestEpoch, std::memory_order_release);
+}
+
+bool FLCRewindHistoryReader::IsValid() const
+{
+	return Frames.IsValid() && !Frames->bRetired.load(std::memory_order_acquire);
+}
+
+ELCRewindReadResult FLCRewindHistoryReader::RewindSlot(int32 Slot, float TargetTime, FVector& OutPosition, float& OutHalfHeight) const
+{
+	if (!IsValid())
+	{
+		return ELCRewindReadResult::Retired;
+	}
+	if (Slot < 0 || Slot >= Frames->SlotCapacity)
+	{
+		return ELCRewindReadResult::NoHistory;
+	}
+
+	const FLCRewindHistoryFrames& Rows = *Frames;
+	return LCRewindHistory::ReadPublished(Rows, [&Rows, Slot, TargetTime, &OutPosition, &OutHalfHeight](int32 Head, int32 Count)
+	{
+		int32 RowA, RowB;
+		float Alpha;
+		Rows.GetRewindFrames(Head, Count, TargetTime, RowA, RowB, Alpha);
+		if ((Rows.Flags[RowA * Rows.SlotCapacity + Slot] & FLCRewindHistoryFrames::FrameFlag_Valid) == 0)
+		{
+			return ELCRewindReadResult::NoHistory;
+		}
+
+		OutPosition = Rows.RewindSlotRows(Slot, RowA, RowB, Alpha);
+		OutHalfHeight = Rows.HalfHeight[RowA * Rows.SlotCapacity + Slot];
+		return ELCRewindReadResult::Ok;
+	});
+}
+
+ELCRewindReadResult FLCRewindHistoryReader::RewindSlots(float TargetTime, const TArray<int32>& Slots, TArrayView<const FLCRewindSlotState> SlotStates,
+	FLCCapsuleBatch& OutCapsules) const
+{
+	if (!IsValid())
+	{
+		return ELCRewindReadResult::Retired;
+	}
+
+	const FLCRewindHistoryFrames& Rows = *Frames;
+	const ELCRewindReadResult Result = LCRewindHistory::ReadPublished(Rows, [&Rows, TargetTime, &Slots, SlotStates, &OutCapsules](int32 Head, int32 Count)
+	{
+		Rows.RewindSlots(Head, Count, TargetTime, Slots, SlotStates, OutCapsules);
+		return ELCRewindReadResult::Ok;
+	});
+
+	// no frames yet, every slot is where it is now
+	if (Result == ELCRewindReadResult::NoHistory)
+	{
+		Rows.RewindSlots(0, 0, TargetTime, Slots, SlotStates, OutCapsules);
+		return ELCRewindReadResult::Ok;
+	}
+	return Result;
+}
+
+ELCRewindReadResult FLCRewindHistoryReader::ComputeSweptBounds(float FromTime, float ToTime, TArrayView<const FLCRewindSlotState> SlotStates, TArray<FBox>& OutBounds) const
+{
+	if (!IsValid())
+	{
+		return ELCRewindReadResult::Retired;
+	}
+
+	const FLCRewindHistoryFrames& Rows = *Frames;
+	const ELCRewindReadResult Result = LCRewindHistory::ReadPublished(Rows, [&Rows, FromTime, ToTime, SlotStates, &OutBounds](int32 Head, int32 Count)
+	{
+		Rows.ComputeSweptBounds(Head, Count, FromTime, ToTime, SlotStates, OutBounds);
+		return ELCRewindReadResult::Ok;
+	});
+
+	if (Result == ELCRewindReadResult::NoHistory)
+	{
+		Rows.ComputeSweptBounds(0, 0, FromTime, ToTime, SlotStates, OutBounds);
+		return ELCRewindReadResult::Ok;
+	}
+	return Result;
+}
+
+bool FLCRewindHistoryReader::GetTimeRange(float& OutOldestTime, float& OutNewestTime) const
+{
+	if (!IsValid())
+	{
+		return false;
+	}
+
+	const FLCRewindHistoryFrames& Rows = *Frames;
+	return LCRewindHistory::ReadPublished(Rows, [&Rows, &OutOldestTime, &OutNewestTime](int32 Head, int32 Count)
+	{
+		OutOldestTime = Rows.FrameTimes[Rows.GetRow(Head, 0)];
+		OutNewestTime = Rows.FrameTimes[Rows.GetRow(Head, Count - 1)];
+		return ELCRewindReadResult::Ok;
+	}) == ELCRewindReadResult::Ok;
+}
+
+ULCRewindHistorySubsystem::ULCRewindHistorySubsystem()
+	: Frames(MakeShared<FLCRewindHistoryFrames, ESPMode::ThreadSafe>())
+	, bHitboxesActive(false)
+	, FrameHead(0)
+	, FrameCount(0)
+	, NextEpoch(0)
+{
+	MaxHistoryAge = 1.f;
+	ExpectedFrameRate = 120.f;
+	bHermiteInterpolation = true;
+	bRecordHitboxes = false;
+	MaxHitboxesPerCharacter = 16;
+	HitboxMemoryBudget = 4 * 1024 * 1024;
+}
+
+bool ULCRewindHistorySubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	UWorld* World = Cast<UWorld>(Outer);
+	return World && World->IsGameWorld();
+}
+
+void ULCRewindHistorySubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	const int32 FrameCapacity = (int32)FMath::RoundUpToPowerOfTwo((uint32)FMath::Max(FMath::CeilToInt(MaxHistoryAge * ExpectedFrameRate) + 2 + LCRewindHistory::ReaderSlackFrames, 2));
+	ResizeRows(FrameCapacity, 16);
+
+	PostActorTickHandle = FWorldDelegates::OnWorldPostActorTick.AddUObject(this, &ULCRewindHistorySubsystem::OnWorldPostActorTick);
+}
+
+void ULCRewindHistorySubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldPostActorTick.Remove(PostActorTickHandle);
+	Frames->bRetired.store(true, std::memory_order_release);
+	Characters.Reset();
+	Hitboxes.Empty();
+	SET_MEMORY_STAT(STAT_LagComp_HistoryMemory, 0);
+	SET_MEMORY_STAT(STAT_LagComp_HitboxMemory, 0);
+	SET_MEMORY_STAT(STAT_LagComp_SavedPositionMemory, 0);
+
+	Super::Deinitialize();
+}
+
+int32 ULCRewindHistorySubsystem::RegisterCharacter(ALagCompensationCharacter* Character)
+{
+	int32 Slot = Characters.Find(nullptr);
+	if (Slot == INDEX_NONE)
+	{
+		Slot = Characters.Add(nullptr);
+		PendingTeleports.Add(false);
+		SlotRadius.Add(0.f);
+		SlotHitboxes.AddDefaulted();
+		SlotHitboxBones.AddDefaulted();
+		if (Characters.Num() > Frames->SlotCapacity)
+		{
+			ResizeRows(Frames->FrameMask + 1, Frames->SlotCapacity * 2);
+		}
+	}
+
+	Characters[Slot] = Character;
+	PendingTeleports[Slot] = false;
+	SlotRadius[Slot] = Character->GetCapsuleComponent()->GetScaledCapsuleRadius();
+	RegisterHitboxes(Slot, Character);
+	return Slot;
+}
+
+void ULCRewindHistorySubsystem::RegisterHitboxes(int32 Slot, const ALagCompensationCharacter* Character)
+{
+	TArray<FLCHitboxDefinition>& Definitions = SlotHitboxes[Slot];
+	TArray<int32>& Bones = SlotHitboxBones[Slot];
+	Definitions.Reset();
+	Bones.Reset();
+
+	USkeletalMeshComponent* Mesh = Character->GetMesh();
+	if (!bHitboxesActive || Mesh == nullptr || Mesh->SkeletalMesh == nullptr)
+	{
+		return;
+	}
+
+	// nobody looks at the mesh on a dedicated server, but the bones still have to follow the animation
+	Mesh->VisibilityBasedAnimTickOption = EVisibilityBasedAnimTickOption::AlwaysTickPoseAndRefreshBones;
+
+	for (const FLCHitboxDefinition& Definition : Character->Hitboxes)
+	{
+		if (Definitions.Num() == MaxHitboxesPerCharacter)
+		{
+			UE_LOG(LogLagCompensation, Warning, TEXT("%s has more than %d hitboxes, the rest are ignored"), *Character->GetName(), MaxHitboxesPerCharacter);
+			break;
+		}
+
+		const int32 BoneIndex = Mesh->GetBoneIndex(Definition.BoneName);
+		if (BoneIndex == INDEX_NONE)
+		{
+			UE_LOG(LogLagCompensation, Warning, TEXT("%s: hitbox bone %s not found"), *Character->GetName(), *Definition.BoneName.ToString());
+		}
+		Definitions.Add(Definition);
+		Bones.Add(BoneIndex);
+	}
+}
+
+void ULCRewindHistorySubsystem::UnregisterCharacter(int32 Slot)
+{
+	if (!Characters.IsValidIndex(Slot))
+	{
+		return;
+	}
+
+	Characters[Slot] = nullptr;
+	Frames->ClearSlotHistory(Slot, NextEpoch, FrameCount);
+}
+
+void ULCRewindHistorySubsystem::NotifyTeleported(int32 Slot)
+{
+	if (PendingTeleports.IsValidIndex(Slot))
+	{
+		PendingTeleports[Slot] = true;
+	}
+}
+
+void ULCRewindHistorySubsystem::OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	if (World == GetWorld() && World->GetNetMode() != NM_Client)
+	{
+		// the characters' own saved positions are sampled on the same server tick, at their own rate. Characters
+		// the server moves itself have no client moves, their tick is the move
+		const float WorldTime = World->GetTimeSeconds();
+		for (ALagCompensationCharacter* Character : Characters)
+		{
+			if (Character)
+			{
+				Character->RecordMove();
+				Character->SamplePosition(WorldTime);
+			}
+		}
+
+		RecordFrame(WorldTime);
+	}
+}
+
+void ULCRewindHistorySubsystem::RecordFrame(float WorldTime)
+{
+	if (FrameCount > 0 && Frames->FrameTimes[GetRow(FrameCount - 1)] == WorldTime)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_LagComp_RecordFrame);
+
+#if STATS || CSV_PROFILER
+	int32 NumCharacters = 0;
+	int32 NumSavedPositions = 0;
+	int32 MaxSavedPositions = 0;
+	SIZE_T SavedPositionMemory = 0;
+#endif
+
+	if (FrameCount == Frames->FrameMask + 1 - LCRewindHistory::ReaderSlackFrames)
+	{
+		if (FrameCount > 1 && Frames->FrameTimes[GetRow(1)] >= WorldTime - MaxHistoryAge)
+		{
+			// the server ticks faster than ExpectedFrameRate, dropping a frame would cover less than MaxHistoryAge
+			const int32 FrameCapacity = (Frames->FrameMask + 1) * 2;
+			UE_LOG(LogLagCompensation, Warning, TEXT("Rewind history of %d frames covers only %.3f s of the %.3f s MaxHistoryAge, growing it to %d frames. Raise ExpectedFrameRate to the server tick rate."),
+				FrameCount, WorldTime - Frames->FrameTimes[GetRow(0)], MaxHistoryAge, FrameCapacity);
+			ResizeRows(FrameCapacity, Frames->SlotCapacity);
+		}
+		else
+		{
+			// full, drop the oldest frame. The rows past the window give readers time to finish with it
+			FrameHead = (FrameHead + 1) & Frames->FrameMask;
+			FrameCount--;
+		}
+	}
+	const int32 Row = Frames->BeginFrame(NextEpoch, WorldTime);
+	FrameCount++;
+
+	for (int32 Slot = 0; Slot < Characters.Num(); Slot++)
+	{
+		const ALagCompensationCharacter* Character = Characters[Slot];
+		if (Character == nullptr)
+		{
+			Frames->WriteSlot(Row, Slot, FVector::ZeroVector, FVector::ZeroVector, 0.f, 0.f, 0);
+			continue;
+		}
+
+		Frames->WriteSlot(Row, Slot, Character->GetActorLocation(), Character->GetVelocity(), Character->GetActorRotation().Yaw,
+			Character->GetCapsuleComponent()->GetScaledCapsuleHalfHeight(),
+			FLCRewindHistoryFrames::FrameFlag_Valid | (PendingTeleports[Slot] ? FLCRewindHistoryFrames::FrameFlag_Teleported : 0));
+		PendingTeleports[Slot] = false;
+
+		if (bHitboxesActive)
+		{
+			RecordHitboxes(Slot, Row, Character);
+		}
+
+#if STATS || CSV_PROFILER
+		NumCharacters++;
+		NumSavedPositions += Character->SavedMoves.Num();
+		MaxSavedPositions = FMath::Max(MaxSavedPositions, Character->SavedMoves.Num());
+		SavedPositionMemory += Character->SavedMoves.GetAllocatedSize() + Character->ClientMoves.GetAllocatedSize();
+#endif
+	}
+
+	// maintain one frame beyond MaxHistoryAge for interpolation
+	while (FrameCount > 1 && Frames->FrameTimes[GetRow(1)] < WorldTime - MaxHistoryAge)
+	{
+		FrameHead = (FrameHead + 1) & Frames->FrameMask;
+		FrameCount--;
+	}
+
+	Frames->EndFrame(NextEpoch, FrameCount);
+	NextEpoch++;
+
+	SET_DWORD_STAT(STAT_LagComp_HistoryFrames, FrameCount);
+	SET_DWORD_STAT(STAT_LagComp_RecordedCharacters, NumCharacters);
+	SET_DWORD_STAT(STAT_LagComp_SavedPositions, NumSavedPositions);
+	SET_DWORD_STAT(STAT_LagComp_MaxSavedPositions, MaxSavedPositions);
+	SET_MEMORY_STAT(STAT_LagComp_SavedPositionMemory, SavedPositionMemory);
+
+	CSV_CUSTOM_STAT(LagComp, HistoryFrames, FrameCount, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(LagComp, SavedPositionsMax, MaxSavedPositions, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(LagComp, SavedPositionsAverage, NumCharacters > 0 ? (float)NumSavedPositions / NumCharacters : 0.f, ECsvCustomStatOp::Set);
+}
+
+void ULCRewindHistorySubsystem::RecordHitboxes(int32 Slot, int32 Row, const ALagCompensationCharacter* Character)
+{
+	SCOPE_CYCLE_COUNTER(STAT_LagComp_RecordHitboxes);
+
+	const TArray<FLCHitboxDefinition>& Definitions = SlotHitboxes[Slot];
+	const TArray<int32>& Bones = SlotHitboxBones[Slot];
+	const USkeletalMeshComponent* Mesh = Character->GetMesh();
+	if (Definitions.Num() == 0 || Mesh == nullptr)
+	{
+		return;
+	}
+
+	const FVector ActorLocation = Character->GetActorLocation();
+	FLCQuantizedHitbox* Quantized = &Hitboxes[(Row * Frames->SlotCapacity + Slot) * MaxHitboxesPerCharacter];
+	for (int32 Index = 0; Index < Definitions.Num(); Index++)
+	{
+		if (Bones[Index] == INDEX_NONE)
+		{
+			continue;
+		}
+
+		const FTransform BoneTransform = Mesh->GetBoneTransform(Bones[Index]);
+		const FVector Center = BoneTransform.TransformPosition(Definitions[Index].Offset) - ActorLocation;
+		Quantized[Index].Center[0] = FLCQuantization::ToFixed16(Center.X, LCRewindHistory::HitboxPositionScale);
+		Quantized[Index].Center[1] = FLCQuantization::ToFixed16(Center.Y, LCRewindHistory::HitboxPositionScale);
+		Quantized[Index].Center[2] = FLCQuantization::ToFixed16(Center.Z, LCRewindHistory::HitboxPositionScale);
+		FLCQuantization::EncodeUnitVector(BoneTransform.GetUnitAxis(EAxis::X), Quantized[Index].Axis[0], Quantized[Index].Axis[1]);
+	}
+}
+
+void ULCRewindHistorySubsystem::ResizeRows(int32 NewFrameCapacity, int32 NewSlotCapacity)
+{
+	const int32 OldFrameMask = Frames->FrameMask;
+	const int32 NewFrameMask = NewFrameCapacity - 1;
+	const int32 OldSlotCapacity = Frames->SlotCapacity;
+	const int32 CopiedSlots = FMath::Min(OldSlotCapacity, NewSlotCapacity);
+
+	// frames keep their epoch, so the one with epoch E moves from row E & OldFrameMask to row E & NewFrameMask
+	const uint32 OldestEpoch = NextEpoch - (uint32)FrameCount;
+	const int32 NumFrames = FrameCount;
+	const int32 OldHead = FrameHead;
+
+	auto Relayout = [=](const auto& Column, int32 OldRowSize, int32 NewRowSize, int32 CopiedSize)
+	{
+		TArray<typename TDecay<decltype(Column[0])>::Type> NewColumn;
+		NewColumn.SetNumZeroed(NewFrameCapacity * NewRowSize);
+		for (int32 Frame = 0; Frame < NumFrames && CopiedSize > 0; Frame++)
+		{
+			const int32 OldRow = (OldHead + Frame) & OldFrameMask;
+			const int32 NewRow = (int32)((OldestEpoch + (uint32)Frame) & (uint32)NewFrameMask);
+			FMemory::Memcpy(&NewColumn[NewRow * NewRowSize], &Column[OldRow * OldRowSize], CopiedSize * sizeof(Column[0]));
+		}
+		return NewColumn;
+	};
+
+	// readers may still be using the current rows, so they are left as they are and retired
+	TSharedRef<FLCRewindHistoryFrames, ESPMode::ThreadSafe> NewFrames = MakeShared<FLCRewindHistoryFrames, ESPMode::ThreadSafe>();
+	NewFrames->FrameTimes = Relayout(Frames->FrameTimes, 1, 1, 1);
+	NewFrames->PositionX = Relayout(Frames->PositionX, OldSlotCapacity, NewSlotCapacity, CopiedSlots);
+	NewFrames->PositionY = Relayout(Frames->PositionY, OldSlotCapacity, NewSlotCapacity, CopiedSlots);
+	NewFrames->PositionZ = Relayout(Frames->PositionZ, OldSlotCapacity, NewSlotCapacity, CopiedSlots);
+	NewFrames->VelocityX = Relayout(Frames->VelocityX, OldSlotCapacity, NewSlotCapacity, CopiedSlots);
+	NewFrames->VelocityY = Relayout(Frames->VelocityY, OldSlotCapacity, NewSlotCapacity, CopiedSlots);
+	NewFrames->VelocityZ = Relayout(Frames->VelocityZ, OldSlotCapacity, NewSlotCapacity, CopiedSlots);
+	NewFrames->Yaw = Relayout(Frames->Yaw, OldSlotCapacity, NewSlotCapacity, CopiedSlots);
+	NewFrames->HalfHeight = Relayout(Frames->HalfHeight, OldSlotCapacity, NewSlotCapacity, CopiedSlots);
+	NewFrames->Flags = Relayout(Frames->Flags, OldSlotCapacity, NewSlotCapacity, CopiedSlots);
+	NewFrames->SlotCapacity = NewSlotCapacity;
+	NewFrames->bHermite = bHermiteInterpolation;
+	NewFrames->FrameMask = NewFrameMask;
+	NewFrames->WriteEpoch.store(Frames->WriteEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	NewFrames->PublishedWindow.store(Frames->PublishedWindow.load(std::memory_order_relaxed), std::memory_order_release);
+	Frames->bRetired.store(true, std::memory_order_release);
+	Frames = NewFrames;
+
+	if (bHitboxesActive)
+	{
+		Hitboxes = Relayout(Hitboxes, OldSlotCapacity * MaxHitboxesPerCharacter, NewSlotCapacity * MaxHitboxesPerCharacter, CopiedSlots * MaxHitboxesPerCharacter);
+	}
+	FrameHead = (int32)(OldestEpoch & (uint32)NewFrameMask);
+	UpdateHitboxStorage();
+
+	SET_MEMORY_STAT(STAT_LagComp_HistoryMemory, Frames->FrameTimes.GetAllocatedSize() + Frames->PositionX.GetAllocatedSize() + Frames->PositionY.GetAllocatedSize()
+		+ Frames->PositionZ.GetAllocatedSize() + Frames->VelocityX.GetAllocatedSize() + Frames->VelocityY.GetAllocatedSize() + Frames->VelocityZ.GetAllocatedSize()
+		+ Frames->Yaw.GetAllocatedSize() + Frames->HalfHeight.GetAllocatedSize() + Frames->Flags.GetAllocatedSize());
+}
+
+int64 ULCRewindHistorySubsystem::GetHitboxMemorySize() const
+{
+	return (int64)(Frames->FrameMask + 1) * Frames->SlotCapacity * FMath::Max(MaxHitboxesPerCharacter, 0) * sizeof(FLCQuantizedHitbox);
+}
+
+void ULCRewindHistorySubsystem::UpdateHitboxStorage()
+{
+	const bool bWasActive = bHitboxesActive;
+	const int64 MemorySize = GetHitboxMemorySize();
+	bHitboxesActive = bRecordHitboxes && MaxHitboxesPerCharacter > 0 && MemorySize <= HitboxMemoryBudget;
+
+	if (bHitboxesActive)
+	{
+		if (!bWasActive)
+		{
+			Hitboxes.SetNumZeroed(MemorySize / sizeof(FLCQuantizedHitbox));
+		}
+		UE_LOG(LogLagCompensation, Log, TEXT("Hitbox history: %d frames x %d slots x %d hitboxes, %lld KB"),
+			Frames->FrameMask + 1, Frames->SlotCapacity, MaxHitboxesPerCharacter, MemorySize / 1024);
+	}
+	else
+	{
+		if (bRecordHitboxes && MemorySize > HitboxMemoryBudget)
+		{
+			UE_LOG(LogLagCompensation, Warning, TEXT("Hitbox history needs %lld KB for %d slots, over the %d KB budget. Hitboxes are no longer recorded."),
+				MemorySize / 1024, Frames->SlotCapacity, HitboxMemoryBudget / 1024);
+		}
+		Hitboxes.Empty();
+	}
+
+	SET_MEMORY_STAT(STAT_LagComp_HitboxMemory, Hitboxes.GetAllocatedSize());
+}
+
+FVector ULCRewindHistorySubsystem::RewindSlot(int32 Slot, float TargetTime) const
+{
+	const ALagCompensationCharacter* Character = GetCharacter(Slot);
+	if (Character == nullptr)
+	{
+		return FVector::ZeroVector;
+	}
+	if (FrameCount == 0)
+	{
+		return Character->GetActorLocation();
+	}
+
+	int32 RowA, RowB;
+	float Alpha;
+	Frames->GetRewindFrames(FrameHead, FrameCount, TargetTime, RowA, RowB, Alpha);
+	if ((Frames->Flags[RowA * Frames->SlotCapacity + Slot] & FLCRewindHistoryFrames::FrameFlag_Valid) == 0)
+	{
+		return Character->GetActorLocation();
+	}
+	return Frames->RewindSlotRows(Slot, RowA, RowB, Alpha);
+}
+
+void ULCRewindHistorySubsystem::RewindAll(float TargetTime, TArray<FVector>& OutPositions) const
+{
+	const int32 NumSlots = Characters.Num();
+	OutPositions.SetNumUninitialized(NumSlots, false);
+	if (FrameCount == 0)
+	{
+		for (int32 Slot = 0; Slot < NumSlots; Slot++)
+		{
+			OutPositions[Slot] = Characters[Slot] ? Characters[Slot]->GetActorLocation() : FVector::ZeroVector;
+		}
+		return;
+	}
+
+	int32 RowA, RowB;
+	float Alpha;
+	Frames->GetRewindFrames(FrameHead, FrameCount, TargetTime, RowA, RowB, Alpha);
+
+	const int32 A = RowA * Frames->SlotCapacity;
+	for (int32 Slot = 0; Slot < NumSlots; Slot++)
+	{
+		if ((Frames->Flags[A + Slot] & FLCRewindHistoryFrames::FrameFlag_Valid) == 0)
+		{
+			OutPositions[Slot] = Characters[Slot] ? Characters[Slot]->GetActorLocation() : FVector::ZeroVector;
+		}
+		else
+		{
+			OutPositions[Slot] = Frames->RewindSlotRows(Slot, RowA, RowB, Alpha);
+		}
+	}
+}
+
+void ULCRewindHistorySubsystem::RewindSlots(float TargetTime, const TArray<int32>& Slots, FLCCapsuleBatch& OutCapsules) const
+{
+	// only the slots asked for are looked at
+	TArray<FLCRewindSlotState, TInlineAllocator<64>> SlotStates;
+	SlotStates.SetNumUninitialized(Characters.Num());
+	for (const int32 Slot : Slots)
+	{
+		SlotStates[Slot] = GetSlotState(Slot);
+	}
+	Frames->RewindSlots(FrameHead, FrameCount, TargetTime, Slots, SlotStates, OutCapsules);
+}
+
+int32 ULCRewindHistorySubsystem::RewindHitboxes(int32 Slot, float TargetTime, TArray<FLCHitboxCapsule>& OutHitboxes) const
+{
+	if (!bHitboxesActive || FrameCount == 0 || !SlotHitboxes.IsValidIndex(Slot))
+	{
+		return 0;
+	}
+
+	int32 RowA, RowB;
+	float Alpha;
+	Frames->GetRewindFrames(FrameHead, FrameCount, TargetTime, RowA, RowB, Alpha);
+	const uint8 FlagsA = Frames->Flags[RowA * Frames->SlotCapacity + Slot];
+	const uint8 FlagsB = Frames->Flags[RowB * Frames->SlotCapacity + Slot];
+	if ((FlagsA & FLCRewindHistoryFrames::FrameFlag_Valid) == 0)
+	{
+		return 0;
+	}
+	if ((FlagsB & FLCRewindHistoryFrames::FrameFlag_Valid) == 0 || (FlagsB & FLCRewindHistoryFrames::FrameFlag_Teleported) != 0)
+	{
+		RowB = RowA;
+		Alpha = 0.f;
+	}
+
+	const FVector ActorLocation = Frames->RewindSlotRows(Slot, RowA, RowB, Alpha);
+	const TArray<FLCHitboxDefinition>& Definitions = SlotHitboxes[Slot];
+	const TArray<int32>& Bones = SlotHitboxBones[Slot];
+	const FLCQuantizedHitbox* QuantizedA = &Hitboxes[(RowA * Frames->SlotCapacity + Slot) * MaxHitboxesPerCharacter];
+	const FLCQuantizedHitbox* QuantizedB = &Hitboxes[(RowB * Frames->SlotCapacity + Slot) * MaxHitboxesPerCharacter];
+
+	const int32 FirstAdded = OutHitboxes.Num();
+	for (int32 Index = 0; Index < Definitions.Num(); Index++)
+	{
+		if (Bones[Index] == INDEX_NONE)
+		{
+			continue;
+		}
+
+		const FLCQuantizedHitbox& A = QuantizedA[Index];
+		const FLCQuantizedHitbox& B = QuantizedB[Index];
+		const FVector CenterA(A.Center[0], A.Center[1], A.Center[2]);
+		const FVector CenterB(B.Center[0], B.Center[1], B.Center[2]);
+		const FVector AxisA = FLCQuantization::DecodeUnitVector(A.Axis[0], A.Axis[1]);
+		const FVector AxisB = FLCQuantization::DecodeUnitVector(B.Axis[0], B.Axis[1]);
+
+		FLCHitboxCapsule& Hitbox = OutHitboxes.AddDefaulted_GetRef();
+		Hitbox.Center = ActorLocation + FMath::Lerp(CenterA, CenterB, Alpha) * LCRewindHistory::HitboxPositionInvScale;
+		Hitbox.Axis = FMath::Lerp(AxisA, AxisB, Alpha).GetSafeNormal(SMALL_NUMBER, AxisA);
+		Hitbox.Radius = Definitions[Index].Radius;
+		Hitbox.HalfHeight = Definitions[Index].HalfHeight;
+		Hitbox.Zone = (uint8)Definitions[Index].Zone;
+	}
+	return OutHitboxes.Num() - FirstAdded;
+}
+
+void ULCRewindHistorySubsystem::ComputeSweptBounds(float FromTime, float ToTime, TArray<FBox>& OutBounds) const
+{
+	TArray<FLCRewindSlotState, TInlineAllocator<64>> SlotStates;
+	SlotStates.SetNumUninitialized(Characters.Num());
+	for (int32 Slot = 0; Slot < Characters.Num(); Slot++)
+	{
+		SlotStates[Slot] = GetSlotState(Slot);
+	}
+	Frames->ComputeSweptBounds(FrameHead, FrameCount, FromTime, ToTime, SlotStates, OutBounds);
+}
+
+void ULCRewindHistorySubsystem::GetSlotStates(TArray<FLCRewindSlotState>& OutStates) const
+{
+	OutStates.SetNumUninitialized(Characters.Num());
+	for (int32 Slot = 0; Slot < Characters.Num(); Slot++)
+	{
+		OutStates[Slot] = GetSlotState(Slot);
+	}
+}
+
+FLCRewindSlotState ULCRewindHistorySubsystem::GetSlotState(int32 Slot) const
+{
+	FLCRewindSlotState State;
+	const ALagCompensationCharacter* Character = Characters[Slot];
+	State.Location = Character ? Character->GetActorLocation() : FVector::ZeroVector;
+	State.HalfHeight = Character ? Character->GetCapsuleComponent()->GetScaledCapsuleHalfHeight() : 0.f;
+	State.Radius = SlotRadius[Slot];
+	State.bOccupied = Character != nullptr;
+	return State;
+}
@@ -0,0 +1,146 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCRewindLogSubsystem.h"
+
+#include "Components/CapsuleComponent.h"
+#include "Engine/World.h"
+#include "LagCompensation/LagCompensation.h"
+#include "LagCompensation/LagCompensationCharacter.h"
+#include "LCRewindHistorySubsystem.h"
+#include "LCShotValidationSubsystem.h"
+#include "HAL/FileManager.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Paths.h"
+
+ULCRewindLogSubsystem::ULCRewindLogSubsystem()
+	: NextCharacterId(0)
+{
+	bRecordRewindLog = false;
+	ChunkSize = 64 * 1024;
+}
+
+bool ULCRewindLogSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	UWorld* World = Cast<UWorld>(Outer);
+	return World && World->IsGameWorld();
+}
+
+void ULCRewindLogSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Collection.InitializeDependency(ULCShotValidationSubsystem::StaticClass());
+	Super::Initialize(Collection);
+}
+
+void ULCRewindLogSubsystem::Deinitialize()
+{
+	if (ULCShotValidationSubsystem* ShotValidation = GetWorld()->GetSubsystem<ULCShotValidationSubsystem>())
+	{
+		ShotValidation->OnShotValidated.Remove(ShotValidatedHandle);
+	}
+
+	if (Writer)
+	{
+		Writer->Close();
+		UE_LOG(LogLagCompensation, Display, TEXT("Rewind log closed, %lld KB"), Writer->GetFileSize() / 1024);
+		Writer.Reset();
+	}
+	CharacterIds.Reset();
+
+	Super::Deinitialize();
+}
+
+void ULCRewindLogSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	FString Filename;
+	const bool bCommandLine = FParse::Param(FCommandLine::Get(), TEXT("LagCompRecord")) || FParse::Value(FCommandLine::Get(), TEXT("LagCompRecord="), Filename);
+	if (InWorld.GetNetMode() == NM_Client || !(bRecordRewindLog || bCommandLine))
+	{
+		return;
+	}
+
+	if (Filename.IsEmpty())
+	{
+		Filename = FPaths::ProjectSavedDir() / TEXT("RewindLogs") / FString::Printf(TEXT("%s-%s.lcrl"), *InWorld.GetMapName(), *FDateTime::Now().ToString());
+	}
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Filename), true);
+
+	Writer = MakeUnique<FLCRewindLogWriter>(ChunkSize);
+	if (!Writer->Open(Filename))
+	{
+		UE_LOG(LogLagCompensation, Warning, TEXT("Can't create rewind log %s"), *Filename);
+		Writer.Reset();
+	}
+	else
+	{
+		ShotValidatedHandle = InWorld.GetSubsystem<ULCShotValidationSubsystem>()->OnShotValidated.AddUObject(this, &ULCRewindLogSubsystem::HandleShotValidated);
+		UE_LOG(LogLagCompensation, Display, TEXT("Recording rewind log %s"), *Filename);
+	}
+}
+
+void ULCRewindLogSubsystem::RecordPosition(const ALagCompensationCharacter* Character, const FSavedPosition& Position)
+{
+	const uint16 Id = GetCharacterId(Character);
+	if (Id != MAX_uint16)
+	{
+		Writer->AddPosition(Id, Position);
+	}
+}
+
+void ULCRewindLogSubsystem::HandleShotValidated(const FLCPendingShot& Shot, const FLCShotResult& Result, ALagCompensationCharacter* HitCharacter)
+{
+	FLCRecordedShot Recorded;
+	Recorded.ShooterId = GetCharacterId(Shot.Shooter.Get());
+	Recorded.VictimId = GetCharacterId(Shot.Victim.Get());
+	Recorded.HitId = GetCharacterId(HitCharacter);
+	Recorded.ServerTime = Shot.ServerTime;
+	Recorded.ClientTimeStamp = Shot.ClientTimeStamp;
+	Recorded.PredictionAmount = Shot.PredictionAmount;
+	Recorded.RewindTime = Shot.RewindTime;
+	Recorded.StartLocation = Shot.StartLocation;
+	Recorded.EndLocation = Shot.EndLocation;
+	Recorded.ClientPosition = Shot.ClientPosition;
+	Recorded.BlockTime = Result.BlockTime;
+	Recorded.bTracedWorld = Result.bTracedWorld;
+
+	// the rewound state the shot was tested against, so a replay runs the same test
+	const ULCShotValidationSubsystem* ShotValidation = GetWorld()->GetSubsystem<ULCShotValidationSubsystem>();
+	const ULCRewindHistorySubsystem* RewindHistory = GetWorld()->GetSubsystem<ULCRewindHistorySubsystem>();
+	const FLCRewindBucket& Bucket = ShotValidation->GetBucket(Shot.BucketIndex);
+	Recorded.BucketTime = Bucket.Time;
+	Recorded.Capsules = Bucket.Capsules;
+	Recorded.Hitboxes = Bucket.Hitboxes;
+	Recorded.HitboxStart = Bucket.HitboxStart;
+	Recorded.CapsuleIds.Reset(Bucket.Slots.Num());
+	for (const int32 Slot : Bucket.Slots)
+	{
+		Recorded.CapsuleIds.Add(GetCharacterId(RewindHistory ? RewindHistory->GetCharacter(Slot) : nullptr));
+	}
+	Writer->AddShot(Recorded);
+}
+
+uint16 ULCRewindLogSubsystem::GetCharacterId(const ALagCompensationCharacter* Character)
+{
+	if (Character == nullptr || !Writer)
+	{
+		return MAX_uint16;
+	}
+
+	if (const uint16* Id = CharacterIds.Find(Character))
+	{
+		return *Id;
+	}
+
+	if (NextCharacterId == MAX_uint16)
+	{
+		return MAX_uint16;
+	}
+
+	const uint16 Id = NextCharacterId++;
+	CharacterIds.Add(Character, Id);
+	const UCapsuleComponent* Capsule = Character->GetCapsuleComponent();
+	Writer->AddCharacter(Id, Character->GetName(), Capsule->GetScaledCapsuleRadius(), Capsule->GetScaledCapsuleHalfHeight());
+	return Id;
+}
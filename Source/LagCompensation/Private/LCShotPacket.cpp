@@ -0,0 +1,172 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCShotPacket.h"
+
+#include "Engine/NetSerialization.h"
+#include "LagCompensation/LagCompensation.h"
+#include "LagCompensation/LagCompensationCharacter.h"
+#include "LCQuantization.h"
+#include "Serialization/BitWriter.h"
+
+namespace LCShotPacket
+{
+	constexpr float OriginScale = 8.f;
+	constexpr float RangeStep = 10.f;
+	constexpr float TimeStampScale = 10000.f;
+
+	/** The largest delta is reserved to mark a saturated one. */
+	constexpr int32 MaxTimeStampTicks = MAX_uint16 - 1;
+	constexpr uint16 SaturatedTimeStampDelta = MAX_uint16;
+
+	FORCEINLINE int32 ToTimeStampTicks(float BaseTimeStamp, float ClientTimeStamp)
+	{
+		return FMath::RoundToInt((ClientTimeStamp - BaseTimeStamp) * TimeStampScale);
+	}
+}
+
+bool FLCShotPacket::FitsTimeStampDelta(float BaseTimeStamp, float ClientTimeStamp)
+{
+	const int32 Ticks = LCShotPacket::ToTimeStampTicks(BaseTimeStamp, ClientTimeStamp);
+	return Ticks >= 0 && Ticks <= LCShotPacket::MaxTimeStampTicks;
+}
+
+bool FLCShotPacket::IsSaturated() const
+{
+	// FLCQuantization::ToFixed16 clamps to +-MAX_int16
+	return TimeStampDelta == LCShotPacket::SaturatedTimeStampDelta
+		|| FMath::Abs((int32)Origin[0]) == MAX_int16 || FMath::Abs((int32)Origin[1]) == MAX_int16 || FMath::Abs((int32)Origin[2]) == MAX_int16;
+}
+
+FLCShotPacket FLCShotPacket::Make(const FVector& ShooterPosition, float BaseTimeStamp, float ClientTimeStamp, float PredictionAmount,
+	const FVector& StartLocation, const FVector& EndLocation, ALagCompensationCharacter* InVictim, const FVector& InClientPosition)
+{
+	using namespace LCShotPacket;
+
+	FLCShotPacket Packet;
+	const FVector Origin = StartLocation - ShooterPosition;
+	Packet.Origin[0] = FLCQuantization::ToFixed16(Origin.X, OriginScale);
+	Packet.Origin[1] = FLCQuantization::ToFixed16(Origin.Y, OriginScale);
+	Packet.Origin[2] = FLCQuantization::ToFixed16(Origin.Z, OriginScale);
+
+	const FVector Delta = EndLocation - StartLocation;
+	FLCQuantization::EncodeUnitVector(Delta.GetSafeNormal(), Packet.Direction[0], Packet.Direction[1]);
+	Packet.Range = (uint16)FMath::Clamp(FMath::RoundToInt(Delta.Size() / RangeStep), 0, (int32)MAX_uint16);
+
+	Packet.TimeStampDelta = FitsTimeStampDelta(BaseTimeStamp, ClientTimeStamp) ? (uint16)ToTimeStampTicks(BaseTimeStamp, ClientTimeStamp) : SaturatedTimeStampDelta;
+	Packet.PredictionMs = (uint16)FMath::Clamp(FMath::RoundToInt(PredictionAmount * 1000.f), 0, (int32)MAX_uint16);
+	Packet.Victim = InVictim;
+	Packet.ClientPosition = InClientPosition;
+	return Packet;
+}
+
+FVector FLCShotPacket::GetStartLocation(const FVector& ShooterPosition) const
+{
+	const float InvScale = 1.f / LCShotPacket::OriginScale;
+	return ShooterPosition + FVector(Origin[0], Origin[1], Origin[2]) * InvScale;
+}
+
+FVector FLCShotPacket::GetEndLocation(const FVector& ShooterPosition) const
+{
+	return GetStartLocation(ShooterPosition) + FLCQuantization::DecodeUnitVector(Direction[0], Direction[1]) * (Range * LCShotPacket::RangeStep);
+}
+
+float FLCShotPacket::GetClientTimeStamp(float BaseTimeStamp) const
+{
+	return BaseTimeStamp + TimeStampDelta / LCShotPacket::TimeStampScale;
+}
+
+bool FLCShotPacket::NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+{
+	bOutSuccess = true;
+
+	Ar << Origin[0] << Origin[1] << Origin[2];
+	Ar << Direction[0] << Direction[1];
+
+	// small values in practice, packed ints take one or two bytes
+	uint32 PackedRange = Range;
+	uint32 PackedTimeStampDelta = TimeStampDelta;
+	uint32 PackedPredictionMs = PredictionMs;
+	Ar.SerializeIntPacked(PackedRange);
+	Ar.SerializeIntPacked(PackedTimeStampDelta);
+	Ar.SerializeIntPacked(PackedPredictionMs);
+	Range = (uint16)FMath::Min<uint32>(PackedRange, MAX_uint16);
+	TimeStampDelta = (uint16)FMath::Min<uint32>(PackedTimeStampDelta, MAX_uint16);
+	PredictionMs = (uint16)FMath::Min<uint32>(PackedPredictionMs, MAX_uint16);
+
+	uint8 bHasVictim = Victim != nullptr ? 1 : 0;
+	Ar.SerializeBits(&bHasVictim, 1);
+	if (bHasVictim)
+	{
+		UObject* VictimObject = Victim;
+		if (Map)
+		{
+			bOutSuccess &= Map->SerializeObject(Ar, ALagCompensationCharacter::StaticClass(), VictimObject);
+		}
+		Victim = Cast<ALagCompensationCharacter>(VictimObject);
+		bOutSuccess &= SerializePackedVector<1, 24>(ClientPosition, Ar);
+	}
+	else if (Ar.IsLoading())
+	{
+		Victim = nullptr;
+		ClientPosition = FVector::ZeroVector;
+	}
+
+	return true;
+}
+
+namespace LCShotPacket
+{
+	/** Bytes per shot of the old OnFire_Server parameters and of FLCShotPacket batches, for a few random shots. */
+	static void MeasureBandwidth(const TArray<FString>& Args)
+	{
+		const int32 NumShots = 64;
+		const int32 BatchSize = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 4;
+		FRandomStream Random(1234);
+
+		// the old RPC: prediction float, start and end vectors, controller and victim references, client position.
+		// object references go out as packed NetGUIDs, modelled here with a typical value and null. Shots that
+		// missed on the client are compared, with a victim both sides pay for the same NetGUID
+		FBitWriter LegacyWriter(0, true);
+		for (int32 Shot = 0; Shot < NumShots; Shot++)
+		{
+			float PredictionAmount = Random.FRandRange(0.02f, 0.2f);
+			FVector Start = Random.GetUnitVector() * 5000.f;
+			FVector End = Start + Random.GetUnitVector() * 10000.f;
+			FVector ClientPosition = Random.GetUnitVector() * 5000.f;
+			uint32 ControllerGUID = 24;
+			uint32 VictimGUID = 0;
+			LegacyWriter << PredictionAmount << Start << End;
+			LegacyWriter.SerializeIntPacked(ControllerGUID);
+			LegacyWriter.SerializeIntPacked(VictimGUID);
+			LegacyWriter << ClientPosition;
+		}
+
+		// batches of FLCShotPacket: a base timestamp and an array count per batch
+		FBitWriter PacketWriter(0, true);
+		for (int32 First = 0; First < NumShots; First += BatchSize)
+		{
+			float BaseTimeStamp = 100.f + First / 60.f;
+			PacketWriter << BaseTimeStamp;
+			uint32 Count = FMath::Min(BatchSize, NumShots - First);
+			PacketWriter.SerializeIntPacked(Count);
+			for (uint32 Index = 0; Index < Count; Index++)
+			{
+				const FVector ShooterPosition = Random.GetUnitVector() * 5000.f;
+				const FVector Start = ShooterPosition + Random.GetUnitVector() * 100.f;
+				FLCShotPacket Packet = Make(ShooterPosition, BaseTimeStamp, BaseTimeStamp + Index / 60.f, Random.FRandRange(0.02f, 0.2f),
+					Start, Start + Random.GetUnitVector() * 10000.f, nullptr, FVector::ZeroVector);
+				bool bSuccess;
+				Packet.NetSerialize(PacketWriter, nullptr, bSuccess);
+			}
+		}
+
+		UE_LOG(LogLagCompensation, Display, TEXT("Shot RPC payload: %.1f bytes/shot before, %.1f bytes/shot with FLCShotPacket in batches of %d"),
+			LegacyWriter.GetNumBits() / 8.f / NumShots, PacketWriter.GetNumBits() / 8.f / NumShots, BatchSize);
+	}
+
+	static FAutoConsoleCommand MeasureBandwidthCommand(
+		TEXT("LagComp.ShotBandwidth"),
+		TEXT("Logs the bytes per shot of the shot RPC payload before and after packing. Optional argument: batch size."),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&MeasureBandwidth));
+}
@@ -0,0 +1,398 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCShotValidationSubsystem.h"
+
+#include "Async/ParallelFor.h"
+#include "Engine/World.h"
+#include "Kismet/KismetSystemLibrary.h"
+#include "LagCompensation/LagCompensation.h"
+#include "LagCompensation/LagCompensationCharacter.h"
+#include "LCDebugDrawSubsystem.h"
+#include "LCRewindHistorySubsystem.h"
+
+DECLARE_CYCLE_STAT(TEXT("Process Shots"), STAT_LagComp_ProcessShots, STATGROUP_LagComp);
+DECLARE_CYCLE_STAT(TEXT("Rewind Lookup"), STAT_LagComp_RewindLookup, STATGROUP_LagComp);
+DECLARE_CYCLE_STAT(TEXT("Validate Shots"), STAT_LagComp_ValidateShots, STATGROUP_LagComp);
+DECLARE_CYCLE_STAT(TEXT("Hitbox Test"), STAT_LagComp_HitboxTest, STATGROUP_LagComp);
+DECLARE_CYCLE_STAT(TEXT("World Traces"), STAT_LagComp_WorldTraces, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Shots Validated"), STAT_LagComp_ShotsValidated, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Rewind Buckets"), STAT_LagComp_RewindBuckets, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Rewound Characters"), STAT_LagComp_RewoundCharacters, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Traces"), STAT_LagComp_NumWorldTraces, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Hit Disagreements"), STAT_LagComp_HitDisagreements, STATGROUP_LagComp);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Implausible Hit Claims"), STAT_LagComp_ImplausibleClaims, STATGROUP_LagComp);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Max Rewind Error (cm)"), STAT_LagComp_MaxRewindError, STATGROUP_LagComp);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Hit Agreement (%)"), STAT_LagComp_HitAgreement, STATGROUP_LagComp);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Average Rewind Error (cm)"), STAT_LagComp_AverageRewindError, STATGROUP_LagComp);
+
+namespace LCShotValidation
+{
+	static void DumpStats(UWorld* World)
+	{
+		const ULCShotValidationSubsystem* ShotValidation = World ? World->GetSubsystem<ULCShotValidationSubsystem>() : nullptr;
+		if (ShotValidation)
+		{
+			ShotValidation->DumpStats();
+		}
+	}
+
+	static FAutoConsoleCommandWithWorld DumpStatsCommand(
+		TEXT("LagComp.DumpStats"),
+		TEXT("Logs the shots validated in this world, the client/server hit agreement rate and the rewind error."),
+		FConsoleCommandWithWorldDelegate::CreateStatic(&DumpStats));
+}
+
+ULCShotValidationSubsystem::ULCShotValidationSubsystem()
+	: NumBuckets(0)
+	, TotalShotsValidated(0)
+	, TotalShotsAgreed(0)
+	, TotalRewindError(0.0)
+	, TotalRewindErrorShots(0)
+	, MaxRewindError(0.f)
+	, TotalImplausibleClaims(0)
+	, TotalProcessingTime(0.0)
+{
+	RewindTimeMode = ELCRewindTimeMode::Adaptive;
+	RewindTimeBucketSize = 0.004f;
+	MinShotsForParallelValidation = 8;
+	ClaimTimeWindow = 0.25f;
+	MaxClaimError = 100.f;
+}
+
+bool ULCShotValidationSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	UWorld* World = Cast<UWorld>(Outer);
+	return World && World->IsGameWorld();
+}
+
+void ULCShotValidationSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Collection.InitializeDependency(ULCRewindHistorySubsystem::StaticClass());
+	Super::Initialize(Collection);
+
+	PreActorTickHandle = FWorldDelegates::OnWorldPreActorTick.AddUObject(this, &ULCShotValidationSubsystem::OnWorldPreActorTick);
+}
+
+void ULCShotValidationSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldPreActorTick.Remove(PreActorTickHandle);
+	QueuedShots.Reset();
+
+	Super::Deinitialize();
+}
+
+void ULCShotValidationSubsystem::QueueShot(const FLCPendingShot& Shot)
+{
+	FLCPendingShot& QueuedShot = QueuedShots.Add_GetRef(Shot);
+	QueuedShot.QueuedTime = FPlatformTime::Seconds();
+}
+
+void ULCShotValidationSubsystem::OnWorldPreActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	if (World == GetWorld())
+	{
+		ProcessQueuedShots();
+	}
+}
+
+void ULCShotValidationSubsystem::ProcessQueuedShots()
+{
+	if (QueuedShots.Num() == 0)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_LagComp_ProcessShots);
+	CSV_SCOPED_TIMING_STAT(LagComp, ProcessShots);
+	const double StartTime = FPlatformTime::Seconds();
+
+	const ULCRewindHistorySubsystem* RewindHistory = GetWorld()->GetSubsystem<ULCRewindHistorySubsystem>();
+	if (RewindHistory == nullptr)
+	{
+		QueuedShots.Reset();
+		return;
+	}
+
+	// shots sharing a bucket end up next to each other, in the order they arrived
+	for (FLCPendingShot& Shot : QueuedShots)
+	{
+		Shot.RewindBucket = FMath::RoundToInt(Shot.RewindTime / RewindTimeBucketSize);
+	}
+	QueuedShots.StableSort([](const FLCPendingShot& A, const FLCPendingShot& B) { return A.RewindBucket < B.RewindBucket; });
+
+	Results.Reset();
+	Results.SetNum(QueuedShots.Num());
+
+	NumBuckets = 0;
+	for (int32 First = 0; First < QueuedShots.Num();)
+	{
+		int32 Count = 1;
+		while (First + Count < QueuedShots.Num() && QueuedShots[First + Count].RewindBucket == QueuedShots[First].RewindBucket)
+		{
+			Count++;
+		}
+
+		if (NumBuckets == Buckets.Num())
+		{
+			Buckets.AddDefaulted();
+		}
+		Buckets[NumBuckets].FirstShot = First;
+		Buckets[NumBuckets].NumShots = Count;
+		for (int32 ShotIndex = First; ShotIndex < First + Count; ShotIndex++)
+		{
+			QueuedShots[ShotIndex].BucketIndex = NumBuckets;
+		}
+
+		NumBuckets++;
+		First += Count;
+	}
+
+	// rewound world states are built on workers. They read the frames through a reader and the characters
+	// through their state taken here, never the characters themselves
+	{
+		CSV_SCOPED_TIMING_STAT(LagComp, RewindLookup);
+		const FLCRewindHistoryReader Reader = RewindHistory->GetReader();
+		RewindHistory->GetSlotStates(SlotStates);
+		ParallelFor(NumBuckets, [this, RewindHistory, &Reader](int32 BucketIndex)
+		{
+			SCOPE_CYCLE_COUNTER(STAT_LagComp_RewindLookup);
+			BuildBucket(*RewindHistory, Reader, Buckets[BucketIndex]);
+		}, NumBuckets < 2 || QueuedShots.Num() < MinShotsForParallelValidation);
+	}
+
+	INC_DWORD_STAT_BY(STAT_LagComp_RewindBuckets, NumBuckets);
+	for (int32 BucketIndex = 0; BucketIndex < NumBuckets; BucketIndex++)
+	{
+		INC_DWORD_STAT_BY(STAT_LagComp_RewoundCharacters, Buckets[BucketIndex].Slots.Num());
+	}
+
+	// shots are independent of each other once their bucket exists
+	{
+		SCOPE_CYCLE_COUNTER(STAT_LagComp_ValidateShots);
+		ParallelFor(QueuedShots.Num(), [this](int32 ShotIndex)
+		{
+			ValidateShot(ShotIndex);
+		}, QueuedShots.Num() < MinShotsForParallelValidation);
+	}
+
+	ApplyResults(*RewindHistory);
+	QueuedShots.Reset();
+
+	TotalProcessingTime += FPlatformTime::Seconds() - StartTime;
+}
+
+void ULCShotValidationSubsystem::BuildBucket(const ULCRewindHistorySubsystem& RewindHistory, const FLCRewindHistoryReader& Reader, FLCRewindBucket& Bucket)
+{
+	Bucket.Time = QueuedShots[Bucket.FirstShot].RewindBucket * RewindTimeBucketSize;
+	Bucket.Slots.Reset();
+	Bucket.Hitboxes.Reset();
+	Bucket.HitboxStart.Reset();
+
+	// broad phase: only characters whose recent movement comes near one of the shot lines need to be rewound
+	TArray<FBox>& SweptBounds = Bucket.SweptBounds;
+	ELCRewindReadResult ReadResult = Reader.ComputeSweptBounds(Bucket.Time, Bucket.Time, SlotStates, SweptBounds);
+	if (ReadResult != ELCRewindReadResult::Ok)
+	{
+		UE_LOG(LogLagCompensation, Warning, TEXT("Rewind history could not be read for %d shots at %.3f, they miss"), Bucket.NumShots, Bucket.Time);
+		Bucket.Capsules.SetNum(0);
+		return;
+	}
+	Bucket.SlotToIndex.Init(INDEX_NONE, SweptBounds.Num());
+
+	for (int32 ShotIndex = Bucket.FirstShot; ShotIndex < Bucket.FirstShot + Bucket.NumShots; ShotIndex++)
+	{
+		const FLCPendingShot& Shot = QueuedShots[ShotIndex];
+		const FVector Direction = Shot.EndLocation - Shot.StartLocation;
+		for (int32 Slot = 0; Slot < SweptBounds.Num(); Slot++)
+		{
+			if (Bucket.SlotToIndex[Slot] == INDEX_NONE && Slot != Shot.ShooterSlot && SweptBounds[Slot].IsValid
+				&& FMath::LineBoxIntersection(SweptBounds[Slot], Shot.StartLocation, Shot.EndLocation, Direction))
+			{
+				Bucket.SlotToIndex[Slot] = Bucket.Slots.Add(Slot);
+			}
+		}
+	}
+
+	// the rewound world state for this bucket, shared by all of its shots
+	ReadResult = Reader.RewindSlots(Bucket.Time, Bucket.Slots, SlotStates, Bucket.Capsules);
+	if (ReadResult != ELCRewindReadResult::Ok)
+	{
+		UE_LOG(LogLagCompensation, Warning, TEXT("Rewind history could not be read for %d shots at %.3f, they miss"), Bucket.NumShots, Bucket.Time);
+		Bucket.Slots.Reset();
+		Bucket.Capsules.SetNum(0);
+		return;
+	}
+
+	if (RewindHistory.IsRecordingHitboxes())
+	{
+		for (const int32 Slot : Bucket.Slots)
+		{
+			Bucket.HitboxStart.Add(Bucket.Hitboxes.Num());
+			RewindHistory.RewindHitboxes(Slot, Bucket.Time, Bucket.Hitboxes);
+		}
+		Bucket.HitboxStart.Add(Bucket.Hitboxes.Num());
+	}
+}
+
+void ULCShotValidationSubsystem::ValidateShot(int32 ShotIndex)
+{
+	const FLCPendingShot& Shot = QueuedShots[ShotIndex];
+	const FLCRewindBucket& Bucket = Buckets[Shot.BucketIndex];
+	if (Bucket.Slots.Num() == 0)
+	{
+		return;
+	}
+
+	const int32 IgnoreIndex = Bucket.SlotToIndex.IsValidIndex(Shot.ShooterSlot) ? Bucket.SlotToIndex[Shot.ShooterSlot] : INDEX_NONE;
+
+	FLCShotResult& Result = Results[ShotIndex];
+	CONDITIONAL_SCOPE_CYCLE_COUNTER(STAT_LagComp_HitboxTest, Bucket.HitboxStart.Num() > 0);
+
+	int32 HitHitbox;
+	const int32 HitIndex = FLCRewindMath::SegmentCharacterIntersection(Shot.StartLocation, Shot.EndLocation, Bucket.Capsules, Bucket.Hitboxes, Bucket.HitboxStart,
+		IgnoreIndex, Result.HitTime, HitHitbox);
+	if (HitIndex != INDEX_NONE)
+	{
+		Result.HitSlot = Bucket.Slots[HitIndex];
+		Result.HitZone = HitHitbox != INDEX_NONE ? (ELCHitZone)Bucket.Hitboxes[HitHitbox].Zone : ELCHitZone::Body;
+		Result.RewoundPosition = Bucket.Capsules.GetCenter(HitIndex);
+		Result.RewoundHalfHeight = Bucket.Capsules.HalfHeight[HitIndex];
+	}
+}
+
+void ULCShotValidationSubsystem::ApplyResults(const ULCRewindHistorySubsystem& RewindHistory)
+{
+	int32 NumShots = 0;
+	int32 NumTraces = 0;
+	int32 NumAgreed = 0;
+	int32 NumRewindErrors = 0;
+	int32 NumImplausibleClaims = 0;
+	float RewindErrorSum = 0.f;
+	float RewindErrorMax = 0.f;
+
+	// the physics trace only checks world geometry, live players are never in the way
+	TArray<AActor*> ActorsToIgnore;
+	for (int32 Slot = 0; Slot < RewindHistory.GetNumSlots(); Slot++)
+	{
+		if (ALagCompensationCharacter* Character = RewindHistory.GetCharacter(Slot))
+		{
+			ActorsToIgnore.Add(Character);
+		}
+	}
+
+	for (int32 ShotIndex = 0; ShotIndex < QueuedShots.Num(); ShotIndex++)
+	{
+		const FLCPendingShot& Shot = QueuedShots[ShotIndex];
+		FLCShotResult& Result = Results[ShotIndex];
+		ALagCompensationCharacter* Shooter = Shot.Shooter.Get();
+		if (Shooter == nullptr)
+		{
+			continue;
+		}
+
+		ALagCompensationCharacter* HitCharacter = RewindHistory.GetCharacter(Result.HitSlot);
+		if (HitCharacter)
+		{
+			SCOPE_CYCLE_COUNTER(STAT_LagComp_WorldTraces);
+			NumTraces++;
+
+			//fire a trace from a given spot (yup the player can cheat here. checking against the current muzzle
+			//location could help)
+			FHitResult OutHit;
+			const bool bHitOccurred = UKismetSystemLibrary::LineTraceSingle(GetWorld(), Shot.StartLocation, Shot.EndLocation, ETraceTypeQuery::TraceTypeQuery1,
+				false, ActorsToIgnore, ULCDebugDrawSubsystem::GetTraceDrawType(), OutHit, true);
+			Result.bTracedWorld = true;
+			Result.BlockTime = bHitOccurred ? OutHit.Time : 1.f;
+			if (bHitOccurred && OutHit.Time < Result.HitTime)
+			{
+				// world geometry was in the way
+				HitCharacter = nullptr;
+				Result.HitSlot = INDEX_NONE;
+			}
+		}
+
+		NumShots++;
+		const ALagCompensationCharacter* Victim = Shot.Victim.Get();
+		if (Victim)
+		{
+			CheckClaim(Shot, *Victim, Result);
+			if (Result.bImplausibleClaim)
+			{
+				NumImplausibleClaims++;
+				UE_LOG(LogLagCompensation, Verbose, TEXT("%s: claimed a hit on %s at %s, %.1f cm from its path (%.3f s from the rewind time)"),
+					*Shooter->GetName(), *Victim->GetName(), *Shot.ClientPosition.ToString(), Result.ClaimError, Result.ClaimTimeOffset);
+			}
+		}
+		if (HitCharacter == Victim)
+		{
+			NumAgreed++;
+			if (HitCharacter)
+			{
+				// how far the victim we rewound to is from where the shooter saw it
+				const float RewindError = FVector::Dist(Shot.ClientPosition, Result.RewoundPosition);
+				RewindErrorSum += RewindError;
+				RewindErrorMax = FMath::Max(RewindErrorMax, RewindError);
+				NumRewindErrors++;
+			}
+		}
+
+		Shooter->OnShotValidated(Shot, Result, HitCharacter);
+		OnShotValidated.Broadcast(Shot, Result, HitCharacter);
+	}
+
+	TotalShotsValidated += NumShots;
+	TotalShotsAgreed += NumAgreed;
+	TotalRewindError += RewindErrorSum;
+	TotalRewindErrorShots += NumRewindErrors;
+	MaxRewindError = FMath::Max(MaxRewindError, RewindErrorMax);
+	TotalImplausibleClaims += NumImplausibleClaims;
+
+	INC_DWORD_STAT_BY(STAT_LagComp_ShotsValidated, NumShots);
+	INC_DWORD_STAT_BY(STAT_LagComp_NumWorldTraces, NumTraces);
+	INC_DWORD_STAT_BY(STAT_LagComp_HitDisagreements, NumShots - NumAgreed);
+	INC_DWORD_STAT_BY(STAT_LagComp_ImplausibleClaims, NumImplausibleClaims);
+	SET_FLOAT_STAT(STAT_LagComp_MaxRewindError, RewindErrorMax);
+	SET_FLOAT_STAT(STAT_LagComp_HitAgreement, GetHitAgreementRate() * 100.f);
+	SET_FLOAT_STAT(STAT_LagComp_AverageRewindError, GetAverageRewindError());
+
+	CSV_CUSTOM_STAT(LagComp, ShotsValidated, NumShots, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(LagComp, TracesPerShot, NumShots > 0 ? (float)NumTraces / NumShots : 0.f, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(LagComp, HitAgreement, NumShots > 0 ? (float)NumAgreed / NumShots : 1.f, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(LagComp, ImplausibleClaims, NumImplausibleClaims, ECsvCustomStatOp::Set);
+	if (NumRewindErrors > 0)
+	{
+		CSV_CUSTOM_STAT(LagComp, RewindErrorAverage, RewindErrorSum / NumRewindErrors, ECsvCustomStatOp::Set);
+		CSV_CUSTOM_STAT(LagComp, RewindErrorMax, RewindErrorMax, ECsvCustomStatOp::Set);
+	}
+}
+
+void ULCShotValidationSubsystem::CheckClaim(const FLCPendingShot& Shot, const ALagCompensationCharacter& Victim, FLCShotResult& Result) const
+{
+	FLCClosestSavedPosition Closest;
+	if (!Victim.FindClosestPosition(Shot.ClientPosition, Shot.RewindTime - ClaimTimeWindow, Shot.RewindTime + ClaimTimeWindow, Closest))
+	{
+		// nothing recorded around the rewind time, a victim that just spawned; nothing to compare with
+		return;
+	}
+
+	Result.ClaimTimeOffset = Closest.Time - Shot.RewindTime;
+	Result.ClaimError = FMath::Sqrt(Closest.DistanceSquared);
+	Result.bImplausibleClaim = Closest.DistanceSquared > FMath::Square(MaxClaimError);
+}
+
+float ULCShotValidationSubsystem::GetHitAgreementRate() const
+{
+	return TotalShotsValidated > 0 ? (float)((double)TotalShotsAgreed / TotalShotsValidated) : 1.f;
+}
+
+float ULCShotValidationSubsystem::GetAverageRewindError() const
+{
+	return TotalRewindErrorShots > 0 ? (float)(TotalRewindError / TotalRewindErrorShots) : 0.f;
+}
+
+void ULCShotValidationSubsystem::DumpStats() const
+{
+	UE_LOG(LogLagCompensation, Display, TEXT("%s: %lld shots validated, client and server agreed on %.1f%%, rewind error %.2f cm average and %.2f cm max over %lld hits, %lld implausible hit claims"),
+		*GetWorld()->GetName(), TotalShotsValidated, GetHitAgreementRate() * 100.f, GetAverageRewindError(), MaxRewindError, TotalRewindErrorShots, TotalImplausibleClaims);
+}
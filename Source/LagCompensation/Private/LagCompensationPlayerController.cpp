@@ -4,6 +4,9 @@
 #include "LagCompensationPlayerController.h"
 
 #include "DrawDebugHelpers.h"
+#include "Engine/NetConnection.h"
+#include "GameFramework/Character.h"
+#include "GameFramework/CharacterMovementComponent.h"
 #include "GameFramework/PlayerState.h"
 #include "Net/UnrealNetwork.h"
 
@@ -12,6 +15,10 @@ ALagCompensationPlayerController::ALagCompensationPlayerController(const class F
 {
 	MaxPing = 200.f;
 	PredictionFudgeFactor = 0.f;
+	RewindDelayPercentile = 0.5f;
+	MinTimingSamples = 32;
+	MaxInterpolationDelay = 0.25f;
+	InterpolationDelay = 0.f;
 }
 
 void ALagCompensationPlayerController::GetLifetimeReplicatedProps(TArray<class FLifetimeProperty>& OutLifetimeProps) const
@@ -30,6 +37,21 @@ void ALagCompensationPlayerController::BeginPlay()
 void ALagCompensationPlayerController::Tick(float DeltaSeconds)
 {
 	Super::Tick(DeltaSeconds);
+
+	if (HasAuthority())
+	{
+		TimingEstimator.SetRoundTripTime(GetServerRoundTripTime());
+	}
+	else if (IsLocalController())
+	{
+		// smoothing settings rarely change, only tell the server when they do
+		const float NewInterpolationDelay = ComputeInterpolationDelay();
+		if (!FMath::IsNearlyEqual(NewInterpolationDelay, InterpolationDelay, 0.001f))
+		{
+			InterpolationDelay = NewInterpolationDelay;
+			ServerSetInterpolationDelay(NewInterpolationDelay);
+		}
+	}
 }
 
 float ALagCompensationPlayerController::GetPredictionTime()
@@ -38,13 +60,68 @@ float ALagCompensationPlayerController::GetPredictionTime()
 	return (PlayerState && (GetNetMode() != NM_Standalone)) ? (0.001f*FMath::Clamp(GetPlayerState<APlayerState>()->ExactPing - PredictionFudgeFactor, 0.f, MaxPing)) : 0.f;
 }
 
+float ALagCompensationPlayerController::GetServerRoundTripTime() const
+{
+	// AvgLag is measured by the server itself, unlike the ping the client predicts with
+	const UNetConnection* Connection = IsLocalController() ? nullptr : GetNetConnection();
+	return Connection ? FMath::Clamp(Connection->AvgLag, 0.f, 0.001f * MaxPing) : 0.f;
+}
+
+void ALagCompensationPlayerController::OnClientMovePerformed(float ClientTimeStamp)
+{
+	TimingEstimator.AddSample(ClientTimeStamp, GetWorld()->GetTimeSeconds());
+}
+
+float ALagCompensationPlayerController::GetAdaptiveRewindTime(float ClientTimeStamp) const
+{
+	return TimingEstimator.ClientToServerTime(ClientTimeStamp) - TimingEstimator.GetOneWayDelay(RewindDelayPercentile);
+}
+
+float ALagCompensationPlayerController::ComputeInterpolationDelay() const
+{
+	// other players' characters are of the same class as ours, so our movement component has their smoothing settings
+	const ACharacter* Character = Cast<ACharacter>(GetPawn());
+	const UCharacterMovementComponent* Movement = Character ? Character->GetCharacterMovement() : nullptr;
+	if (Movement == nullptr)
+	{
+		return InterpolationDelay;
+	}
+
+	switch (Movement->NetworkSmoothingMode)
+	{
+	case ENetworkSmoothingMode::Linear:
+		// interpolates from the previous to the new replicated location over the smoothing time
+	case ENetworkSmoothingMode::Exponential:
+		// the mesh offset decays with this time constant, which is also how far it trails a moving character
+		return Movement->NetworkSimulatedSmoothLocationTime;
+	default:
+		return 0.f;
+	}
+}
+
+void ALagCompensationPlayerController::ServerSetInterpolationDelay_Implementation(float NewInterpolationDelay)
+{
+	InterpolationDelay = FMath::Clamp(NewInterpolationDelay, 0.f, MaxInterpolationDelay);
+}
+
 void ALagCompensationPlayerController::ClientDebugRewind_Implementation(FVector_NetQuantize TargetLocation,
 	FVector_NetQuantize RewindLocation, FVector_NetQuantize PrePosition, FVector_NetQuantize PostPosition,
 	float TargetCapsuleHeight, float PredictionTime, float Percent, bool bTeleported)
 {
+#if ENABLE_DRAW_DEBUG
 	DrawDebugCapsule(GetWorld(), TargetLocation, TargetCapsuleHeight, 33.f, FQuat::Identity, FColor::Red, false, 8.f);
 	DrawDebugCapsule(GetWorld(), RewindLocation, TargetCapsuleHeight, 33.f, FQuat::Identity, FColor::Yellow, false, 8.f);
 	DrawDebugCapsule(GetWorld(), PrePosition, TargetCapsuleHeight - 20.f, 33.f, FQuat::Identity, FColor::Blue, false, 8.f);
 	DrawDebugCapsule(GetWorld(), PostPosition, TargetCapsuleHeight + 20.f, 33.f, FQuat::Identity, FColor::White, false, 8.f);
-	
+#endif
+}
+
+void ALagCompensationPlayerController::ClientDrawDebugRewinds_Implementation(const TArray<FLCRewindDebugRecord>& Records)
+{
+#if ENABLE_DRAW_DEBUG
+	if (ULCDebugDrawSubsystem* DebugDraw = GetWorld()->GetSubsystem<ULCDebugDrawSubsystem>())
+	{
+		DebugDraw->AddRemoteRewinds(Records);
+	}
+#endif
 }
@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCBenchmarkSubsystem.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "Misc/AutomationTest.h"
+#include "Tests/AutomationCommon.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace LCBenchmarkTests
+{
+	constexpr uint32 TestFlags = EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter;
+
+	const TCHAR* MapName = TEXT("/Game/FirstPersonCPP/Maps/FirstPersonExampleMap");
+
+	/** Settings of the run: bots, seconds, round trip ms, jitter ms, loss %. No jitter or loss, so the latency is known. */
+	constexpr int32 NumBots = 4;
+	constexpr float Duration = 3.f;
+	constexpr float RoundTripMs = 100.f;
+
+	/** Real seconds the run may take on a slow machine before the test gives up. */
+	constexpr double Timeout = 60.0;
+
+	UWorld* FindGameWorld()
+	{
+		for (const FWorldContext& Context : GEngine->GetWorldContexts())
+		{
+			if ((Context.WorldType == EWorldType::PIE || Context.WorldType == EWorldType::Game) && Context.World())
+			{
+				return Context.World();
+			}
+		}
+		return nullptr;
+	}
+
+	/** Starts a short benchmark in the loaded map and checks its report once it stops. */
+	class FRunBenchmarkCommand : public IAutomationLatentCommand
+	{
+	public:
+		explicit FRunBenchmarkCommand(FAutomationTestBase* InTest) : Test(InTest), bStarted(false) {}
+
+		virtual bool Update() override
+		{
+			UWorld* World = FindGameWorld();
+			ULCBenchmarkSubsystem* Benchmark = World ? World->GetSubsystem<ULCBenchmarkSubsystem>() : nullptr;
+			if (Benchmark == nullptr)
+			{
+				Test->AddError(TEXT("No game world with a benchmark subsystem"));
+				return true;
+			}
+
+			if (!bStarted)
+			{
+				Benchmark->StartBenchmark({ FString::FromInt(NumBots), FString::SanitizeFloat(Duration), FString::SanitizeFloat(RoundTripMs), TEXT("0"), TEXT("0") });
+				bStarted = true;
+				return false;
+			}
+
+			if (Benchmark->IsRunning())
+			{
+				if (GetCurrentRunTime() > Timeout)
+				{
+					Benchmark->StopBenchmark();
+					Test->AddError(TEXT("Benchmark did not finish in time"));
+					return true;
+				}
+				return false;
+			}
+
+			// each shot spends half the round trip on its way up, then waits at most a tick or two for validation
+			Test->TestTrue(TEXT("Bots fired"), Benchmark->GetShotsFired() > 0);
+			Test->TestTrue(TEXT("Shots were validated"), Benchmark->GetShotsValidated() > 0);
+			Test->TestTrue(TEXT("Nothing is validated twice"), Benchmark->GetShotsValidated() <= Benchmark->GetShotsFired());
+			Test->TestTrue(TEXT("Fire to result includes the uplink delay"), Benchmark->GetFireToResultTime(0.5f) >= 0.5f * RoundTripMs - 1.f);
+			Test->TestTrue(TEXT("Fire to result stays near the uplink delay"), Benchmark->GetFireToResultTime(0.5f) < 0.5f * RoundTripMs + 200.f);
+			return true;
+		}
+
+	private:
+		FAutomationTestBase* Test;
+		bool bStarted;
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCBenchmarkShortRunTest, "LagCompensation.Benchmark.ShortRun", LCBenchmarkTests::TestFlags)
+
+bool FLCBenchmarkShortRunTest::RunTest(const FString& Parameters)
+{
+	AutomationOpenMap(LCBenchmarkTests::MapName);
+	ADD_LATENT_AUTOMATION_COMMAND(LCBenchmarkTests::FRunBenchmarkCommand(this));
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
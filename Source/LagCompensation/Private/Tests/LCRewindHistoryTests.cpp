@@ -0,0 +1,256 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCRewindHistorySubsystem.h"
+#include "Async/Async.h"
+#include "LCSavedPositionHistory.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace LCRewindHistoryTests
+{
+	constexpr uint32 TestFlags = EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter;
+
+	/** A circle of 500 cm at 600 cm/s, a turn of 1.2 radians per second. */
+	FSavedPosition CirclePosition(float Time)
+	{
+		const float Angle = 1.2f * Time;
+		return FSavedPosition(FVector(FMath::Cos(Angle), FMath::Sin(Angle), 0.f) * 500.f, FRotator::ZeroRotator, false, Time,
+			Time, FVector(-FMath::Sin(Angle), FMath::Cos(Angle), 0.f) * 600.f);
+	}
+
+	/** Sizes the columns of Frames for NumRows frames (a power of two) of NumSlots slots, all zero. */
+	void AllocateRows(FLCRewindHistoryFrames& Frames, int32 NumRows, int32 NumSlots)
+	{
+		Frames.SlotCapacity = NumSlots;
+		Frames.FrameMask = NumRows - 1;
+		Frames.FrameTimes.SetNumZeroed(NumRows);
+		for (TArray<float>* Column : { &Frames.PositionX, &Frames.PositionY, &Frames.PositionZ, &Frames.VelocityX,
+			&Frames.VelocityY, &Frames.VelocityZ, &Frames.Yaw, &Frames.HalfHeight })
+		{
+			Column->SetNumZeroed(NumRows * NumSlots);
+		}
+		Frames.Flags.SetNumZeroed(NumRows * NumSlots);
+	}
+
+	/** Fills the rows of a single slot with Positions, one frame each, oldest in row 0. */
+	void FillRows(FLCRewindHistoryFrames& Frames, const TArray<FSavedPosition>& Positions)
+	{
+		AllocateRows(Frames, (int32)FMath::RoundUpToPowerOfTwo(Positions.Num()), 1);
+		for (int32 Row = 0; Row < Positions.Num(); Row++)
+		{
+			const FSavedPosition& Position = Positions[Row];
+			Frames.FrameTimes[Row] = Position.Time;
+			Frames.PositionX[Row] = Position.Position.X;
+			Frames.PositionY[Row] = Position.Position.Y;
+			Frames.PositionZ[Row] = Position.Position.Z;
+			Frames.VelocityX[Row] = Position.Velocity.X;
+			Frames.VelocityY[Row] = Position.Velocity.Y;
+			Frames.VelocityZ[Row] = Position.Velocity.Z;
+			Frames.Flags[Row] = FLCRewindHistoryFrames::FrameFlag_Valid;
+		}
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCRewindHistorySameCurveTest, "LagCompensation.RewindHistory.SameCurve", LCRewindHistoryTests::TestFlags)
+
+bool FLCRewindHistorySameCurveTest::RunTest(const FString& Parameters)
+{
+	using namespace LCRewindHistoryTests;
+
+	// 10 Hz frames, far enough apart for the chords to miss the arc by 0.9 cm
+	TArray<FSavedPosition> Positions;
+	for (int32 Index = 0; Index < 16; Index++)
+	{
+		Positions.Add(CirclePosition(Index * 0.1f));
+	}
+
+	for (const bool bHermite : { false, true })
+	{
+		FLCRewindHistoryFrames Frames;
+		FillRows(Frames, Positions);
+		Frames.bHermite = bHermite;
+
+		FLCSavedPositionHistory History;
+		History.Reserve(Positions.Num());
+		History.SetHermiteInterpolation(bHermite);
+		for (const FSavedPosition& Position : Positions)
+		{
+			History.Add(Position);
+		}
+
+		float MaxRowsError = 0.f;
+		float MaxArcError = 0.f;
+		for (int32 Query = 0; Query < 150; Query++)
+		{
+			const float Time = Query * 0.01f + 0.005f;
+			int32 RowA;
+			int32 RowB;
+			float Alpha;
+			Frames.GetRewindFrames(0, Positions.Num(), Time, RowA, RowB, Alpha);
+			const FVector Rewound = Frames.RewindSlotRows(0, RowA, RowB, Alpha);
+
+			// shots are validated on the path the character's saved positions follow
+			MaxRowsError = FMath::Max(MaxRowsError, FVector::Dist(Rewound, History.GetPositionAtTime(Time)));
+			MaxArcError = FMath::Max(MaxArcError, FVector::Dist(Rewound, CirclePosition(Time).Position));
+		}
+
+		const TCHAR* What = bHermite ? TEXT("Hermite") : TEXT("Linear");
+		TestTrue(FString::Printf(TEXT("%s: rows follow the saved positions, off by %.4f cm"), What, MaxRowsError), MaxRowsError <= 0.01f);
+		if (bHermite)
+		{
+			TestTrue(FString::Printf(TEXT("%s: on the arc, off by %.4f cm"), What, MaxArcError), MaxArcError <= 0.05f);
+		}
+		else
+		{
+			TestTrue(FString::Printf(TEXT("%s: chords cut the arc by %.4f cm"), What, MaxArcError), MaxArcError > 0.5f);
+		}
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCRewindHistoryConcurrentReadTest, "LagCompensation.RewindHistory.ConcurrentRead", LCRewindHistoryTests::TestFlags)
+
+bool FLCRewindHistoryConcurrentReadTest::RunTest(const FString& Parameters)
+{
+	using namespace LCRewindHistoryTests;
+
+	// a small ring, so readers are overtaken all the time; the writer leaves the same 4 rows of slack as the subsystem
+	constexpr int32 NumRows = 16;
+	constexpr int32 MaxFrames = NumRows - 4;
+	constexpr int32 NumSlots = 4;
+	constexpr int32 ReusedSlot = NumSlots - 1;
+	constexpr int32 NumReaders = 4;
+
+	const TSharedRef<FLCRewindHistoryFrames, ESPMode::ThreadSafe> Frames = MakeShared<FLCRewindHistoryFrames, ESPMode::ThreadSafe>();
+	AllocateRows(*Frames, NumRows, NumSlots);
+	const FLCRewindHistoryReader Reader(Frames);
+
+	// frame N puts every slot at X = 10 N and half height N, its slot number in Y: whatever a consistent read
+	// interpolates lies within 10 cm of ten times its half height, a read mixing two writes is off by 160 cm or more
+	std::atomic<bool> bStop(false);
+	std::atomic<int32> NumReads(0);
+	std::atomic<int32> NumTorn(0);
+	std::atomic<int32> NumContended(0);
+	std::atomic<int32> NumMissing(0);
+	std::atomic<int32> NumRetired(0);
+	TArray<TFuture<void>> Readers;
+	for (int32 ReaderIndex = 0; ReaderIndex < NumReaders; ReaderIndex++)
+	{
+		Readers.Add(Async(EAsyncExecution::TaskGraph, [&, ReaderIndex]()
+		{
+			FRandomStream Random(ReaderIndex);
+			while (!bStop.load(std::memory_order_relaxed))
+			{
+				float OldestTime;
+				float NewestTime;
+				if (!Reader.GetTimeRange(OldestTime, NewestTime))
+				{
+					continue;
+				}
+
+				const int32 Slot = Random.RandHelper(NumSlots);
+				FVector Position;
+				float HalfHeight;
+				switch (Reader.RewindSlot(Slot, Random.FRandRange(OldestTime - 0.01f, NewestTime + 0.01f), Position, HalfHeight))
+				{
+				case ELCRewindReadResult::Ok:
+					if (Position.Y != Slot || Position.X < 10.f * HalfHeight - 0.5f || Position.X > 10.f * HalfHeight + 10.5f)
+					{
+						NumTorn++;
+					}
+					break;
+				case ELCRewindReadResult::NoHistory:
+					// only the slot that is given up and taken again has frames without a character
+					if (Slot != ReusedSlot)
+					{
+						NumMissing++;
+					}
+					break;
+				case ELCRewindReadResult::Retired:
+					NumRetired++;
+					break;
+				case ELCRewindReadResult::Contended:
+					NumContended++;
+					break;
+				}
+				NumReads++;
+			}
+		}));
+	}
+
+	// the game thread's part, with the same calls as ULCRewindHistorySubsystem::RecordFrame and UnregisterCharacter
+	uint32 NextEpoch = 0;
+	int32 FrameCount = 0;
+	const double EndTime = FPlatformTime::Seconds() + 2.0;
+	for (int32 Frame = 0; Frame < 100000 && NumReads.load(std::memory_order_relaxed) < 200000 && FPlatformTime::Seconds() < EndTime; Frame++)
+	{
+		// the last slot is unregistered every 64 frames and taken again 32 frames later
+		const bool bReusedSlotRecorded = Frame % 64 < 32;
+		if (Frame % 64 == 32)
+		{
+			Frames->ClearSlotHistory(ReusedSlot, NextEpoch, FrameCount);
+		}
+
+		if (FrameCount == MaxFrames)
+		{
+			FrameCount--;
+		}
+		const int32 Row = Frames->BeginFrame(NextEpoch, Frame * 0.01f);
+		for (int32 Slot = 0; Slot < NumSlots; Slot++)
+		{
+			Frames->WriteSlot(Row, Slot, FVector(Frame * 10.f, Slot, 0.f), FVector::ZeroVector, 0.f, Frame,
+				Slot != ReusedSlot || bReusedSlotRecorded ? FLCRewindHistoryFrames::FrameFlag_Valid : 0);
+		}
+		FrameCount++;
+		Frames->EndFrame(NextEpoch, FrameCount);
+		NextEpoch++;
+
+		FPlatformProcess::YieldThread();
+	}
+
+	bStop = true;
+	for (TFuture<void>& Future : Readers)
+	{
+		Future.Wait();
+	}
+
+	AddInfo(FString::Printf(TEXT("%d reads, %d given up after retrying"), NumReads.load(), NumContended.load()));
+	TestTrue(TEXT("Readers ran"), NumReads > 0);
+	TestEqual(TEXT("Torn reads"), NumTorn.load(), 0);
+	TestEqual(TEXT("Recorded slots without history"), NumMissing.load(), 0);
+	TestEqual(TEXT("Retired while recording"), NumRetired.load(), 0);
+
+	FVector Position;
+	float HalfHeight;
+	TestTrue(TEXT("Consistent rows are read"), Reader.RewindSlot(0, 0.f, Position, HalfHeight) == ELCRewindReadResult::Ok);
+	TestTrue(TEXT("A slot out of range has no history"), Reader.RewindSlot(NumSlots, 0.f, Position, HalfHeight) == ELCRewindReadResult::NoHistory);
+
+	// shot validation builds its buckets from the rows and the slots' state, a slot without history is where it is now
+	Frames->ClearSlotHistory(ReusedSlot, NextEpoch, FrameCount);
+	TArray<FLCRewindSlotState> SlotStates;
+	SlotStates.Init({ FVector(-100.f, 0.f, 0.f), 50.f, 30.f, true }, NumSlots);
+	float OldestTime;
+	float NewestTime;
+	Reader.GetTimeRange(OldestTime, NewestTime);
+	FLCCapsuleBatch Capsules;
+	TestTrue(TEXT("Slots are rewound"), Reader.RewindSlots(NewestTime, { 0, ReusedSlot }, SlotStates, Capsules) == ELCRewindReadResult::Ok);
+	TestEqual(TEXT("A recorded slot is at its frame"), Capsules.GetCenter(0), FVector(10.f * Capsules.HalfHeight[0], 0.f, 0.f));
+	TestEqual(TEXT("A recorded slot has its radius"), Capsules.Radius[0], 30.f);
+	TestEqual(TEXT("A slot without history is at its current location"), Capsules.GetCenter(1), FVector(-100.f, 0.f, 0.f));
+	TArray<FBox> Bounds;
+	TestTrue(TEXT("Swept bounds are read"), Reader.ComputeSweptBounds(OldestTime, NewestTime, SlotStates, Bounds) == ELCRewindReadResult::Ok);
+	TestTrue(TEXT("Bounds of a recorded slot cover its frames"), Bounds[0].IsValid && Bounds[0].IsInside(Capsules.GetCenter(0)));
+	TestTrue(TEXT("Bounds of a slot without history are around its current location"), Bounds[ReusedSlot].IsInside(FVector(-100.f, 0.f, 0.f)));
+
+	// a write that reaches every row of the window and is never published: every attempt is overwritten
+	Frames->BeginWrite(NextEpoch + NumRows);
+	TestTrue(TEXT("Overwritten rows are given up on"), Reader.RewindSlot(0, 0.f, Position, HalfHeight) == ELCRewindReadResult::Contended);
+
+	Frames->bRetired = true;
+	TestTrue(TEXT("Retired rows are not read"), Reader.RewindSlot(0, 0.f, Position, HalfHeight) == ELCRewindReadResult::Retired);
+	return true;
+}
+
+#endif
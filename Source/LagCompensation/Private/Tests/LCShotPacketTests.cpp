@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCShotPacket.h"
+#include "Misc/AutomationTest.h"
+#include "Serialization/BitReader.h"
+#include "Serialization/BitWriter.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace LCShotPacketTests
+{
+	constexpr uint32 TestFlags = EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter;
+
+	FLCShotPacket SerializeRoundTrip(FLCShotPacket Packet)
+	{
+		bool bSuccess;
+		FBitWriter Writer(0, true);
+		Packet.NetSerialize(Writer, nullptr, bSuccess);
+
+		FLCShotPacket Read;
+		FBitReader Reader(Writer.GetData(), Writer.GetNumBits());
+		Read.NetSerialize(Reader, nullptr, bSuccess);
+		return Read;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCShotPacketRoundTripTest, "LagCompensation.ShotPacket.RoundTrip", LCShotPacketTests::TestFlags)
+
+bool FLCShotPacketRoundTripTest::RunTest(const FString& Parameters)
+{
+	using namespace LCShotPacketTests;
+
+	const FVector ShooterPosition(1234.5f, -876.25f, 90.f);
+	const FVector Start = ShooterPosition + FVector(20.f, 30.f, 60.f);
+	const FVector End = Start + FVector(6000.f, 8000.f, 0.f);
+	const FLCShotPacket Packet = SerializeRoundTrip(FLCShotPacket::Make(ShooterPosition, 100.f, 100.5f, 0.08f, Start, End, nullptr, FVector::ZeroVector));
+
+	TestFalse(TEXT("In range shot is not saturated"), Packet.IsSaturated());
+	TestEqual(TEXT("Start location"), Packet.GetStartLocation(ShooterPosition), Start, 1.f / 16.f);
+	TestEqual(TEXT("End location"), Packet.GetEndLocation(ShooterPosition), End, 10.f);
+	TestEqual(TEXT("Client timestamp"), Packet.GetClientTimeStamp(100.f), 100.5f, 0.0001f);
+	TestEqual(TEXT("Prediction amount"), Packet.GetPredictionAmount(), 0.08f, 0.001f);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCShotPacketSaturationTest, "LagCompensation.ShotPacket.Saturation", LCShotPacketTests::TestFlags)
+
+bool FLCShotPacketSaturationTest::RunTest(const FString& Parameters)
+{
+	using namespace LCShotPacketTests;
+
+	const FVector ShooterPosition(0.f, 0.f, 90.f);
+	const FVector Start = ShooterPosition + FVector(20.f, 0.f, 60.f);
+	const FVector End = Start + FVector(10000.f, 0.f, 0.f);
+
+	// the timestamp delta reaches 6.5 s, a batch that stays open longer has to start over
+	TestTrue(TEXT("6.5 s delta fits"), FLCShotPacket::FitsTimeStampDelta(100.f, 106.5f));
+	TestFalse(TEXT("7 s delta does not fit"), FLCShotPacket::FitsTimeStampDelta(100.f, 107.f));
+	TestFalse(TEXT("Negative delta does not fit"), FLCShotPacket::FitsTimeStampDelta(100.f, 99.f));
+	TestFalse(TEXT("6.5 s delta is not saturated"),
+		FLCShotPacket::Make(ShooterPosition, 100.f, 106.5f, 0.f, Start, End, nullptr, FVector::ZeroVector).IsSaturated());
+
+	const FLCShotPacket Stale = FLCShotPacket::Make(ShooterPosition, 100.f, 107.f, 0.f, Start, End, nullptr, FVector::ZeroVector);
+	TestTrue(TEXT("Stale timestamp saturates"), Stale.IsSaturated());
+	TestTrue(TEXT("Saturated timestamp stays saturated over the network"), SerializeRoundTrip(Stale).IsSaturated());
+	TestTrue(TEXT("Timestamp before the batch saturates"),
+		FLCShotPacket::Make(ShooterPosition, 100.f, 99.f, 0.f, Start, End, nullptr, FVector::ZeroVector).IsSaturated());
+
+	// an origin the shooter could not have fired from
+	const FVector FarStart = ShooterPosition + FVector(0.f, 5000.f, 0.f);
+	const FLCShotPacket Far = FLCShotPacket::Make(ShooterPosition, 100.f, 100.f, 0.f, FarStart, FarStart + FVector(10000.f, 0.f, 0.f), nullptr, FVector::ZeroVector);
+	TestTrue(TEXT("Far origin saturates"), Far.IsSaturated());
+	TestTrue(TEXT("Saturated origin stays saturated over the network"), SerializeRoundTrip(Far).IsSaturated());
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,167 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LCShotPacket.h"
+#include "LCShotValidationSubsystem.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LCBenchmarkSubsystem.generated.h"
+
+class ALagCompensationCharacter;
+struct FLCPendingShot;
+struct FLCShotResult;
+
+/**
+ * Headless lag compensation benchmark: server-side bots that shoot at each other over simulated latency,
+ * jitter and loss, see the README. The bots have no connection, the report lists what that leaves out.
+ * Not created in Shipping builds.
+ */
+UCLASS(config=Game)
+class LAGCOMPENSATION_API ULCBenchmarkSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	ULCBenchmarkSubsystem();
+
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+	virtual void Deinitialize() override;
+
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+
+	/**
+	 * Spawns the bots and starts measuring, server only.
+	 * @param Args	optional overrides: bots, duration in seconds, latency and jitter in ms, loss in percent
+	 */
+	void StartBenchmark(const TArray<FString>& Args);
+
+	/** Logs the report and destroys the bots. */
+	void StopBenchmark();
+
+	bool IsRunning() const { return bRunning; }
+
+	/** Results of the current or last run. */
+	int32 GetShotsFired() const { return ShotsFired; }
+	int32 GetShotsValidated() const { return ShotsValidated; }
+	int32 GetShotsAgreed() const { return ShotsAgreed; }
+
+	/** Time from a bot firing to the server's result at Percentile (0 to 1) of the validated shots, in ms. */
+	float GetFireToResultTime(float Percentile) const;
+
+private:
+	void OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+
+	void SpawnBots();
+
+	/** Steers bot BotIndex and fires when it is time. */
+	void TickBot(int32 BotIndex, float WorldTime);
+
+	void FireShot(int32 BotIndex, float WorldTime);
+
+	/** Replaces the bot's OnFire_Server RPC, the shots are delivered after the uplink delay. */
+	void SendShots(float BaseTimeStamp, const TArray<FLCShotPacket>& Shots, int32 BotIndex);
+
+	/** Hands the shots whose delay is over to the server. */
+	void DeliverShots(float WorldTime);
+
+	void HandleShotValidated(const FLCPendingShot& Shot, const FLCShotResult& Result, ALagCompensationCharacter* HitCharacter);
+
+	/** One way network delay in seconds. */
+	float SampleDelay();
+
+	/** Sets or clears the packet simulation of the world's net driver. */
+	void ApplyPacketSimulation(bool bEnable);
+
+	void LogReport() const;
+
+	UPROPERTY(Config)
+	int32 NumBots;
+
+	/** Length of a run, in seconds. */
+	UPROPERTY(Config)
+	float Duration;
+
+	/** Round trip time, in milliseconds. */
+	UPROPERTY(Config)
+	float Latency;
+
+	/** Extra delay of up to this many milliseconds on each way. */
+	UPROPERTY(Config)
+	float Jitter;
+
+	/** Percentage of shot batches that never arrive. */
+	UPROPERTY(Config)
+	float PacketLoss;
+
+	/** Seconds between two shots of a bot. */
+	UPROPERTY(Config)
+	float FireInterval;
+
+	/** Bots aim at a random point this far (in cm) from the target's center, so some shots miss. */
+	UPROPERTY(Config)
+	float AimError;
+
+	/** Bots stay within this distance of where they were spawned. */
+	UPROPERTY(Config)
+	float ArenaRadius;
+
+	struct FBot
+	{
+		TWeakObjectPtr<ALagCompensationCharacter> Character;
+		FVector MoveDirection;
+		float NextTurnTime;
+		float NextFireTime;
+
+		/** Move timestamp and world time of the shots fired that have no result yet. */
+		TArray<TPair<float, float>> ShotsAwaitingResult;
+	};
+
+	TArray<FBot> Bots;
+
+	/** A shot batch on its way to the server. */
+	struct FDelayedShots
+	{
+		TWeakObjectPtr<ALagCompensationCharacter> Shooter;
+		float DeliveryTime;
+		float BaseTimeStamp;
+		TArray<FLCShotPacket> Shots;
+	};
+
+	TArray<FDelayedShots> InFlight;
+
+	FRandomStream Random;
+	FVector ArenaCenter;
+
+	bool bRunning;
+
+	/** The bots' shots are validated in ClientPing mode, the configured mode is restored when the run stops. */
+	ELCRewindTimeMode ConfiguredRewindTimeMode;
+
+	/** Started from the command line, the process exits after the report. */
+	bool bExitWhenDone;
+
+	float StartTime;
+	float EndTime;
+	double StartProcessingTime;
+	int64 StartShotsValidated;
+
+	int32 ShotsFired;
+	int32 ShotsLost;
+	int32 ShotsValidated;
+	int32 ShotsAgreed;
+	int32 ClientHits;
+	int32 ServerHits;
+
+	/** World time from a bot firing a shot to its result, in ms, per validated shot. */
+	TArray<float> FireToResultTimes;
+
+	/** Real time between a shot being queued on the server and its result, in ms, per validated shot. */
+	TArray<float> QueueToResultTimes;
+
+	FDelegateHandle PostActorTickHandle;
+	FDelegateHandle ShotValidatedHandle;
+};
@@ -19,8 +19,9 @@ class LAGCOMPENSATION_API ULCCharacterMovementComponent : public UCharacterMovem
 public:
 	float GetCurrentSynchTime() const;
 private:
-	virtual void PerformMovement(float DeltaTime) override;
-	
+	/** Server: tells the character, which saves the position it arrived at. */
+	virtual void OnTeleported() override;
+
 	virtual void MoveAutonomous(float ClientTimeStamp, float DeltaTime, uint8 CompressedFlags, const FVector& NewAccel) override;
 public:
 	/** Time server is using for this move, from timestamp passed by client */
@@ -0,0 +1,113 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "EngineDefines.h"
+#include "Engine/NetSerialization.h"
+#include "Kismet/KismetSystemLibrary.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LCDebugDrawSubsystem.generated.h"
+
+class ALagCompensationPlayerController;
+
+/** What the server found for one hit, as drawn by the debug visualization. */
+USTRUCT()
+struct FLCRewindDebugRecord
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** Victim location on the shooting client. */
+	UPROPERTY()
+	FVector_NetQuantize ClientPosition;
+
+	/** Victim location on the server when the shot was validated. */
+	UPROPERTY()
+	FVector_NetQuantize CurrentPosition;
+
+	/** Victim location the server rewound to. */
+	UPROPERTY()
+	FVector_NetQuantize RewoundPosition;
+
+	UPROPERTY()
+	FVector_NetQuantize StartLocation;
+
+	UPROPERTY()
+	FVector_NetQuantize HitLocation;
+
+	/** Victim capsule half height, in whole centimeters. */
+	UPROPERTY()
+	uint16 HalfHeight;
+};
+
+/** Debug drawing of shot rewinds, toggled with LagComp.DebugDraw. Not created in Shipping and Test builds. */
+UCLASS(config=Game)
+class LAGCOMPENSATION_API ULCDebugDrawSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	ULCDebugDrawSubsystem();
+
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+	virtual void Deinitialize() override;
+
+	/** Whether debug drawing is compiled in and turned on. */
+	static bool IsEnabled();
+
+	/** Draw type for the shot traces, None when debug drawing is off. */
+	static EDrawDebugTrace::Type GetTraceDrawType();
+
+	/** Server: draws a rewind here and queues it for the shooter's client. */
+	void AddRewind(ALagCompensationPlayerController* Shooter, const FLCRewindDebugRecord& Record);
+
+	/** Client: draws rewinds the server sent. */
+	void AddRemoteRewinds(const TArray<FLCRewindDebugRecord>& Records);
+
+private:
+	void OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+
+	/** Sends the queued records of every shooter. */
+	void Flush();
+
+	void AddDrawn(const FLCRewindDebugRecord& Record, bool bRemote);
+
+	/** Seconds between two RPCs to a client. */
+	UPROPERTY(Config)
+	float FlushInterval;
+
+	/** Records sent to a client per RPC, older ones are dropped. */
+	UPROPERTY(Config)
+	int32 MaxRecordsPerFlush;
+
+	/** Rewinds kept on screen, the oldest one disappears when a new one comes in. */
+	UPROPERTY(Config)
+	int32 MaxDrawnRewinds;
+
+	struct FPendingRecords
+	{
+		TWeakObjectPtr<ALagCompensationPlayerController> Shooter;
+		TArray<FLCRewindDebugRecord> Records;
+	};
+
+	TArray<FPendingRecords> Pending;
+
+	struct FDrawnRewind
+	{
+		FLCRewindDebugRecord Record;
+
+		/** Drawn on the client from a server record. */
+		bool bRemote;
+	};
+
+	/** Ring of the rewinds on screen. */
+	TArray<FDrawnRewind> Drawn;
+	int32 NextDrawn;
+
+	float TimeSinceFlush;
+
+	FDelegateHandle PostActorTickHandle;
+};
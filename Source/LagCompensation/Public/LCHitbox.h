@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LCRewindMath.h"
+#include "LCHitbox.generated.h"
+
+/** Part of the body a hitbox belongs to. */
+UENUM(BlueprintType)
+enum class ELCHitZone : uint8
+{
+	Body,
+	Head,
+	Limb,
+};
+
+/** A capsule attached to a bone of the character mesh, oriented along the bone's X axis. */
+USTRUCT(BlueprintType)
+struct FLCHitboxDefinition
+{
+	GENERATED_USTRUCT_BODY()
+
+	FLCHitboxDefinition() : BoneName(NAME_None), Offset(FVector::ZeroVector), Radius(10.f), HalfHeight(20.f), Zone(ELCHitZone::Body) {}
+
+	FLCHitboxDefinition(FName InBoneName, FVector InOffset, float InRadius, float InHalfHeight, ELCHitZone InZone)
+		: BoneName(InBoneName), Offset(InOffset), Radius(InRadius), HalfHeight(InHalfHeight), Zone(InZone) {}
+
+	UPROPERTY(EditAnywhere, Category = Hitbox)
+	FName BoneName;
+
+	/** Capsule center in bone space. */
+	UPROPERTY(EditAnywhere, Category = Hitbox)
+	FVector Offset;
+
+	UPROPERTY(EditAnywhere, Category = Hitbox)
+	float Radius;
+
+	/** Half height including the hemispheres, same as UCapsuleComponent. */
+	UPROPERTY(EditAnywhere, Category = Hitbox)
+	float HalfHeight;
+
+	UPROPERTY(EditAnywhere, Category = Hitbox)
+	ELCHitZone Zone;
+};
+
+/**
+ * A hitbox as stored in the rewind history: center relative to the actor location in 1/32 cm steps
+ * (+-1024 cm range) and axis as an octahedral encoded unit vector. 10 bytes.
+ */
+struct FLCQuantizedHitbox
+{
+	int16 Center[3];
+	int16 Axis[2];
+};
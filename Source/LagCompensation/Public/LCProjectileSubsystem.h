@@ -0,0 +1,88 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LCRewindMath.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LCProjectileSubsystem.generated.h"
+
+class ALagCompensationCharacter;
+class ALagCompensationProjectile;
+
+/** Server: fast-forwards projectiles from the time a client fired them to the present against rewound characters. */
+UCLASS(config=Game)
+class LAGCOMPENSATION_API ULCProjectileSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	ULCProjectileSubsystem();
+
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+	virtual void Deinitialize() override;
+
+	/**
+	 * Spawns a projectile fired by Shooter at server time FireTime, and fast-forwards it to the present.
+	 * FireTime is clamped to MaxForwardTime in the past.
+	 */
+	ALagCompensationProjectile* SpawnProjectile(TSubclassOf<ALagCompensationProjectile> ProjectileClass, ALagCompensationCharacter* Shooter,
+		const FVector& Location, const FRotator& Rotation, float FireTime);
+
+	/** Projectiles still catching up. */
+	int32 GetNumCatchingUp() const { return CatchingUp.Num(); }
+
+private:
+	/** A projectile simulated by the subsystem until it reaches the present. */
+	struct FCatchUp
+	{
+		TWeakObjectPtr<ALagCompensationProjectile> Projectile;
+		int32 ShooterSlot;
+
+		/** Server time the projectile's location and velocity are at. */
+		float Time;
+		FVector Location;
+		FVector Velocity;
+	};
+
+	void OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+
+	/**
+	 * Moves the projectile DeltaTime further, returns false if it hit something and is done catching up.
+	 * @param QueryParams	world sweep parameters, ignoring the projectile and the live characters
+	 */
+	bool SubStep(FCatchUp& CatchUp, float DeltaTime, const FCollisionQueryParams& QueryParams);
+
+	/** Moves the projectile actor to where its catch-up has got to. */
+	void UpdateActor(const FCatchUp& CatchUp);
+
+	/** Hands the projectile over to its movement component. */
+	void FinishCatchUp(const FCatchUp& CatchUp);
+
+	/** Projectiles fired longer ago than this (in seconds) are only fast-forwarded this far. */
+	UPROPERTY(Config)
+	float MaxForwardTime;
+
+	/** Length of a fast-forward sub-step, in seconds. */
+	UPROPERTY(Config)
+	float SubStepTime;
+
+	/** Sub-steps run per tick over all projectiles. */
+	UPROPERTY(Config)
+	int32 MaxSubStepsPerTick;
+
+	/** Oldest first. */
+	TArray<FCatchUp> CatchingUp;
+
+	/** Per slot bounds of the characters over this tick's catch-up, from ULCRewindHistorySubsystem::ComputeSweptBounds. */
+	TArray<FBox> SlotBounds;
+
+	/** Scratch for SubStep: the slots whose bounds the sub-step touches, and their rewound capsules. */
+	TArray<int32> Slots;
+	FLCCapsuleBatch Capsules;
+
+	FDelegateHandle PostActorTickHandle;
+};
@@ -0,0 +1,332 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LCHitbox.h"
+#include "LCRewindMath.h"
+#include "Subsystems/WorldSubsystem.h"
+#include <atomic>
+#include "LCRewindHistorySubsystem.generated.h"
+
+class ALagCompensationCharacter;
+
+/** State of a slot taken on the game thread, for reads of the rewind history that must not touch the character. */
+struct FLCRewindSlotState
+{
+	/** Current location and capsule half height, used where the slot has no history. Zero for free slots. */
+	FVector Location;
+	float HalfHeight;
+
+	float Radius;
+
+	bool bOccupied;
+};
+
+/**
+ * Frame rows of ULCRewindHistorySubsystem, written by the game thread and read lock-free by FLCRewindHistoryReader.
+ * The frame with epoch E is in row E & FrameMask; readers retry when WriteEpoch has reached their window.
+ * Head and Count below are the oldest row and number of frames of a window.
+ */
+struct LAGCOMPENSATION_API FLCRewindHistoryFrames
+{
+	/** Per slot, per frame flags. */
+	enum EFrameFlags : uint8
+	{
+		FrameFlag_Valid = 1 << 0,
+		FrameFlag_Teleported = 1 << 1,
+	};
+
+	FLCRewindHistoryFrames();
+
+	/** Physical row of the frame FrameIndex frames after the one in row Head. */
+	int32 GetRow(int32 Head, int32 FrameIndex) const { return (Head + FrameIndex) & FrameMask; }
+
+	/** Index of the newest of Count frames starting at row Head that is older than TargetTime, or INDEX_NONE. */
+	int32 FindLastFrameBefore(int32 Head, int32 Count, float TargetTime) const;
+
+	/** Resolves the frame pair and blend factor used to rewind to TargetTime. Count must not be 0. */
+	void GetRewindFrames(int32 Head, int32 Count, float TargetTime, int32& OutRowA, int32& OutRowB, float& OutAlpha) const;
+
+	/**
+	 * Position of Slot between rows A and B, linear or along the Hermite curve of the positions and velocities.
+	 * Row A when B is not valid or was reached by teleport.
+	 */
+	FVector RewindSlotRows(int32 Slot, int32 RowA, int32 RowB, float Alpha) const;
+
+	/** Capsules of Slots rewound to TargetTime, slots without history there get their SlotStates capsule. */
+	void RewindSlots(int32 Head, int32 Count, float TargetTime, const TArray<int32>& Slots, TArrayView<const FLCRewindSlotState> SlotStates,
+		FLCCapsuleBatch& OutCapsules) const;
+
+	/** See ULCRewindHistorySubsystem::ComputeSweptBounds, one box per entry of SlotStates. */
+	void ComputeSweptBounds(int32 Head, int32 Count, float FromTime, float ToTime, TArrayView<const FLCRewindSlotState> SlotStates,
+		TArray<FBox>& OutBounds) const;
+
+	/** Game thread: starts writing the frame with Epoch at Time and returns its row. Readers of the frame it held read again. */
+	int32 BeginFrame(uint32 Epoch, float Time);
+
+	/** Game thread: writes Slot into Row of the frame being written. */
+	void WriteSlot(int32 Row, int32 Slot, const FVector& Position, const FVector& Velocity, float InYaw, float InHalfHeight, uint8 SlotFlags);
+
+	/** Game thread: makes the frame with Epoch and the Count - 1 frames before it readable. */
+	void EndFrame(uint32 Epoch, int32 Count);
+
+	/**
+	 * Game thread: clears every frame of Slot, so whoever gets it next does not interpolate from them. All epochs,
+	 * NextEpoch with them, move a whole ring ahead, so readers in the middle of it read again.
+	 */
+	void ClearSlotHistory(int32 Slot, uint32& NextEpoch, int32 Count);
+
+	/** Game thread: the row of the frame with Epoch is about to be written, readers of it have to read again. */
+	void BeginWrite(uint32 Epoch);
+
+	/** Game thread: makes the Count frames from OldestEpoch on readable. */
+	void Publish(uint32 OldestEpoch, int32 Count);
+
+	/** Server time of each frame row. */
+	TArray<float> FrameTimes;
+
+	/** Row-major [Row * SlotCapacity + Slot] position, velocity, yaw and capsule half height columns. */
+	TArray<float> PositionX;
+	TArray<float> PositionY;
+	TArray<float> PositionZ;
+	TArray<float> VelocityX;
+	TArray<float> VelocityY;
+	TArray<float> VelocityZ;
+	TArray<float> Yaw;
+	TArray<float> HalfHeight;
+	TArray<uint8> Flags;
+
+	int32 SlotCapacity;
+
+	/** Interpolate along the Hermite curve, see ULCRewindHistorySubsystem::bHermiteInterpolation. */
+	bool bHermite;
+
+	/** Frame capacity - 1, frame capacity is a power of two. */
+	int32 FrameMask;
+
+	/** Epoch of the frame written last or being written. */
+	std::atomic<uint32> WriteEpoch;
+
+	/** Oldest readable epoch in the low 32 bits, number of readable frames in the high 32 bits. */
+	std::atomic<uint64> PublishedWindow;
+
+	/** Set once the subsystem has moved on to new rows (more slots) or is gone, these are no longer written. */
+	std::atomic<bool> bRetired;
+};
+
+/** Outcome of FLCRewindHistoryReader::RewindSlot. */
+enum class ELCRewindReadResult : uint8
+{
+	Ok,
+
+	/** The slot had no character at the requested time, or there are no frames yet. */
+	NoHistory,
+
+	/** The subsystem has moved on to new rows or is gone, get a new reader. */
+	Retired,
+
+	/** The game thread kept overwriting the frames while they were read, try again. */
+	Contended,
+};
+
+/** Lock-free read access to the rewind history from any thread, see ULCRewindHistorySubsystem::GetReader(). */
+class LAGCOMPENSATION_API FLCRewindHistoryReader
+{
+public:
+	FLCRewindHistoryReader() {}
+
+	explicit FLCRewindHistoryReader(const TSharedRef<const FLCRewindHistoryFrames, ESPMode::ThreadSafe>& InFrames)
+		: Frames(InFrames)
+	{
+	}
+
+	/** Whether the rows are still the ones the game thread records into. */
+	bool IsValid() const;
+
+	/**
+	 * Rewinds Slot to TargetTime, as it was recorded at that time: a slot given to another character since
+	 * only has history from when it was registered. The outputs are only set with ELCRewindReadResult::Ok.
+	 */
+	ELCRewindReadResult RewindSlot(int32 Slot, float TargetTime, FVector& OutPosition, float& OutHalfHeight) const;
+
+	/**
+	 * Rewinds Slots to TargetTime, see ULCRewindHistorySubsystem::RewindSlots. Slots without history get their
+	 * SlotStates capsule. OutCapsules is only set with ELCRewindReadResult::Ok.
+	 */
+	ELCRewindReadResult RewindSlots(float TargetTime, const TArray<int32>& Slots, TArrayView<const FLCRewindSlotState> SlotStates,
+		FLCCapsuleBatch& OutCapsules) const;
+
+	/** See ULCRewindHistorySubsystem::ComputeSweptBounds, OutBounds is only set with ELCRewindReadResult::Ok. */
+	ELCRewindReadResult ComputeSweptBounds(float FromTime, float ToTime, TArrayView<const FLCRewindSlotState> SlotStates, TArray<FBox>& OutBounds) const;
+
+	/** Server times of the oldest and newest readable frames, false if there are none. */
+	bool GetTimeRange(float& OutOldestTime, float& OutNewestTime) const;
+
+private:
+	TSharedPtr<const FLCRewindHistoryFrames, ESPMode::ThreadSafe> Frames;
+};
+
+/**
+ * Server-side position history of every lag compensated character, one structure-of-arrays row per frame
+ * indexed by character slot, optionally with bone hitboxes (bRecordHitboxes).
+ */
+UCLASS(config=Game)
+class LAGCOMPENSATION_API ULCRewindHistorySubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	ULCRewindHistorySubsystem();
+
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+	virtual void Deinitialize() override;
+
+	/** Starts recording Character, returns the slot it was given. */
+	int32 RegisterCharacter(ALagCompensationCharacter* Character);
+
+	/** Stops recording the character in Slot and forgets its history, readers in the middle of it read again. */
+	void UnregisterCharacter(int32 Slot);
+
+	/** Marks the next recorded position of Slot as reached by teleport, so it is not interpolated into. */
+	void NotifyTeleported(int32 Slot);
+
+	/** Appends the current position of every registered character as the newest frame. */
+	void RecordFrame(float WorldTime);
+
+	/**
+	 * Rewinds every slot to TargetTime with a single sweep over the two frames around it.
+	 * OutPositions is indexed by slot; slots without a character or without history get the character's
+	 * current location (or zero).
+	 */
+	void RewindAll(float TargetTime, TArray<FVector>& OutPositions) const;
+
+	/** Rewinds a single slot to TargetTime. */
+	FVector RewindSlot(int32 Slot, float TargetTime) const;
+
+	/** Rewinds only the given slots to TargetTime, the capsules in OutCapsules match Slots. */
+	void RewindSlots(float TargetTime, const TArray<int32>& Slots, FLCCapsuleBatch& OutCapsules) const;
+
+	/**
+	 * Appends the hitboxes of Slot rewound to TargetTime to OutHitboxes, returns how many were added.
+	 * Adds nothing when hitboxes are not recorded or the slot has no history at TargetTime.
+	 */
+	int32 RewindHitboxes(int32 Slot, float TargetTime, TArray<FLCHitboxCapsule>& OutHitboxes) const;
+
+	/** Whether frames carry bone hitboxes. False if disabled or the history would not fit HitboxMemoryBudget. */
+	bool IsRecordingHitboxes() const { return bHitboxesActive; }
+
+	/**
+	 * Broad phase for shots: computes, per slot, the bounds of its capsule swept over the recorded positions
+	 * between FromTime and ToTime (including the frames just outside that window).
+	 * Free slots get an invalid box.
+	 */
+	void ComputeSweptBounds(float FromTime, float ToTime, TArray<FBox>& OutBounds) const;
+
+	/** Number of slots, including free ones. */
+	int32 GetNumSlots() const { return Characters.Num(); }
+
+	/** Character recorded in Slot, or nullptr if the slot is free. */
+	ALagCompensationCharacter* GetCharacter(int32 Slot) const { return Characters.IsValidIndex(Slot) ? Characters[Slot] : nullptr; }
+
+	/** Capsule radius of the character recorded in Slot. */
+	float GetSlotRadius(int32 Slot) const { return SlotRadius[Slot]; }
+
+	int32 GetNumFrames() const { return FrameCount; }
+
+	/** Reader of the frame rows for other threads, see FLCRewindHistoryReader. */
+	FLCRewindHistoryReader GetReader() const { return FLCRewindHistoryReader(Frames.ToSharedRef()); }
+
+	/** State of every slot for the reads of another thread, indexed by slot. Game thread only. */
+	void GetSlotStates(TArray<FLCRewindSlotState>& OutStates) const;
+
+private:
+	void OnWorldPostActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+
+	/**
+	 * Moves the per frame rows to new ones laid out for NewFrameCapacity frames (a power of two) and
+	 * NewSlotCapacity slots, readers of the old rows keep them alive until they let go. Happens when
+	 * registering more characters than there are slots, and when the ring covers less than MaxHistoryAge.
+	 */
+	void ResizeRows(int32 NewFrameCapacity, int32 NewSlotCapacity);
+
+	/** Physical row of the frame with logical index FrameIndex (0 is the oldest). */
+	int32 GetRow(int32 FrameIndex) const { return Frames->GetRow(FrameHead, FrameIndex); }
+
+	FLCRewindSlotState GetSlotState(int32 Slot) const;
+
+	/** Resolves the bones of Character's hitbox definitions for Slot. */
+	void RegisterHitboxes(int32 Slot, const ALagCompensationCharacter* Character);
+
+	/** Writes the hitboxes of Slot into Row. */
+	void RecordHitboxes(int32 Slot, int32 Row, const ALagCompensationCharacter* Character);
+
+	/** Hitbox bytes the frame ring needs at the current slot capacity. */
+	int64 GetHitboxMemorySize() const;
+
+	/** Enables or disables hitbox recording according to the budget, and (re)sizes the hitbox rows. */
+	void UpdateHitboxStorage();
+
+	/** How long positions are kept, in seconds. One frame beyond this is kept for interpolation. */
+	UPROPERTY(Config)
+	float MaxHistoryAge;
+
+	/** Expected server frame rate, used to size the frame ring. The ring grows, with a warning, if the server ticks faster. */
+	UPROPERTY(Config)
+	float ExpectedFrameRate;
+
+	/**
+	 * Interpolate between frames along the Hermite curve of the positions and velocities instead of straight
+	 * lines. Keep it the same as ALagCompensationCharacter::bHermiteSavedPositions, so shots are validated
+	 * on the path hit claims are checked against.
+	 */
+	UPROPERTY(Config)
+	bool bHermiteInterpolation;
+
+	/** Record bone hitboxes with every frame. */
+	UPROPERTY(Config)
+	bool bRecordHitboxes;
+
+	/** Hitboxes kept per character, extra definitions are ignored. */
+	UPROPERTY(Config)
+	int32 MaxHitboxesPerCharacter;
+
+	/** Upper bound for the hitbox rows, in bytes. Hitboxes are not recorded if the history would not fit. */
+	UPROPERTY(Config)
+	int32 HitboxMemoryBudget;
+
+	/** Character recorded in each slot, nullptr for free slots. */
+	UPROPERTY()
+	TArray<ALagCompensationCharacter*> Characters;
+
+	/** Slots with a teleport since their last recorded frame. */
+	TBitArray<> PendingTeleports;
+
+	/** Capsule radius of each slot. */
+	TArray<float> SlotRadius;
+
+	/** Never null, only replaced when the slots grow. */
+	TSharedPtr<FLCRewindHistoryFrames, ESPMode::ThreadSafe> Frames;
+
+	/** Per slot hitbox definitions and the mesh bone index of each (INDEX_NONE if the bone is missing). */
+	TArray<TArray<FLCHitboxDefinition>> SlotHitboxes;
+	TArray<TArray<int32>> SlotHitboxBones;
+
+	/** [(Row * SlotCapacity + Slot) * MaxHitboxesPerCharacter + Hitbox], only allocated while bHitboxesActive. */
+	TArray<FLCQuantizedHitbox> Hitboxes;
+
+	bool bHitboxesActive;
+
+	/** Physical row of the oldest frame. */
+	int32 FrameHead;
+
+	int32 FrameCount;
+
+	/** Epoch of the next recorded frame. */
+	uint32 NextEpoch;
+
+	FDelegateHandle PostActorTickHandle;
+};
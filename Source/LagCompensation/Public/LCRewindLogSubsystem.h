@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LCRewindLog.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LCRewindLogSubsystem.generated.h"
+
+class ALagCompensationCharacter;
+struct FLCPendingShot;
+struct FLCShotResult;
+
+/** Server: writes saved positions and validated shots to a rewind log for LagComp.Replay, see bRecordRewindLog. */
+UCLASS(config=Game)
+class LAGCOMPENSATION_API ULCRewindLogSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	ULCRewindLogSubsystem();
+
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+	virtual void Deinitialize() override;
+
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+
+	bool IsRecording() const { return Writer.IsValid(); }
+
+	/** Logs a position Character just saved. */
+	void RecordPosition(const ALagCompensationCharacter* Character, const FSavedPosition& Position);
+
+private:
+	void HandleShotValidated(const FLCPendingShot& Shot, const FLCShotResult& Result, ALagCompensationCharacter* HitCharacter);
+
+	/** Id of Character in the log, logging it first if it is new. MAX_uint16 for none. */
+	uint16 GetCharacterId(const ALagCompensationCharacter* Character);
+
+	UPROPERTY(Config)
+	bool bRecordRewindLog;
+
+	/** Bytes of records written to the file at once. */
+	UPROPERTY(Config)
+	int32 ChunkSize;
+
+	TUniquePtr<FLCRewindLogWriter> Writer;
+
+	TMap<TWeakObjectPtr<const ALagCompensationCharacter>, uint16> CharacterIds;
+	uint16 NextCharacterId;
+
+	FDelegateHandle ShotValidatedHandle;
+};
@@ -0,0 +1,80 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LCShotPacket.generated.h"
+
+class ALagCompensationCharacter;
+
+/**
+ * A shot as sent from the shooting client to the server. The origin is relative to the shooter's position at
+ * the shot's move and the timestamp a delta from the first shot of its batch; see IsSaturated.
+ */
+USTRUCT()
+struct LAGCOMPENSATION_API FLCShotPacket
+{
+	GENERATED_USTRUCT_BODY()
+
+	FLCShotPacket()
+		: Range(0), TimeStampDelta(0), PredictionMs(0), Victim(nullptr), ClientPosition(FVector::ZeroVector)
+	{
+		Origin[0] = Origin[1] = Origin[2] = 0;
+		Direction[0] = Direction[1] = 0;
+	}
+
+	/**
+	 * Encodes a shot.
+	 * @param ShooterPosition	shooter's location after the move with ClientTimeStamp
+	 * @param BaseTimeStamp		timestamp of the first shot of the batch
+	 */
+	static FLCShotPacket Make(const FVector& ShooterPosition, float BaseTimeStamp, float ClientTimeStamp, float PredictionAmount,
+		const FVector& StartLocation, const FVector& EndLocation, ALagCompensationCharacter* InVictim, const FVector& InClientPosition);
+
+	/** Whether a shot fired at ClientTimeStamp can go in a batch based at BaseTimeStamp, without saturating its delta. */
+	static bool FitsTimeStampDelta(float BaseTimeStamp, float ClientTimeStamp);
+
+	/**
+	 * Whether the origin or the timestamp delta hit the end of its encoding when the packet was made (or a
+	 * larger delta came in over the network). The shot can't be decoded where it was fired.
+	 */
+	bool IsSaturated() const;
+
+	FVector GetStartLocation(const FVector& ShooterPosition) const;
+	FVector GetEndLocation(const FVector& ShooterPosition) const;
+	float GetClientTimeStamp(float BaseTimeStamp) const;
+	float GetPredictionAmount() const { return PredictionMs * 0.001f; }
+
+	bool NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess);
+
+	/** Shot origin - shooter position, in 1/8 cm steps. +-MAX_int16 when saturated. */
+	int16 Origin[3];
+
+	/** FLCQuantization::EncodeUnitVector of the shot direction. */
+	int16 Direction[2];
+
+	/** Shot length in 10 cm steps. */
+	uint16 Range;
+
+	/** Client timestamp - batch base timestamp, in 0.1 ms ticks. MAX_uint16 when saturated. */
+	uint16 TimeStampDelta;
+
+	/** Client side prediction time, in milliseconds. Only used by the ClientPing rewind mode. */
+	uint16 PredictionMs;
+
+	/** Character the client hit, if any. */
+	UPROPERTY()
+	ALagCompensationCharacter* Victim;
+
+	/** Victim location on the shooting client, in whole centimeters. Only sent with a victim. */
+	FVector ClientPosition;
+};
+
+template<>
+struct TStructOpsTypeTraits<FLCShotPacket> : public TStructOpsTypeTraitsBase2<FLCShotPacket>
+{
+	enum
+	{
+		WithNetSerializer = true,
+	};
+};
@@ -0,0 +1,260 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LCHitbox.h"
+#include "LCRewindHistorySubsystem.h"
+#include "LCRewindMath.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LCShotValidationSubsystem.generated.h"
+
+class ALagCompensationCharacter;
+
+/**
+ * How the server picks the time a shot is validated at. The timestamp based modes also go back by the
+ * interpolation delay the shooter's client renders other characters with.
+ */
+UENUM()
+enum class ELCRewindTimeMode : uint8
+{
+	/** Server time when the shot arrives minus the prediction time the client computed from its ping. */
+	ClientPing,
+
+	/**
+	 * The shot carries the timestamp of the shooter's last move. The server maps it to the server time that
+	 * move was performed at through the shooter's own move history, and subtracts the round trip time it
+	 * measured on the shooter's connection. Shots whose move is not in the history are rejected.
+	 */
+	MoveTimeStamp,
+
+	/**
+	 * The shot's move timestamp converted to server time with the clock offset estimated from the shooter's
+	 * recent moves, minus the estimated delay of the server's updates to the shooter. Adapts to jitter.
+	 * Falls back to MoveTimeStamp until enough moves were seen.
+	 */
+	Adaptive,
+};
+
+/** A shot reported by a client, waiting for server validation. */
+struct FLCPendingShot
+{
+	TWeakObjectPtr<ALagCompensationCharacter> Shooter;
+
+	/** Character the client says it hit, if any. */
+	TWeakObjectPtr<ALagCompensationCharacter> Victim;
+
+	/** Shooter's slot in the rewind history, the shot never hits it. */
+	int32 ShooterSlot;
+
+	FVector StartLocation;
+	FVector EndLocation;
+
+	/** Victim location on the shooter's client when the shot was fired. */
+	FVector ClientPosition;
+
+	/** Server time the shot arrived at. */
+	float ServerTime;
+
+	/** What the client sent to pick the rewind time with, see ELCRewindTimeMode. */
+	float ClientTimeStamp;
+	float PredictionAmount;
+
+	/** Server time the world is rewound to for this shot. */
+	float RewindTime;
+
+	/** RewindTime quantized to the validation bucket size. */
+	int32 RewindBucket;
+
+	/** Index of the bucket the shot is validated in. */
+	int32 BucketIndex;
+
+	/** FPlatformTime::Seconds() when the shot was queued. */
+	double QueuedTime;
+};
+
+/** What the server found for a shot. */
+struct FLCShotResult
+{
+	FLCShotResult() : HitSlot(INDEX_NONE), RewoundPosition(FVector::ZeroVector), RewoundHalfHeight(0.f), HitTime(1.f), HitZone(ELCHitZone::Body)
+		, BlockTime(1.f), bTracedWorld(false), ClaimError(0.f), ClaimTimeOffset(0.f), bImplausibleClaim(false) {}
+
+	/** Rewind history slot of the character hit, INDEX_NONE on a miss. */
+	int32 HitSlot;
+
+	/** Rewound capsule of the character hit. */
+	FVector RewoundPosition;
+	float RewoundHalfHeight;
+
+	/** Fraction of the shot segment at the point of contact. */
+	float HitTime;
+
+	/** Body part hit, Body when the character has no recorded hitboxes. */
+	ELCHitZone HitZone;
+
+	/**
+	 * Fraction of the shot segment where world geometry blocks it, 1 if nothing does. The world is only traced
+	 * for shots that hit a character, bTracedWorld tells whether it was.
+	 */
+	float BlockTime;
+	bool bTracedWorld;
+
+	/**
+	 * For a shot the client says hit someone: distance in cm from the victim location the client reported to
+	 * the nearest point of the victim's recorded path around the rewind time, and when the victim was there
+	 * relative to the rewind time. Zero for other shots.
+	 */
+	float ClaimError;
+	float ClaimTimeOffset;
+
+	/** The victim was never near where the client says it saw it, see ULCShotValidationSubsystem::MaxClaimError. */
+	bool bImplausibleClaim;
+};
+
+/** Shots sharing a rewind time and the rewound world state they are tested against. */
+struct FLCRewindBucket
+{
+	float Time;
+
+	/** The bucket's shots are QueuedShots[FirstShot, FirstShot + NumShots). */
+	int32 FirstShot;
+	int32 NumShots;
+
+	/** Rewind history slots that were rewound, and the index of each slot in Slots (or INDEX_NONE). */
+	TArray<int32> Slots;
+	TArray<int32> SlotToIndex;
+
+	/** Rewound capsules matching Slots. */
+	FLCCapsuleBatch Capsules;
+
+	/**
+	 * Rewound hitboxes, those of Slots[i] are [HitboxStart[i], HitboxStart[i + 1]), as FLCRewindMath::SegmentCharacterIntersection
+	 * takes them. Empty if hitboxes are not recorded.
+	 */
+	TArray<FLCHitboxCapsule> Hitboxes;
+	TArray<int32> HitboxStart;
+
+	/** Scratch for the broad phase, per bucket so buckets can be built at the same time. */
+	TArray<FBox> SweptBounds;
+};
+
+/** Outcome of a validated shot, HitCharacter is null on a miss. */
+DECLARE_MULTICAST_DELEGATE_ThreeParams(FLCShotValidatedDelegate, const FLCPendingShot& /*Shot*/, const FLCShotResult& /*Result*/, ALagCompensationCharacter* /*HitCharacter*/);
+
+/**
+ * Validates client shots on the server once per tick, against the characters rewound to each shot's rewind time.
+ * Shots sharing a rewind time share one rewound state, built and tested on task graph workers.
+ */
+UCLASS(config=Game)
+class LAGCOMPENSATION_API ULCShotValidationSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	ULCShotValidationSubsystem();
+
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+	virtual void Deinitialize() override;
+
+	/** Queues a shot, it is validated at the start of the next tick. */
+	void QueueShot(const FLCPendingShot& Shot);
+
+	/** Validates every queued shot and reports the results. */
+	void ProcessQueuedShots();
+
+	ELCRewindTimeMode GetRewindTimeMode() const { return RewindTimeMode; }
+
+	/** Overrides the configured rewind time mode for the rest of the world's life. */
+	void SetRewindTimeMode(ELCRewindTimeMode InRewindTimeMode) { RewindTimeMode = InRewindTimeMode; }
+
+	/** Fraction of the validated shots where the server hit the character the client said it hit, or both missed. */
+	float GetHitAgreementRate() const;
+
+	/** Average distance between the client side and the rewound position of a victim both sides hit, in cm. */
+	float GetAverageRewindError() const;
+
+	/** Hit claims whose reported victim location was off the victim's recorded path, since the world started. */
+	int64 GetTotalImplausibleClaims() const { return TotalImplausibleClaims; }
+
+	/** Rewound world state a shot was validated against, see FLCPendingShot::BucketIndex. Valid while OnShotValidated is broadcast. */
+	const FLCRewindBucket& GetBucket(int32 BucketIndex) const { return Buckets[BucketIndex]; }
+
+	/** Logs the shot totals of this world. */
+	void DumpStats() const;
+
+	int64 GetTotalShotsValidated() const { return TotalShotsValidated; }
+
+	/** Wall clock seconds spent validating shots since the world started. */
+	double GetTotalProcessingTime() const { return TotalProcessingTime; }
+
+	/** Broadcast for every validated shot, after the shooter was told. */
+	FLCShotValidatedDelegate OnShotValidated;
+
+private:
+	void OnWorldPreActorTick(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+
+	/**
+	 * Builds the rewound world state for the shots of Bucket, which share a rewind bucket. Reads the frames
+	 * through Reader and the slots through SlotStates, safe to run on any thread. Hitboxes are read from
+	 * RewindHistory, which the game thread does not write while it waits for the workers.
+	 */
+	void BuildBucket(const ULCRewindHistorySubsystem& RewindHistory, const FLCRewindHistoryReader& Reader, FLCRewindBucket& Bucket);
+
+	/** Tests one shot against its bucket. Only reads the bucket, safe to run on any thread. */
+	void ValidateShot(int32 ShotIndex);
+
+	/** Checks world geometry for the shots that hit a capsule and hands every result to its shooter. */
+	void ApplyResults(const ULCRewindHistorySubsystem& RewindHistory);
+
+	/** Compares the victim location the client reported with the victim's saved positions, fills the Claim fields of Result. */
+	void CheckClaim(const FLCPendingShot& Shot, const ALagCompensationCharacter& Victim, FLCShotResult& Result) const;
+
+	UPROPERTY(Config)
+	ELCRewindTimeMode RewindTimeMode;
+
+	/** Shots whose rewind times are less than this apart (in seconds) are validated against the same rewound positions. */
+	UPROPERTY(Config)
+	float RewindTimeBucketSize;
+
+	/** Fewer queued shots than this are validated (and their buckets built) on the game thread, the task dispatch isn't worth it. */
+	UPROPERTY(Config)
+	int32 MinShotsForParallelValidation;
+
+	/** A reported victim location is looked for in the victim's path this many seconds around the rewind time. */
+	UPROPERTY(Config)
+	float ClaimTimeWindow;
+
+	/** A hit claim whose reported victim location is farther than this (in cm) from the victim's path is implausible. */
+	UPROPERTY(Config)
+	float MaxClaimError;
+
+	TArray<FLCPendingShot> QueuedShots;
+
+	/** State of every rewind history slot, taken before the buckets are built. */
+	TArray<FLCRewindSlotState> SlotStates;
+
+	/** Results matching QueuedShots. */
+	TArray<FLCShotResult> Results;
+
+	/** Buckets of this tick, entries past NumBuckets are kept around to reuse their allocations. */
+	TArray<FLCRewindBucket> Buckets;
+	int32 NumBuckets;
+
+	/** Shots validated since the world started, and how many of them the server and the client agreed on. */
+	int64 TotalShotsValidated;
+	int64 TotalShotsAgreed;
+
+	/** Rewind errors of the shots both sides hit the same character with. */
+	double TotalRewindError;
+	int64 TotalRewindErrorShots;
+	float MaxRewindError;
+
+	int64 TotalImplausibleClaims;
+
+	double TotalProcessingTime;
+
+	FDelegateHandle PreActorTickHandle;
+};
@@ -4,12 +4,14 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/PlayerController.h"
+#include "LCDebugDrawSubsystem.h"
+#include "LCNetTimingEstimator.h"
 #include "LagCompensationPlayerController.generated.h"
 
 /**
  * 
  */
-UCLASS()
+UCLASS(config=Game)
 class LAGCOMPENSATION_API ALagCompensationPlayerController : public APlayerController
 {
 	GENERATED_BODY()
@@ -24,6 +26,29 @@ public:
 	/** Return amount of time to tick or simulate to make up for network lag */
 	virtual float GetPredictionTime();
 
+	/** Server: round trip time measured on this player's connection, in seconds, clamped to MaxPing. */
+	float GetServerRoundTripTime() const;
+
+	/** Server: feeds the timing estimator with a move of this player's pawn. */
+	void OnClientMovePerformed(float ClientTimeStamp);
+
+	/** Server: whether the timing estimator has seen enough moves to be used. */
+	bool HasTimingEstimate() const { return TimingEstimator.GetNumSamples() >= MinTimingSamples; }
+
+	/**
+	 * Server: time the world the client saw at ClientTimeStamp was simulated at on the server, that is
+	 * the client time converted to server time minus the estimated delay of the server's updates to the client.
+	 */
+	float GetAdaptiveRewindTime(float ClientTimeStamp) const;
+
+	const FLCNetTimingEstimator& GetTimingEstimator() const { return TimingEstimator; }
+
+	/** Server: how far behind the replicated state this client renders other characters, in seconds. */
+	float GetInterpolationDelay() const { return InterpolationDelay; }
+
+	/** Client: delay the network smoothing of simulated proxies adds to what this client renders, in seconds. */
+	float ComputeInterpolationDelay() const;
+
 	UPROPERTY(BlueprintReadOnly, Category=Network, Replicated)
 	float MaxPing;
 
@@ -32,6 +57,32 @@ public:
 	UPROPERTY(EditAnywhere, Replicated, Category=Network)
 	float PredictionFudgeFactor;
 
+	/** Percentile of the one-way delay distribution the adaptive rewind time assumes (0 to 1). */
+	UPROPERTY(Config)
+	float RewindDelayPercentile;
+
+	/** Moves needed before the timing estimator is trusted. */
+	UPROPERTY(Config)
+	int32 MinTimingSamples;
+
+	/** Largest interpolation delay the server accepts from a client, in seconds. */
+	UPROPERTY(Config)
+	float MaxInterpolationDelay;
+
+	UFUNCTION(Server, Reliable)
+	void ServerSetInterpolationDelay(float NewInterpolationDelay);
+
 	UFUNCTION(Client, Unreliable)
 		void ClientDebugRewind(FVector_NetQuantize TargetLocation, FVector_NetQuantize RewindLocation, FVector_NetQuantize PrePosition, FVector_NetQuantize PostPosition, float TargetCapsuleHeight, float PredictionTime, float Percent, bool bTeleported);
+
+	/** Rewinds of this player's shots found by the server since the last batch, see ULCDebugDrawSubsystem. */
+	UFUNCTION(Client, Unreliable)
+	void ClientDrawDebugRewinds(const TArray<FLCRewindDebugRecord>& Records);
+
+private:
+	/** Server: clock offset and delay of this player's connection. */
+	FLCNetTimingEstimator TimingEstimator;
+
+	/** Server: interpolation delay reported by the client. Client: the value last reported. */
+	float InterpolationDelay;
 };
@@ -0,0 +1,14 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+using UnrealBuildTool;
+
+public class LagCompensationCore : ModuleRules
+{
+	public LagCompensationCore(ReadOnlyTargetRules Target) : base(Target)
+	{
+		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
+
+		// no Engine: the rewind history, its math and the network timing only need Core
+		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject" });
+	}
+}
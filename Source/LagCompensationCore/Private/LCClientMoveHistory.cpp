@@ -0,0 +1,74 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCClientMoveHistory.h"
+
+void FLCClientMoveHistory::Reserve(int32 MinCapacity)
+{
+	const int32 NewCapacity = (int32)FMath::RoundUpToPowerOfTwo((uint32)FMath::Max(MinCapacity, 2));
+	Moves.SetNumUninitialized(NewCapacity);
+	IndexMask = NewCapacity - 1;
+	Reset();
+}
+
+void FLCClientMoveHistory::Reset()
+{
+	Head = 0;
+	Count = 0;
+}
+
+void FLCClientMoveHistory::Add(float TimeStamp, float Time, const FVector& Location)
+{
+	if (Moves.Num() == 0 || (Count > 0 && GetMove(Count - 1).TimeStamp == TimeStamp))
+	{
+		return;
+	}
+
+	if (Count == Moves.Num())
+	{
+		Head = (Head + 1) & IndexMask;
+		Count--;
+	}
+	FMove& Move = Moves[(Head + Count) & IndexMask];
+	Move.TimeStamp = TimeStamp;
+	Move.Time = Time;
+	Move.Location = Location;
+	Count++;
+}
+
+bool FLCClientMoveHistory::Find(float TimeStamp, float& OutTime, FVector& OutLocation) const
+{
+	// shots are recent, walk back from the newest move
+	for (int32 Index = Count - 1; Index >= 0; Index--)
+	{
+		const FMove& Move = GetMove(Index);
+		if (Move.TimeStamp == TimeStamp)
+		{
+			OutTime = Move.Time;
+			OutLocation = Move.Location;
+			return true;
+		}
+
+		if (Move.TimeStamp < TimeStamp)
+		{
+			if (Index == Count - 1)
+			{
+				return false;
+			}
+
+			// combined into the next move the client sent, the server performed both in one go
+			const FMove& Next = GetMove(Index + 1);
+			const float Alpha = (TimeStamp - Move.TimeStamp) / (Next.TimeStamp - Move.TimeStamp);
+			OutTime = FMath::Lerp(Move.Time, Next.Time, Alpha);
+			OutLocation = FMath::Lerp(Move.Location, Next.Location, Alpha);
+			return true;
+		}
+
+		// the moves before this one are from before the client reset its timestamps
+		if (Index > 0 && GetMove(Index - 1).TimeStamp > Move.TimeStamp)
+		{
+			return false;
+		}
+	}
+	return false;
+}
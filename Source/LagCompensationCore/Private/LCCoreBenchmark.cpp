@@ -0,0 +1,345 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CoreMinimal.h"
+#include "HAL/IConsoleManager.h"
+#include "LagCompensationCore.h"
+#include "LCRewindMath.h"
+#include "LCSavedPositionHistory.h"
+
+namespace LCCoreBenchmark
+{
+	/** One second of history at 60 samples per second, like a character's saved positions. */
+	constexpr int32 HistoryLength = 60;
+	constexpr float MoveInterval = 1.f / 60.f;
+
+	/** Runs Body Iterations times and returns the nanoseconds per Operations it did each time. */
+	template<typename FunctionType>
+	static double Measure(int32 Iterations, int32 Operations, FunctionType Body)
+	{
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Iteration = 0; Iteration < Iterations; Iteration++)
+		{
+			Body();
+		}
+		return (FPlatformTime::Seconds() - StartTime) * 1e9 / ((double)Iterations * Operations);
+	}
+
+	static void FillHistory(FLCSavedPositionHistory& History, FRandomStream& Random)
+	{
+		FVector Position = Random.GetUnitVector() * 5000.f;
+		for (int32 Move = 0; Move < HistoryLength; Move++)
+		{
+			Position += Random.GetUnitVector() * 5.f;
+			History.Add(FSavedPosition(Position, FRotator::ZeroRotator, false, Move * MoveInterval, Move * MoveInterval));
+		}
+	}
+
+	/** Index of the newest entry older than TargetTime by walking back from the newest entry, as the lookup did before FindLastBefore. */
+	static int32 FindLastBeforeLinear(const FLCSavedPositionHistory& History, float TargetTime)
+	{
+		for (int32 Index = History.Num() - 1; Index >= 0; Index--)
+		{
+			if (History.GetTime(Index) < TargetTime)
+			{
+				return Index;
+			}
+		}
+		return INDEX_NONE;
+	}
+
+	/**
+	 * Bracket lookup costs in histories of 1 s and 5 s at 120 samples per second, in nanoseconds per lookup:
+	 * - linear: walking back from the newest entry
+	 * - binary: FindLastBefore
+	 * - hinted: FindLastBefore with the hint of the previous lookup, four shots in a row at each time
+	 * Times are up to 250 ms back, as for shots, and anywhere in the history.
+	 */
+	static void CompareLookups(int32 Iterations, float& Sink)
+	{
+		constexpr float SampleInterval = 1.f / 120.f;
+		constexpr int32 NumLookups = 256;
+		constexpr int32 ShotsPerTime = 4;
+
+		UE_LOG(LogLagCompensationCore, Display, TEXT("history | rewind | linear | binary | hinted (ns)"));
+		const int32 Depths[] = { 120, 600 };
+		for (const int32 Depth : Depths)
+		{
+			FLCSavedPositionHistory History;
+			History.Reserve(Depth);
+			for (int32 Sample = 0; Sample < Depth; Sample++)
+			{
+				History.Add(FSavedPosition(FVector(Sample, 0.f, 0.f), FRotator::ZeroRotator, false, Sample * SampleInterval, Sample * SampleInterval));
+			}
+
+			const float NewestTime = (Depth - 1) * SampleInterval;
+			const float MaxRewinds[] = { 0.25f, NewestTime };
+			for (const float MaxRewind : MaxRewinds)
+			{
+				FRandomStream Random(Depth);
+				TArray<float> LookupTimes;
+				for (int32 Lookup = 0; Lookup < NumLookups; Lookup++)
+				{
+					LookupTimes.Add(NewestTime - Random.FRandRange(0.f, MaxRewind));
+				}
+
+				const double Linear = Measure(Iterations, NumLookups, [&]()
+				{
+					for (const float Time : LookupTimes)
+					{
+						Sink += FindLastBeforeLinear(History, Time);
+					}
+				});
+				const double Binary = Measure(Iterations, NumLookups, [&]()
+				{
+					for (const float Time : LookupTimes)
+					{
+						Sink += History.FindLastBefore(Time);
+					}
+				});
+				const double Hinted = Measure(Iterations, NumLookups * ShotsPerTime, [&]()
+				{
+					int32 Hint = INDEX_NONE;
+					for (const float Time : LookupTimes)
+					{
+						for (int32 Shot = 0; Shot < ShotsPerTime; Shot++)
+						{
+							Sink += History.FindLastBefore(Time, &Hint);
+						}
+					}
+				});
+
+				UE_LOG(LogLagCompensationCore, Display, TEXT("%5.0f s | %4.2f s | %6.1f | %6.1f | %6.1f"), Depth * SampleInterval, MaxRewind, Linear, Binary, Hinted);
+			}
+		}
+	}
+
+	/**
+	 * Records ten seconds of running, straight stretches with a turn every 1.5 s and a teleport halfway, with and
+	 * without decimation, and logs how many positions were kept and the largest difference between the two
+	 * histories' interpolated positions, which should not exceed Tolerance.
+	 */
+	static void CheckDecimation(float Tolerance)
+	{
+		constexpr int32 NumSamples = 600;
+		FLCSavedPositionHistory Full, Decimated;
+		Full.Reserve(NumSamples);
+		Decimated.Reserve(NumSamples);
+		Decimated.SetDecimationTolerance(Tolerance);
+
+		FRandomStream Random(4321);
+		FVector Position = FVector::ZeroVector;
+		FVector Velocity(600.f, 0.f, 0.f);
+		for (int32 Sample = 0; Sample < NumSamples; Sample++)
+		{
+			if (Sample % 90 == 0)
+			{
+				Velocity = Velocity.RotateAngleAxis(Random.FRandRange(-120.f, 120.f), FVector::UpVector);
+			}
+
+			const bool bTeleported = Sample == NumSamples / 2;
+			Position += bTeleported ? FVector(2000.f, 0.f, 0.f) : Velocity * MoveInterval;
+			const FSavedPosition Saved(Position, FRotator::ZeroRotator, bTeleported, Sample * MoveInterval, Sample * MoveInterval);
+			Full.Add(Saved);
+			Decimated.Add(Saved);
+		}
+
+		float MaxError = 0.f;
+		for (float Time = 0.f; Time < NumSamples * MoveInterval; Time += MoveInterval * 0.25f)
+		{
+			MaxError = FMath::Max(MaxError, FVector::Dist(Full.GetPositionAtTime(Time), Decimated.GetPositionAtTime(Time)));
+		}
+
+		UE_LOG(LogLagCompensationCore, Display, TEXT("decimation at %.1f cm: kept %d of %d positions, max error %.3f cm"), Tolerance, Decimated.Num(), Full.Num(), MaxError);
+		if (MaxError > Tolerance + KINDA_SMALL_NUMBER)
+		{
+			UE_LOG(LogLagCompensationCore, Warning, TEXT("decimation error %.3f cm is over the %.1f cm tolerance"), MaxError, Tolerance);
+		}
+	}
+
+	/**
+	 * Simulates ten seconds of a character running at 600 cm/s, turning at 180 degrees per second for half a
+	 * second and jumping every 1.5 s, in 1 ms steps. Records it at 20, 30 and 60 samples per second with linear
+	 * and Hermite interpolation, and logs the largest and average distance between each history and the path.
+	 */
+	static void CheckInterpolation()
+	{
+		constexpr float StepTime = 0.001f;
+		constexpr int32 NumSteps = 10000;
+		constexpr float Gravity = -980.f;
+
+		TArray<FSavedPosition> Path;
+		Path.Reserve(NumSteps);
+		FVector Position = FVector::ZeroVector;
+		FVector Velocity(600.f, 0.f, 0.f);
+		for (int32 Step = 0; Step < NumSteps; Step++)
+		{
+			const float Time = Step * StepTime;
+			Path.Add(FSavedPosition(Position, FRotator::ZeroRotator, false, Time, Time, Velocity));
+
+			const float Phase = FMath::Fmod(Time, 1.5f);
+			if (Phase < 0.5f)
+			{
+				Velocity = Velocity.RotateAngleAxis(180.f * StepTime, FVector::UpVector);
+			}
+			if (Step > 0 && Phase < StepTime && Position.Z <= 0.f)
+			{
+				Velocity.Z = 420.f;
+			}
+			Velocity.Z = Position.Z > 0.f || Velocity.Z > 0.f ? Velocity.Z + Gravity * StepTime : 0.f;
+			Position += Velocity * StepTime;
+			if (Position.Z < 0.f)
+			{
+				Position.Z = 0.f;
+				Velocity.Z = 0.f;
+			}
+		}
+
+		UE_LOG(LogLagCompensationCore, Display, TEXT("samples/s | linear max | linear average | hermite max | hermite average (cm)"));
+		const int32 SampleRates[] = { 20, 30, 60 };
+		for (const int32 SampleRate : SampleRates)
+		{
+			FLCSavedPositionHistory Linear, Hermite;
+			Linear.Reserve(NumSteps);
+			Hermite.Reserve(NumSteps);
+			Hermite.SetHermiteInterpolation(true);
+
+			const int32 StepsPerSample = 1000 / SampleRate;
+			for (int32 Step = 0; Step < NumSteps; Step += StepsPerSample)
+			{
+				Linear.Add(Path[Step]);
+				Hermite.Add(Path[Step]);
+			}
+
+			float LinearMax = 0.f, HermiteMax = 0.f;
+			double LinearSum = 0.0, HermiteSum = 0.0;
+			const int32 LastStep = (NumSteps - 1) / StepsPerSample * StepsPerSample;
+			for (int32 Step = 0; Step <= LastStep; Step++)
+			{
+				const float LinearError = FVector::Dist(Linear.GetPositionAtTime(Path[Step].Time), Path[Step].Position);
+				const float HermiteError = FVector::Dist(Hermite.GetPositionAtTime(Path[Step].Time), Path[Step].Position);
+				LinearMax = FMath::Max(LinearMax, LinearError);
+				HermiteMax = FMath::Max(HermiteMax, HermiteError);
+				LinearSum += LinearError;
+				HermiteSum += HermiteError;
+			}
+			UE_LOG(LogLagCompensationCore, Display, TEXT("%9d | %10.2f | %14.3f | %11.2f | %15.3f"),
+				SampleRate, LinearMax, LinearSum / (LastStep + 1), HermiteMax, HermiteSum / (LastStep + 1));
+		}
+	}
+
+	/**
+	 * Insertion, lookup and hit testing costs for 1, 16, 64 and 256 players, in nanoseconds per operation:
+	 * - insert: adding one saved position, full and compact encoding
+	 * - lookup: interpolating one history at a random time, full and compact
+	 * - closest: finding the time one history came closest to a point near its path, as for a hit claim
+	 * - hit test: one shot against the capsules of every player
+	 * Then compares bracket lookups with the linear scan they replaced, see CompareLookups, and checks the error
+	 * of decimated histories and of interpolation at lower sample rates, see CheckDecimation and CheckInterpolation.
+	 */
+	static void Run(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 20;
+		const int32 PlayerCounts[] = { 1, 16, 64, 256 };
+		constexpr int32 NumLookups = 256;
+		constexpr int32 NumShots = 256;
+
+		// keeps the results alive so nothing is optimized away
+		float Sink = 0.f;
+
+		UE_LOG(LogLagCompensationCore, Display, TEXT("players | insert full | insert compact | lookup full | lookup compact | closest | hit test (ns)"));
+		for (const int32 NumPlayers : PlayerCounts)
+		{
+			FRandomStream Random(1234);
+
+			TArray<FLCSavedPositionHistory> Full, Compact;
+			Full.SetNum(NumPlayers);
+			Compact.SetNum(NumPlayers);
+			for (int32 Player = 0; Player < NumPlayers; Player++)
+			{
+				Full[Player].Reserve(HistoryLength);
+				Compact[Player].Reserve(HistoryLength, true);
+			}
+
+			auto Insert = [&Random](TArray<FLCSavedPositionHistory>& Histories)
+			{
+				for (FLCSavedPositionHistory& History : Histories)
+				{
+					History.Reset();
+					FillHistory(History, Random);
+				}
+			};
+			const double InsertFull = Measure(Iterations, NumPlayers * HistoryLength, [&]() { Insert(Full); });
+			const double InsertCompact = Measure(Iterations, NumPlayers * HistoryLength, [&]() { Insert(Compact); });
+
+			TArray<float> LookupTimes;
+			for (int32 Lookup = 0; Lookup < NumLookups; Lookup++)
+			{
+				LookupTimes.Add(Random.FRandRange(0.f, HistoryLength * MoveInterval));
+			}
+			auto Lookup = [&LookupTimes, &Sink](const TArray<FLCSavedPositionHistory>& Histories)
+			{
+				for (const FLCSavedPositionHistory& History : Histories)
+				{
+					for (const float Time : LookupTimes)
+					{
+						Sink += History.GetPositionAtTime(Time).X;
+					}
+				}
+			};
+			const double LookupFull = Measure(Iterations, NumPlayers * NumLookups, [&]() { Lookup(Full); });
+			const double LookupCompact = Measure(Iterations, NumPlayers * NumLookups, [&]() { Lookup(Compact); });
+
+			// points a little off the path, a quarter second window around their time like a hit claim check
+			TArray<FVector> ClaimPositions;
+			for (int32 Lookup = 0; Lookup < NumLookups; Lookup++)
+			{
+				const FLCSavedPositionHistory& History = Full[Lookup % NumPlayers];
+				ClaimPositions.Add(History.GetPositionAtTime(LookupTimes[Lookup]) + Random.GetUnitVector() * 20.f);
+			}
+			const double Closest = Measure(Iterations, NumLookups, [&]()
+			{
+				for (int32 Lookup = 0; Lookup < NumLookups; Lookup++)
+				{
+					FLCClosestSavedPosition Result;
+					Full[Lookup % NumPlayers].FindClosestTime(ClaimPositions[Lookup], Result, LookupTimes[Lookup] - 0.25f, LookupTimes[Lookup] + 0.25f);
+					Sink += Result.Time;
+				}
+			});
+
+			FLCCapsuleBatch Capsules;
+			Capsules.SetNum(NumPlayers);
+			for (int32 Player = 0; Player < NumPlayers; Player++)
+			{
+				Capsules.Set(Player, Full[Player].GetPosition(HistoryLength / 2), 34.f, 88.f);
+			}
+			TArray<FVector> ShotStarts, ShotEnds;
+			for (int32 Shot = 0; Shot < NumShots; Shot++)
+			{
+				ShotStarts.Add(Random.GetUnitVector() * 5000.f);
+				ShotEnds.Add(Capsules.GetCenter(Random.RandHelper(NumPlayers)) + Random.GetUnitVector() * 50.f);
+			}
+			const double HitTest = Measure(Iterations, NumShots, [&]()
+			{
+				for (int32 Shot = 0; Shot < NumShots; Shot++)
+				{
+					float HitTime;
+					Sink += FLCRewindMath::SegmentCapsuleBatchIntersection(ShotStarts[Shot], ShotEnds[Shot], Capsules, INDEX_NONE, HitTime);
+				}
+			});
+
+			UE_LOG(LogLagCompensationCore, Display, TEXT("%7d | %11.1f | %14.1f | %11.1f | %14.1f | %7.1f | %8.1f"),
+				NumPlayers, InsertFull, InsertCompact, LookupFull, LookupCompact, Closest, HitTest);
+		}
+		CompareLookups(Iterations, Sink);
+		UE_LOG(LogLagCompensationCore, Verbose, TEXT("checksum %f"), Sink);
+
+		CheckDecimation(1.f);
+		CheckInterpolation();
+	}
+
+	static FAutoConsoleCommand RunCommand(
+		TEXT("LagComp.CoreBenchmark"),
+		TEXT("Logs saved position insertion, lookup and hit test costs for 1 to 256 players, linear and binary lookups, and the error of decimated and interpolated histories. Optional argument: iterations."),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&Run));
+}
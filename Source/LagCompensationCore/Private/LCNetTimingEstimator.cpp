@@ -0,0 +1,81 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCNetTimingEstimator.h"
+
+FLCNetTimingEstimator::FLCNetTimingEstimator(int32 InWindowSize)
+	: NextSample(0)
+	, NumSamples(0)
+	, LastClientTimeStamp(0.f)
+	, RoundTripTime(0.f)
+	, bSortedDirty(false)
+{
+	Offsets.SetNumZeroed(FMath::Max(InWindowSize, 1));
+	SortedOffsets.Reserve(Offsets.Num());
+}
+
+void FLCNetTimingEstimator::Reset()
+{
+	NextSample = 0;
+	NumSamples = 0;
+	LastClientTimeStamp = 0.f;
+	SortedOffsets.Reset();
+	bSortedDirty = false;
+}
+
+void FLCNetTimingEstimator::AddSample(float ClientTimeStamp, float ServerTime)
+{
+	if (ClientTimeStamp < LastClientTimeStamp)
+	{
+		// offsets measured against the old client clock mean nothing now
+		Reset();
+	}
+	LastClientTimeStamp = ClientTimeStamp;
+
+	Offsets[NextSample] = ServerTime - ClientTimeStamp;
+	NextSample = (NextSample + 1) % Offsets.Num();
+	NumSamples = FMath::Min(NumSamples + 1, Offsets.Num());
+	bSortedDirty = true;
+}
+
+void FLCNetTimingEstimator::UpdateSorted() const
+{
+	if (!bSortedDirty)
+	{
+		return;
+	}
+
+	SortedOffsets.Reset();
+	SortedOffsets.Append(Offsets.GetData(), NumSamples);
+	SortedOffsets.Sort();
+	bSortedDirty = false;
+}
+
+float FLCNetTimingEstimator::GetClockOffset() const
+{
+	UpdateSorted();
+	if (SortedOffsets.Num() == 0)
+	{
+		return 0.f;
+	}
+
+	// the fastest move of the window only took the base one-way delay
+	return SortedOffsets[0] - 0.5f * RoundTripTime;
+}
+
+float FLCNetTimingEstimator::GetJitter(float Percentile) const
+{
+	UpdateSorted();
+	if (SortedOffsets.Num() == 0)
+	{
+		return 0.f;
+	}
+
+	const int32 Index = FMath::Clamp(FMath::RoundToInt(Percentile * (SortedOffsets.Num() - 1)), 0, SortedOffsets.Num() - 1);
+	return SortedOffsets[Index] - SortedOffsets[0];
+}
+
+float FLCNetTimingEstimator::GetOneWayDelay(float Percentile) const
+{
+	return 0.5f * RoundTripTime + GetJitter(Percentile);
+}
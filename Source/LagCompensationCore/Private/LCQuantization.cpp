@@ -0,0 +1,37 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCQuantization.h"
+
+void FLCQuantization::EncodeUnitVector(const FVector& Vector, int16& OutX, int16& OutY)
+{
+	// project onto the octahedron |x| + |y| + |z| = 1, then fold the lower half over the upper one
+	const float L1Norm = FMath::Abs(Vector.X) + FMath::Abs(Vector.Y) + FMath::Abs(Vector.Z);
+	float X = L1Norm > SMALL_NUMBER ? Vector.X / L1Norm : 0.f;
+	float Y = L1Norm > SMALL_NUMBER ? Vector.Y / L1Norm : 0.f;
+	if (Vector.Z < 0.f)
+	{
+		const float FoldedX = (1.f - FMath::Abs(Y)) * (X >= 0.f ? 1.f : -1.f);
+		const float FoldedY = (1.f - FMath::Abs(X)) * (Y >= 0.f ? 1.f : -1.f);
+		X = FoldedX;
+		Y = FoldedY;
+	}
+
+	OutX = ToFixed16(X, 32767.f);
+	OutY = ToFixed16(Y, 32767.f);
+}
+
+FVector FLCQuantization::DecodeUnitVector(int16 InX, int16 InY)
+{
+	const float X = InX / 32767.f;
+	const float Y = InY / 32767.f;
+	const float Z = 1.f - FMath::Abs(X) - FMath::Abs(Y);
+
+	FVector Result(X, Y, Z);
+	if (Z < 0.f)
+	{
+		Result.X = (1.f - FMath::Abs(Y)) * (X >= 0.f ? 1.f : -1.f);
+		Result.Y = (1.f - FMath::Abs(X)) * (Y >= 0.f ? 1.f : -1.f);
+	}
+	return Result.GetSafeNormal();
+}
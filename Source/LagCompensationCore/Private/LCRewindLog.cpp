@@ -0,0 +1,427 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCRewindLog.h"
+
+#include "Algo/BinarySearch.h"
+#include "Algo/IsSorted.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFilemanager.h"
+#include "LagCompensationCore.h"
+#include "Serialization/BufferReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace LCRewindLog
+{
+	constexpr uint32 FileMagic = 0x4C43524C;
+	constexpr uint32 ChunkMagic = 0x4C43434B;
+	constexpr uint32 IndexMagic = 0x4C435249;
+	constexpr uint32 Version = 3;
+
+	constexpr int64 FileHeaderSize = 2 * sizeof(uint32);
+
+	/** Magic, payload size, record count, start and end time. */
+	constexpr int64 ChunkHeaderSize = 3 * sizeof(uint32) + 2 * sizeof(float);
+
+	/** Offset, start and end time. */
+	constexpr int64 IndexEntrySize = sizeof(int64) + 2 * sizeof(float);
+
+	/** Entry count and magic. */
+	constexpr int64 IndexFooterSize = 2 * sizeof(uint32);
+
+	static void SerializePosition(FArchive& Ar, FSavedPosition& Position)
+	{
+		uint16 Yaw = FRotator::CompressAxisToShort(Position.Rotation.Yaw);
+		uint16 Pitch = FRotator::CompressAxisToShort(Position.Rotation.Pitch);
+		uint8 bTeleported = Position.bTeleported ? 1 : 0;
+		Ar << Position.Position << Position.Velocity << Yaw << Pitch << bTeleported << Position.Time << Position.TimeStamp;
+		Position.Rotation = FRotator(FRotator::DecompressAxisFromShort(Pitch), FRotator::DecompressAxisFromShort(Yaw), 0.f);
+		Position.bTeleported = bTeleported != 0;
+	}
+
+	/** Everything but the shooter, which is the record id. */
+	static void SerializeShot(FArchive& Ar, FLCRecordedShot& Shot)
+	{
+		Ar << Shot.VictimId << Shot.HitId;
+		Ar << Shot.ServerTime << Shot.ClientTimeStamp << Shot.PredictionAmount << Shot.RewindTime;
+		Ar << Shot.StartLocation << Shot.EndLocation << Shot.ClientPosition;
+
+		uint8 bTracedWorld = Shot.bTracedWorld ? 1 : 0;
+		Ar << Shot.BucketTime << Shot.BlockTime << bTracedWorld;
+		Shot.bTracedWorld = bTracedWorld != 0;
+
+		FLCCapsuleBatch& Capsules = Shot.Capsules;
+		Ar << Shot.CapsuleIds << Capsules.CenterX << Capsules.CenterY << Capsules.CenterZ << Capsules.Radius << Capsules.HalfHeight;
+		Ar << Shot.HitboxStart;
+
+		int32 NumHitboxes = Shot.Hitboxes.Num();
+		Ar << NumHitboxes;
+		if (Ar.IsLoading())
+		{
+			// a damaged record must not make the replay allocate or index past what the chunk holds
+			const int32 NumCapsules = Shot.CapsuleIds.Num();
+			if (NumHitboxes < 0 || NumHitboxes > Ar.TotalSize() - Ar.Tell()
+				|| Capsules.CenterX.Num() != NumCapsules || Capsules.CenterY.Num() != NumCapsules || Capsules.CenterZ.Num() != NumCapsules
+				|| Capsules.Radius.Num() != NumCapsules || Capsules.HalfHeight.Num() != NumCapsules
+				|| (Shot.HitboxStart.Num() > 0 && (Shot.HitboxStart.Num() != NumCapsules + 1 || Shot.HitboxStart[0] != 0
+					|| Shot.HitboxStart.Last() != NumHitboxes || !Algo::IsSorted(Shot.HitboxStart))))
+			{
+				Ar.SetError();
+				return;
+			}
+			Shot.Hitboxes.SetNumUninitialized(NumHitboxes);
+		}
+		for (FLCHitboxCapsule& Hitbox : Shot.Hitboxes)
+		{
+			Ar << Hitbox.Center << Hitbox.Axis << Hitbox.Radius << Hitbox.HalfHeight << Hitbox.Zone;
+		}
+	}
+}
+
+FLCRewindLogWriter::FLCRewindLogWriter(int32 InChunkSize)
+	: FileSize(0)
+	, ChunkSize(FMath::Max(InChunkSize, 1024))
+	, ChunkRecords(0)
+	, ChunkStartTime(MAX_flt)
+	, ChunkEndTime(-MAX_flt)
+{
+}
+
+FLCRewindLogWriter::~FLCRewindLogWriter()
+{
+	Close();
+}
+
+bool FLCRewindLogWriter::Open(const FString& Filename)
+{
+	Close();
+
+	File.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Filename));
+	if (!File.IsValid())
+	{
+		UE_LOG(LogLagCompensationCore, Warning, TEXT("Could not create rewind log %s"), *Filename);
+		return false;
+	}
+
+	uint32 Magic = LCRewindLog::FileMagic;
+	uint32 Version = LCRewindLog::Version;
+	TArray<uint8> Header;
+	FMemoryWriter Writer(Header);
+	Writer << Magic << Version;
+	File->Write(Header.GetData(), Header.Num());
+	FileSize = Header.Num();
+
+	Characters.Reset();
+	Index.Reset();
+	ChunkData.Reset(ChunkSize + 256);
+	ChunkRecords = 0;
+	return true;
+}
+
+void FLCRewindLogWriter::Close()
+{
+	if (!File.IsValid())
+	{
+		return;
+	}
+
+	FlushChunk();
+
+	TArray<uint8> Footer;
+	FMemoryWriter Writer(Footer);
+	for (FChunkIndexEntry& Entry : Index)
+	{
+		Writer << Entry.Offset << Entry.StartTime << Entry.EndTime;
+	}
+	uint32 NumChunks = Index.Num();
+	uint32 Magic = LCRewindLog::IndexMagic;
+	Writer << NumChunks << Magic;
+	File->Write(Footer.GetData(), Footer.Num());
+	FileSize += Footer.Num();
+
+	File.Reset();
+}
+
+void FLCRewindLogWriter::AddCharacter(uint16 Id, const FString& Name, float Radius, float HalfHeight)
+{
+	FCharacterInfo& Info = Characters.Add(Id);
+	Info.Name = Name;
+	Info.Radius = Radius;
+	Info.HalfHeight = HalfHeight;
+
+	if (File.IsValid())
+	{
+		// a new chunk writes every character anyway
+		if (ChunkRecords > 0 && ChunkData.Num() < ChunkSize)
+		{
+			WriteCharacter(Id);
+		}
+		else
+		{
+			BeginRecord(MAX_flt);
+		}
+	}
+}
+
+void FLCRewindLogWriter::WriteCharacter(uint16 Id)
+{
+	FCharacterInfo& Info = Characters[Id];
+	FMemoryWriter Writer(ChunkData, false, true);
+	uint8 Type = (uint8)ELCRewindLogRecord::Character;
+	Writer << Type << Id << Info.Name << Info.Radius << Info.HalfHeight;
+	ChunkRecords++;
+}
+
+void FLCRewindLogWriter::AddPosition(uint16 Id, const FSavedPosition& Position)
+{
+	if (!File.IsValid())
+	{
+		return;
+	}
+
+	BeginRecord(Position.Time);
+	FMemoryWriter Writer(ChunkData, false, true);
+	uint8 Type = (uint8)ELCRewindLogRecord::Position;
+	FSavedPosition Saved = Position;
+	Writer << Type << Id;
+	LCRewindLog::SerializePosition(Writer, Saved);
+	ChunkRecords++;
+}
+
+void FLCRewindLogWriter::AddShot(const FLCRecordedShot& Shot)
+{
+	if (!File.IsValid())
+	{
+		return;
+	}
+
+	BeginRecord(Shot.ServerTime);
+	FMemoryWriter Writer(ChunkData, false, true);
+	uint8 Type = (uint8)ELCRewindLogRecord::Shot;
+	FLCRecordedShot Recorded = Shot;
+	Writer << Type << Recorded.ShooterId;
+	LCRewindLog::SerializeShot(Writer, Recorded);
+	ChunkRecords++;
+}
+
+void FLCRewindLogWriter::BeginRecord(float Time)
+{
+	if (ChunkData.Num() >= ChunkSize)
+	{
+		FlushChunk();
+	}
+
+	if (ChunkRecords == 0)
+	{
+		// every chunk can be read on its own
+		for (const TPair<uint16, FCharacterInfo>& Character : Characters)
+		{
+			WriteCharacter(Character.Key);
+		}
+	}
+
+	// MAX_flt for records without a time
+	if (Time != MAX_flt)
+	{
+		ChunkStartTime = FMath::Min(ChunkStartTime, Time);
+		ChunkEndTime = FMath::Max(ChunkEndTime, Time);
+	}
+}
+
+void FLCRewindLogWriter::FlushChunk()
+{
+	if (ChunkRecords == 0)
+	{
+		return;
+	}
+
+	// a chunk with nothing but characters has no time range of its own
+	if (ChunkStartTime > ChunkEndTime)
+	{
+		ChunkStartTime = ChunkEndTime = Index.Num() > 0 ? Index.Last().EndTime : 0.f;
+	}
+
+	FChunkIndexEntry& Entry = Index.AddDefaulted_GetRef();
+	Entry.Offset = FileSize;
+	Entry.StartTime = ChunkStartTime;
+	Entry.EndTime = ChunkEndTime;
+
+	TArray<uint8> Header;
+	FMemoryWriter Writer(Header);
+	uint32 Magic = LCRewindLog::ChunkMagic;
+	uint32 PayloadSize = ChunkData.Num();
+	uint32 NumRecords = ChunkRecords;
+	Writer << Magic << PayloadSize << NumRecords << ChunkStartTime << ChunkEndTime;
+	File->Write(Header.GetData(), Header.Num());
+	File->Write(ChunkData.GetData(), ChunkData.Num());
+	FileSize += Header.Num() + ChunkData.Num();
+
+	ChunkData.Reset();
+	ChunkRecords = 0;
+	ChunkStartTime = MAX_flt;
+	ChunkEndTime = -MAX_flt;
+}
+
+FLCRewindLogReader::FLCRewindLogReader()
+	: Data(nullptr)
+	, DataSize(0)
+{
+}
+
+FLCRewindLogReader::~FLCRewindLogReader()
+{
+	Close();
+}
+
+bool FLCRewindLogReader::Open(const FString& Filename)
+{
+	Close();
+
+	MappedFile.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Filename));
+	if (MappedFile.IsValid() && MappedFile->GetFileSize() > 0)
+	{
+		MappedRegion.Reset(MappedFile->MapRegion(0, MappedFile->GetFileSize()));
+	}
+	if (!MappedRegion.IsValid())
+	{
+		UE_LOG(LogLagCompensationCore, Warning, TEXT("Could not map rewind log %s"), *Filename);
+		Close();
+		return false;
+	}
+
+	Data = MappedRegion->GetMappedPtr();
+	DataSize = MappedRegion->GetMappedSize();
+
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	if (DataSize >= LCRewindLog::FileHeaderSize)
+	{
+		FBufferReader Reader(const_cast<uint8*>(Data), LCRewindLog::FileHeaderSize, false);
+		Reader << Magic << Version;
+	}
+	if (Magic != LCRewindLog::FileMagic || Version != LCRewindLog::Version)
+	{
+		UE_LOG(LogLagCompensationCore, Warning, TEXT("%s is not a rewind log of version %u"), *Filename, LCRewindLog::Version);
+		Close();
+		return false;
+	}
+
+	BuildIndex();
+	return true;
+}
+
+void FLCRewindLogReader::Close()
+{
+	MappedRegion.Reset();
+	MappedFile.Reset();
+	Data = nullptr;
+	DataSize = 0;
+	Chunks.Reset();
+}
+
+void FLCRewindLogReader::BuildIndex()
+{
+	using namespace LCRewindLog;
+
+	Chunks.Reset();
+
+	auto ReadChunkHeader = [this](int64 Offset, uint32& OutMagic, uint32& OutPayloadSize, float& OutStartTime, float& OutEndTime)
+	{
+		uint32 NumRecords;
+		FBufferReader Reader(const_cast<uint8*>(Data + Offset), ChunkHeaderSize, false);
+		Reader << OutMagic << OutPayloadSize << NumRecords << OutStartTime << OutEndTime;
+	};
+
+	// a closed log ends with the index
+	if (DataSize >= FileHeaderSize + IndexFooterSize)
+	{
+		uint32 NumChunks, Magic;
+		FBufferReader FooterReader(const_cast<uint8*>(Data + DataSize - IndexFooterSize), IndexFooterSize, false);
+		FooterReader << NumChunks << Magic;
+
+		const int64 IndexOffset = DataSize - IndexFooterSize - NumChunks * IndexEntrySize;
+		if (Magic == IndexMagic && IndexOffset >= FileHeaderSize)
+		{
+			FBufferReader IndexReader(const_cast<uint8*>(Data + IndexOffset), NumChunks * IndexEntrySize, false);
+			for (uint32 Index = 0; Index < NumChunks; Index++)
+			{
+				FChunk& Chunk = Chunks.AddDefaulted_GetRef();
+				int64 Offset;
+				IndexReader << Offset << Chunk.StartTime << Chunk.EndTime;
+				Chunk.Offset = Offset + ChunkHeaderSize;
+			}
+			for (int32 Index = 0; Index < Chunks.Num(); Index++)
+			{
+				const int64 End = Index + 1 < Chunks.Num() ? Chunks[Index + 1].Offset - ChunkHeaderSize : IndexOffset;
+				Chunks[Index].Size = End - Chunks[Index].Offset;
+			}
+			return;
+		}
+	}
+
+	// otherwise walk the chunk headers
+	int64 Offset = FileHeaderSize;
+	while (Offset + ChunkHeaderSize <= DataSize)
+	{
+		uint32 Magic, PayloadSize;
+		float StartTime, EndTime;
+		ReadChunkHeader(Offset, Magic, PayloadSize, StartTime, EndTime);
+		if (Magic != ChunkMagic || Offset + ChunkHeaderSize + PayloadSize > DataSize)
+		{
+			// the part of a chunk a crashed server did not finish
+			break;
+		}
+
+		FChunk& Chunk = Chunks.AddDefaulted_GetRef();
+		Chunk.Offset = Offset + ChunkHeaderSize;
+		Chunk.Size = PayloadSize;
+		Chunk.StartTime = StartTime;
+		Chunk.EndTime = EndTime;
+		Offset += ChunkHeaderSize + PayloadSize;
+	}
+}
+
+int32 FLCRewindLogReader::FindChunk(float Time) const
+{
+	return Algo::LowerBoundBy(Chunks, Time, [](const FChunk& Chunk) { return Chunk.EndTime; });
+}
+
+bool FLCRewindLogReader::ReadChunk(int32 ChunkIndex, TFunctionRef<void(const FLCRewindLogRecord&)> Visitor) const
+{
+	if (!Chunks.IsValidIndex(ChunkIndex))
+	{
+		return false;
+	}
+
+	const FChunk& Chunk = Chunks[ChunkIndex];
+	FBufferReader Reader(const_cast<uint8*>(Data + Chunk.Offset), Chunk.Size, false);
+	FLCRewindLogRecord Record;
+	while (!Reader.AtEnd() && !Reader.IsError())
+	{
+		uint8 Type;
+		Reader << Type << Record.Id;
+		Record.Type = (ELCRewindLogRecord)Type;
+		switch (Record.Type)
+		{
+		case ELCRewindLogRecord::Character:
+			Reader << Record.Name << Record.Radius << Record.HalfHeight;
+			break;
+		case ELCRewindLogRecord::Position:
+			LCRewindLog::SerializePosition(Reader, Record.Position);
+			break;
+		case ELCRewindLogRecord::Shot:
+			Record.Shot.ShooterId = Record.Id;
+			LCRewindLog::SerializeShot(Reader, Record.Shot);
+			break;
+		default:
+			UE_LOG(LogLagCompensationCore, Warning, TEXT("Unknown record %d in rewind log chunk %d"), Type, ChunkIndex);
+			return false;
+		}
+
+		if (!Reader.IsError())
+		{
+			Visitor(Record);
+		}
+	}
+	return !Reader.IsError();
+}
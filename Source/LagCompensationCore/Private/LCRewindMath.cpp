@@ -0,0 +1,328 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCRewindMath.h"
+
+#include "Algo/StableSort.h"
+#include "Math/VectorRegister.h"
+
+void FLCCapsuleBatch::SetNum(int32 NewNum)
+{
+	CenterX.SetNumUninitialized(NewNum, false);
+	CenterY.SetNumUninitialized(NewNum, false);
+	CenterZ.SetNumUninitialized(NewNum, false);
+	Radius.SetNumUninitialized(NewNum, false);
+	HalfHeight.SetNumUninitialized(NewNum, false);
+}
+
+bool FLCRewindMath::SegmentSphereIntersection(const FVector& Start, const FVector& Delta, const FVector& Center, float Radius, float& OutTime)
+{
+	const FVector M = Start - Center;
+	const float C = (M | M) - Radius * Radius;
+	if (C <= 0.f)
+	{
+		OutTime = 0.f;
+		return true;
+	}
+
+	const float A = Delta | Delta;
+	const float B = M | Delta;
+	if (B >= 0.f || A < KINDA_SMALL_NUMBER)
+	{
+		// outside and moving away (or not moving at all)
+		return false;
+	}
+
+	const float Discriminant = B * B - A * C;
+	if (Discriminant < 0.f)
+	{
+		return false;
+	}
+
+	const float Time = (-B - FMath::Sqrt(Discriminant)) / A;
+	if (Time > 1.f)
+	{
+		return false;
+	}
+
+	OutTime = Time;
+	return true;
+}
+
+bool FLCRewindMath::SegmentCapsuleIntersection(const FVector& Start, const FVector& End, const FVector& Center, float Radius, float HalfHeight, float& OutTime)
+{
+	const FVector Delta = End - Start;
+	const float CylinderHalfHeight = FMath::Max(HalfHeight - Radius, 0.f);
+	const float BottomZ = Center.Z - CylinderHalfHeight;
+	const float TopZ = Center.Z + CylinderHalfHeight;
+
+	// the first contact with the capsule is the first contact with either the side of its cylinder or one of
+	// its hemispheres, the flat ends of the cylinder lie inside the hemispheres
+	bool bHit = false;
+	float BestTime = 1.f;
+
+	const float MX = Start.X - Center.X;
+	const float MY = Start.Y - Center.Y;
+	const float A = Delta.X * Delta.X + Delta.Y * Delta.Y;
+	const float B = MX * Delta.X + MY * Delta.Y;
+	const float C = MX * MX + MY * MY - Radius * Radius;
+	if (C <= 0.f && Start.Z >= BottomZ && Start.Z <= TopZ)
+	{
+		OutTime = 0.f;
+		return true;
+	}
+
+	if (A >= KINDA_SMALL_NUMBER && C > 0.f && B < 0.f)
+	{
+		const float Discriminant = B * B - A * C;
+		if (Discriminant >= 0.f)
+		{
+			const float Time = (-B - FMath::Sqrt(Discriminant)) / A;
+			const float Z = Start.Z + Time * Delta.Z;
+			if (Time <= BestTime && Z >= BottomZ && Z <= TopZ)
+			{
+				BestTime = Time;
+				bHit = true;
+			}
+		}
+	}
+
+	float SphereTime;
+	if (SegmentSphereIntersection(Start, Delta, FVector(Center.X, Center.Y, BottomZ), Radius, SphereTime) && SphereTime <= BestTime)
+	{
+		BestTime = SphereTime;
+		bHit = true;
+	}
+	if (SegmentSphereIntersection(Start, Delta, FVector(Center.X, Center.Y, TopZ), Radius, SphereTime) && SphereTime <= BestTime)
+	{
+		BestTime = SphereTime;
+		bHit = true;
+	}
+
+	if (bHit)
+	{
+		OutTime = BestTime;
+	}
+	return bHit;
+}
+
+namespace LCRewindMath
+{
+	/** sqrt of a vector known to be non-negative where it matters, without relying on a vector sqrt instruction. */
+	FORCEINLINE VectorRegister VectorSqrtNonNegative(const VectorRegister& Vec)
+	{
+		const VectorRegister Clamped = VectorMax(Vec, VectorSetFloat1(SMALL_NUMBER));
+		return VectorMultiply(Clamped, VectorReciprocalSqrtAccurate(Clamped));
+	}
+
+	/**
+	 * Vector version of FLCRewindMath::SegmentSphereIntersection for four spheres sharing a segment.
+	 * Lanes without a hit return NoHit.
+	 */
+	FORCEINLINE VectorRegister SegmentSpheresTime(const VectorRegister& MX, const VectorRegister& MY, const VectorRegister& MZ,
+		const VectorRegister& RadiusSquared, const VectorRegister& DX, const VectorRegister& DY, const VectorRegister& DZ,
+		const VectorRegister& InvA, float A, const VectorRegister& NoHit)
+	{
+		const VectorRegister Zero = VectorZero();
+		const VectorRegister C = VectorSubtract(VectorMultiplyAdd(MZ, MZ, VectorMultiplyAdd(MY, MY, VectorMultiply(MX, MX))), RadiusSquared);
+		const VectorRegister B = VectorMultiplyAdd(MZ, DZ, VectorMultiplyAdd(MY, DY, VectorMultiply(MX, DX)));
+		const VectorRegister Discriminant = VectorSubtract(VectorMultiply(B, B), VectorMultiply(VectorSetFloat1(A), C));
+
+		const VectorRegister Time = VectorMultiply(VectorSubtract(VectorNegate(B), VectorSqrtNonNegative(Discriminant)), InvA);
+		const VectorRegister Hit = VectorBitwiseAnd(
+			VectorBitwiseAnd(VectorCompareLT(B, Zero), VectorCompareGE(Discriminant, Zero)),
+			VectorCompareLE(Time, VectorOne()));
+		const VectorRegister Inside = VectorCompareLE(C, Zero);
+
+		return VectorSelect(Inside, Zero, VectorSelect(Hit, Time, NoHit));
+	}
+}
+
+bool FLCRewindMath::SegmentOrientedCapsuleIntersection(const FVector& Start, const FVector& End, const FVector& Center, const FVector& Axis, float Radius, float HalfHeight, float& OutTime)
+{
+	// rotate the segment into the capsule's frame, where the capsule stands upright at the origin
+	const FQuat ToCapsule = FQuat::FindBetweenNormals(Axis, FVector::UpVector);
+	return SegmentCapsuleIntersection(ToCapsule.RotateVector(Start - Center), ToCapsule.RotateVector(End - Center), FVector::ZeroVector, Radius, HalfHeight, OutTime);
+}
+
+namespace LCRewindMath
+{
+	/**
+	 * Calls Visit(Index, Time) for every capsule of the batch that the segment touches, in index order.
+	 * The kernel behind SegmentCapsuleBatchIntersection and SegmentCapsuleBatchIntersections.
+	 */
+	template<typename VisitorType>
+	FORCEINLINE void VisitSegmentCapsuleHits(const FVector& Start, const FVector& End, const FLCCapsuleBatch& Capsules, VisitorType&& Visit)
+	{
+		const int32 Count = Capsules.Num();
+		const FVector Delta = End - Start;
+
+		int32 Index = 0;
+		const float A3 = Delta | Delta;
+		if (A3 >= KINDA_SMALL_NUMBER)
+		{
+			const float A2 = Delta.X * Delta.X + Delta.Y * Delta.Y;
+			const bool bCanHitCylinder = A2 >= KINDA_SMALL_NUMBER;
+
+			const VectorRegister Zero = VectorZero();
+			const VectorRegister NoHit = VectorSetFloat1(2.f);
+			const VectorRegister SX = VectorSetFloat1(Start.X);
+			const VectorRegister SY = VectorSetFloat1(Start.Y);
+			const VectorRegister SZ = VectorSetFloat1(Start.Z);
+			const VectorRegister DX = VectorSetFloat1(Delta.X);
+			const VectorRegister DY = VectorSetFloat1(Delta.Y);
+			const VectorRegister DZ = VectorSetFloat1(Delta.Z);
+			const VectorRegister InvA2 = VectorSetFloat1(bCanHitCylinder ? 1.f / A2 : 0.f);
+			const VectorRegister InvA3 = VectorSetFloat1(1.f / A3);
+			const VectorRegister VA2 = VectorSetFloat1(A2);
+
+			float LaneTimes[4];
+			for (; Index + 4 <= Count; Index += 4)
+			{
+				const VectorRegister CX = VectorLoad(&Capsules.CenterX[Index]);
+				const VectorRegister CY = VectorLoad(&Capsules.CenterY[Index]);
+				const VectorRegister CZ = VectorLoad(&Capsules.CenterZ[Index]);
+				const VectorRegister Radius = VectorLoad(&Capsules.Radius[Index]);
+				const VectorRegister HalfHeight = VectorLoad(&Capsules.HalfHeight[Index]);
+
+				const VectorRegister RadiusSquared = VectorMultiply(Radius, Radius);
+				const VectorRegister CylinderHalfHeight = VectorMax(VectorSubtract(HalfHeight, Radius), Zero);
+				const VectorRegister BottomZ = VectorSubtract(CZ, CylinderHalfHeight);
+				const VectorRegister TopZ = VectorAdd(CZ, CylinderHalfHeight);
+
+				const VectorRegister MX = VectorSubtract(SX, CX);
+				const VectorRegister MY = VectorSubtract(SY, CY);
+
+				// side of the cylinder
+				const VectorRegister C = VectorSubtract(VectorMultiplyAdd(MY, MY, VectorMultiply(MX, MX)), RadiusSquared);
+				const VectorRegister StartInBand = VectorBitwiseAnd(VectorCompareGE(SZ, BottomZ), VectorCompareLE(SZ, TopZ));
+				const VectorRegister Inside = VectorBitwiseAnd(VectorCompareLE(C, Zero), StartInBand);
+
+				VectorRegister Time = NoHit;
+				if (bCanHitCylinder)
+				{
+					const VectorRegister B = VectorMultiplyAdd(MY, DY, VectorMultiply(MX, DX));
+					const VectorRegister Discriminant = VectorSubtract(VectorMultiply(B, B), VectorMultiply(VA2, C));
+					const VectorRegister CylinderTime = VectorMultiply(VectorSubtract(VectorNegate(B), VectorSqrtNonNegative(Discriminant)), InvA2);
+					const VectorRegister Z = VectorMultiplyAdd(CylinderTime, DZ, SZ);
+					const VectorRegister CylinderHit = VectorBitwiseAnd(
+						VectorBitwiseAnd(VectorBitwiseAnd(VectorCompareGT(C, Zero), VectorCompareLT(B, Zero)), VectorCompareGE(Discriminant, Zero)),
+						VectorBitwiseAnd(VectorBitwiseAnd(VectorCompareGE(Z, BottomZ), VectorCompareLE(Z, TopZ)), VectorCompareLE(CylinderTime, VectorOne())));
+					Time = VectorSelect(CylinderHit, CylinderTime, NoHit);
+				}
+
+				// hemispheres
+				Time = VectorMin(Time, SegmentSpheresTime(MX, MY, VectorSubtract(SZ, BottomZ), RadiusSquared, DX, DY, DZ, InvA3, A3, NoHit));
+				Time = VectorMin(Time, SegmentSpheresTime(MX, MY, VectorSubtract(SZ, TopZ), RadiusSquared, DX, DY, DZ, InvA3, A3, NoHit));
+				Time = VectorSelect(Inside, Zero, Time);
+
+				VectorStore(Time, LaneTimes);
+				for (int32 Lane = 0; Lane < 4; Lane++)
+				{
+					if (LaneTimes[Lane] <= 1.f)
+					{
+						Visit(Index + Lane, LaneTimes[Lane]);
+					}
+				}
+			}
+		}
+
+		for (; Index < Count; Index++)
+		{
+			float Time;
+			if (FLCRewindMath::SegmentCapsuleIntersection(Start, End, Capsules.GetCenter(Index), Capsules.Radius[Index], Capsules.HalfHeight[Index], Time))
+			{
+				Visit(Index, Time);
+			}
+		}
+	}
+}
+
+int32 FLCRewindMath::SegmentCapsuleBatchIntersection(const FVector& Start, const FVector& End, const FLCCapsuleBatch& Capsules, int32 IgnoreIndex, float& OutTime)
+{
+	int32 BestIndex = INDEX_NONE;
+	float BestTime = 2.f;
+	LCRewindMath::VisitSegmentCapsuleHits(Start, End, Capsules, [IgnoreIndex, &BestIndex, &BestTime](int32 Index, float Time)
+	{
+		if (Time < BestTime && Index != IgnoreIndex)
+		{
+			BestTime = Time;
+			BestIndex = Index;
+		}
+	});
+
+	if (BestIndex != INDEX_NONE)
+	{
+		OutTime = BestTime;
+	}
+	return BestIndex;
+}
+
+int32 FLCRewindMath::SegmentCapsuleBatchIntersections(const FVector& Start, const FVector& End, const FLCCapsuleBatch& Capsules, int32 IgnoreIndex, TArray<FLCCapsuleHit>& OutHits)
+{
+	OutHits.Reset();
+	LCRewindMath::VisitSegmentCapsuleHits(Start, End, Capsules, [IgnoreIndex, &OutHits](int32 Index, float Time)
+	{
+		if (Index != IgnoreIndex)
+		{
+			OutHits.Add({ Index, Time });
+		}
+	});
+
+	// stable, so capsules touched at the same time keep their index order
+	Algo::StableSortBy(OutHits, &FLCCapsuleHit::Time);
+	return OutHits.Num();
+}
+
+int32 FLCRewindMath::SegmentCharacterIntersection(const FVector& Start, const FVector& End, const FLCCapsuleBatch& Capsules, const TArray<FLCHitboxCapsule>& Hitboxes,
+	const TArray<int32>& HitboxStart, int32 IgnoreIndex, float& OutTime, int32& OutHitbox)
+{
+	OutHitbox = INDEX_NONE;
+	if (HitboxStart.Num() == 0)
+	{
+		return SegmentCapsuleBatchIntersection(Start, End, Capsules, IgnoreIndex, OutTime);
+	}
+
+	// a shot can pass between the bones of the character whose capsule it touches first and still hit someone
+	// behind them, and capsules overlap, so every capsule the shot enters before the best hit so far is refined
+	TArray<FLCCapsuleHit> CapsuleHits;
+	SegmentCapsuleBatchIntersections(Start, End, Capsules, IgnoreIndex, CapsuleHits);
+	int32 HitIndex = INDEX_NONE;
+	float BestTime = MAX_flt;
+	for (const FLCCapsuleHit& CapsuleHit : CapsuleHits)
+	{
+		// the hitboxes lie inside their capsule, none of the rest can be hit earlier
+		if (CapsuleHit.Time >= BestTime)
+		{
+			break;
+		}
+
+		const int32 First = HitboxStart[CapsuleHit.Index];
+		const int32 Last = HitboxStart[CapsuleHit.Index + 1];
+		if (First == Last)
+		{
+			HitIndex = CapsuleHit.Index;
+			BestTime = CapsuleHit.Time;
+			OutHitbox = INDEX_NONE;
+			continue;
+		}
+
+		for (int32 Index = First; Index < Last; Index++)
+		{
+			const FLCHitboxCapsule& Hitbox = Hitboxes[Index];
+			float Time;
+			if (SegmentOrientedCapsuleIntersection(Start, End, Hitbox.Center, Hitbox.Axis, Hitbox.Radius, Hitbox.HalfHeight, Time) && Time < BestTime)
+			{
+				HitIndex = CapsuleHit.Index;
+				BestTime = Time;
+				OutHitbox = Index;
+			}
+		}
+	}
+
+	if (HitIndex != INDEX_NONE)
+	{
+		OutTime = BestTime;
+	}
+	return HitIndex;
+}
@@ -0,0 +1,226 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCRewindReplay.h"
+
+#include "HAL/IConsoleManager.h"
+#include "LagCompensationCore.h"
+#include "LCRewindLog.h"
+#include "LCRewindMath.h"
+#include "LCSavedPositionHistory.h"
+
+namespace LCRewindReplay
+{
+	struct FCharacter
+	{
+		FLCSavedPositionHistory History;
+		int32 IndexHint;
+		float Radius;
+		float HalfHeight;
+	};
+
+	static void Run(const TArray<FString>& Args)
+	{
+		if (Args.Num() == 0)
+		{
+			UE_LOG(LogLagCompensationCore, Display, TEXT("LagComp.Replay <file> [rewind offset ms] [from time] [to time]"));
+			return;
+		}
+
+		FLCRewindReplaySettings Settings;
+		if (Args.Num() > 1) Settings.RewindOffset = FCString::Atof(*Args[1]) * 0.001f;
+		if (Args.Num() > 2) Settings.FromTime = FCString::Atof(*Args[2]);
+		if (Args.Num() > 3) Settings.ToTime = FCString::Atof(*Args[3]);
+
+		FLCRewindReplayResult Result;
+		if (!FLCRewindReplay::Run(Args[0], Settings, Result))
+		{
+			return;
+		}
+
+		UE_LOG(LogLagCompensationCore, Display, TEXT("Replayed %d shots over %.1f s of match in %.3f s (%.0fx real time), %d positions"),
+			Result.NumShots, Result.ReplayedTime, Result.WallTime, Result.WallTime > 0.0 ? Result.ReplayedTime / Result.WallTime : 0.0, Result.NumPositions);
+		UE_LOG(LogLagCompensationCore, Display, TEXT("  rewind offset %.1f ms: %d hits recorded, %d replayed, %d verdicts changed, client agreement %.1f%%, rewind error %.2f cm"),
+			Settings.RewindOffset * 1000.f, Result.RecordedHits, Result.ReplayedHits, Result.ChangedVerdicts,
+			Result.NumShots > 0 ? 100.f * Result.ClientAgreed / Result.NumShots : 100.f,
+			Result.RewindErrorShots > 0 ? Result.RewindErrorSum / Result.RewindErrorShots : 0.0);
+		if (Result.UntracedHits > 0)
+		{
+			UE_LOG(LogLagCompensationCore, Display, TEXT("  %d replayed hits on shots the server missed, the world was not traced for them"), Result.UntracedHits);
+		}
+	}
+
+	static FAutoConsoleCommand RunCommand(
+		TEXT("LagComp.Replay"),
+		TEXT("Replays the shots of a rewind log against its saved positions. Arguments: file [rewind offset ms] [from time] [to time]."),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&Run));
+}
+
+bool FLCRewindReplay::Run(const FString& Filename, const FLCRewindReplaySettings& Settings, FLCRewindReplayResult& OutResult)
+{
+	using namespace LCRewindReplay;
+
+	FLCRewindLogReader Reader;
+	if (!Reader.Open(Filename))
+	{
+		return false;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	OutResult = FLCRewindReplayResult();
+
+	TMap<uint16, FCharacter> Characters;
+	float FirstShotTime = MAX_flt;
+	float LastShotTime = -MAX_flt;
+
+	// scratch for the rewound state of a shot replayed with a rewind offset
+	TArray<uint16> CapsuleIds;
+	FLCCapsuleBatch Capsules;
+	TArray<FLCHitboxCapsule> Hitboxes;
+	TArray<int32> HitboxStart;
+
+	auto ReplayShot = [&](const FLCRecordedShot& Shot)
+	{
+		const TArray<uint16>* TestedIds = &Shot.CapsuleIds;
+		const FLCCapsuleBatch* TestedCapsules = &Shot.Capsules;
+		const TArray<FLCHitboxCapsule>* TestedHitboxes = &Shot.Hitboxes;
+		const TArray<int32>* TestedHitboxStart = &Shot.HitboxStart;
+		if (Settings.RewindOffset != 0.f)
+		{
+			// every character moves, hitboxes included, by how far its saved positions went in RewindOffset
+			const float RewindTime = Shot.BucketTime + Settings.RewindOffset;
+			CapsuleIds = Shot.CapsuleIds;
+			Capsules = Shot.Capsules;
+			Hitboxes = Shot.Hitboxes;
+			HitboxStart = Shot.HitboxStart;
+			for (int32 Index = 0; Index < CapsuleIds.Num(); Index++)
+			{
+				FCharacter* Character = Characters.Find(CapsuleIds[Index]);
+				if (Character == nullptr || Character->History.IsEmpty())
+				{
+					continue;
+				}
+
+				const FVector From = Character->History.GetPositionAtTime(Shot.BucketTime, &Character->IndexHint);
+				const FVector Offset = Character->History.GetPositionAtTime(RewindTime, &Character->IndexHint) - From;
+				Capsules.Set(Index, Capsules.GetCenter(Index) + Offset, Capsules.Radius[Index], Capsules.HalfHeight[Index]);
+				if (HitboxStart.Num() > 0)
+				{
+					for (int32 Hitbox = HitboxStart[Index]; Hitbox < HitboxStart[Index + 1]; Hitbox++)
+					{
+						Hitboxes[Hitbox].Center += Offset;
+					}
+				}
+			}
+
+			// characters the server did not rewind for the shot were away from it, at another time they can be in
+			// its way; nothing of their bones is recorded, they are tested by their capsule
+			for (TPair<uint16, FCharacter>& Entry : Characters)
+			{
+				FCharacter& Character = Entry.Value;
+				if (Entry.Key == Shot.ShooterId || Character.History.IsEmpty() || CapsuleIds.Contains(Entry.Key))
+				{
+					continue;
+				}
+
+				const int32 Index = CapsuleIds.Add(Entry.Key);
+				Capsules.SetNum(Index + 1);
+				Capsules.Set(Index, Character.History.GetPositionAtTime(RewindTime, &Character.IndexHint), Character.Radius, Character.HalfHeight);
+				if (HitboxStart.Num() > 0)
+				{
+					HitboxStart.Add(Hitboxes.Num());
+				}
+			}
+
+			TestedIds = &CapsuleIds;
+			TestedCapsules = &Capsules;
+			TestedHitboxes = &Hitboxes;
+			TestedHitboxStart = &HitboxStart;
+		}
+
+		// the same test the server ran
+		float HitTime = 1.f;
+		int32 HitHitbox;
+		const int32 HitIndex = FLCRewindMath::SegmentCharacterIntersection(Shot.StartLocation, Shot.EndLocation, *TestedCapsules, *TestedHitboxes, *TestedHitboxStart,
+			TestedIds->IndexOfByKey(Shot.ShooterId), HitTime, HitHitbox);
+
+		uint16 HitId = HitIndex != INDEX_NONE ? (*TestedIds)[HitIndex] : MAX_uint16;
+		if (HitId != MAX_uint16)
+		{
+			if (!Shot.bTracedWorld)
+			{
+				OutResult.UntracedHits++;
+			}
+			else if (Shot.BlockTime < HitTime)
+			{
+				// world geometry was in the way
+				HitId = MAX_uint16;
+			}
+		}
+
+		OutResult.NumShots++;
+		OutResult.RecordedHits += Shot.HitId != MAX_uint16 ? 1 : 0;
+		OutResult.ReplayedHits += HitId != MAX_uint16 ? 1 : 0;
+		OutResult.ChangedVerdicts += HitId != Shot.HitId ? 1 : 0;
+		if (HitId == Shot.VictimId)
+		{
+			OutResult.ClientAgreed++;
+			if (HitId != MAX_uint16)
+			{
+				OutResult.RewindErrorSum += FVector::Dist(Shot.ClientPosition, TestedCapsules->GetCenter(HitIndex));
+				OutResult.RewindErrorShots++;
+			}
+		}
+	};
+
+	// start early enough for the first shot to have a full history behind it
+	const int32 Capacity = FMath::CeilToInt(Settings.MaxSavedPositionAge * Settings.PositionSampleRate) + 2;
+	for (int32 Chunk = Reader.FindChunk(Settings.FromTime - Settings.MaxSavedPositionAge); Chunk < Reader.GetNumChunks(); Chunk++)
+	{
+		if (Reader.GetChunkStartTime(Chunk) > Settings.ToTime)
+		{
+			break;
+		}
+
+		Reader.ReadChunk(Chunk, [&](const FLCRewindLogRecord& Record)
+		{
+			switch (Record.Type)
+			{
+			case ELCRewindLogRecord::Character:
+				if (!Characters.Contains(Record.Id))
+				{
+					FCharacter& Character = Characters.Add(Record.Id);
+					Character.History.Reserve(Capacity, Settings.bCompactSavedPositions);
+					Character.History.SetDecimationTolerance(Settings.SavedPositionTolerance);
+					Character.History.SetHermiteInterpolation(Settings.bHermiteSavedPositions);
+					Character.IndexHint = INDEX_NONE;
+					Character.Radius = Record.Radius;
+					Character.HalfHeight = Record.HalfHeight;
+				}
+				break;
+
+			case ELCRewindLogRecord::Position:
+				if (FCharacter* Character = Characters.Find(Record.Id))
+				{
+					Character->History.Add(Record.Position);
+					Character->History.PopOlderThan(Record.Position.Time - Settings.MaxSavedPositionAge);
+					OutResult.NumPositions++;
+				}
+				break;
+
+			case ELCRewindLogRecord::Shot:
+				if (Record.Shot.ServerTime >= Settings.FromTime && Record.Shot.ServerTime <= Settings.ToTime)
+				{
+					ReplayShot(Record.Shot);
+					FirstShotTime = FMath::Min(FirstShotTime, Record.Shot.ServerTime);
+					LastShotTime = FMath::Max(LastShotTime, Record.Shot.ServerTime);
+				}
+				break;
+			}
+		});
+	}
+
+	OutResult.ReplayedTime = LastShotTime >= FirstShotTime ? LastShotTime - FirstShotTime : 0.f;
+	OutResult.WallTime = FPlatformTime::Seconds() - StartTime;
+	return true;
+}
@@ -0,0 +1,733 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCSavedPositionHistory.h"
+
+namespace LCSavedPositionHistory
+{
+	/** Compact positions are stored in 1/8 cm steps. */
+	constexpr float PositionScale = 8.f;
+	constexpr float PositionInvScale = 1.f / PositionScale;
+
+	/** Compact times are stored in 0.1 ms ticks. */
+	constexpr double TimeScale = 10000.0;
+	constexpr double TimeInvScale = 1.0 / TimeScale;
+
+	/** Overflow pool size as a fraction of the capacity, and its bounds. Pool indices are stored in 16 bits. */
+	constexpr int32 OverflowPoolShift = 3;
+	constexpr int32 MinOverflowPoolSize = 16;
+	constexpr int32 MaxOverflowPoolSize = MAX_uint16 + 1;
+
+	/** Straight pieces FindClosestTime follows the Hermite curve between two entries with. */
+	constexpr int32 HermitePieces = 8;
+
+	FORCEINLINE bool FitsInt16(int64 Value)
+	{
+		return Value >= MIN_int16 && Value <= MAX_int16;
+	}
+}
+
+void FLCSavedPositionHistory::Reserve(int32 MinCapacity, bool bInCompact)
+{
+	const int32 NewCapacity = (int32)FMath::RoundUpToPowerOfTwo((uint32)FMath::Max(MinCapacity, 2));
+	bCompact = bInCompact;
+	Entries.Reset();
+	CompactEntries.Reset();
+	Blocks.Reset();
+	OverflowPool.Reset();
+	FreeOverflow.Reset();
+	if (bCompact)
+	{
+		using namespace LCSavedPositionHistory;
+		CompactEntries.SetNumZeroed(NewCapacity);
+		Blocks.SetNumZeroed(((NewCapacity - 1) >> BlockShift) + 1);
+		OverflowPool.SetNum(FMath::Clamp(NewCapacity >> OverflowPoolShift, MinOverflowPoolSize, MaxOverflowPoolSize));
+		FreeOverflow.Reserve(OverflowPool.Num());
+	}
+	else
+	{
+		Entries.SetNum(NewCapacity);
+	}
+	BlockBounds.Init(FBox(ForceInit), ((NewCapacity - 1) >> BlockShift) + 1);
+	MoveTimeStamps.SetNumUninitialized(NewCapacity);
+	DecimatedPositions.Reset(MaxDecimatedRun);
+	DecimatedTimes.Reset(MaxDecimatedRun);
+	IndexMask = NewCapacity - 1;
+	Reset();
+}
+
+void FLCSavedPositionHistory::Reset()
+{
+	Head = 0;
+	Count = 0;
+	NumOverwritten = 0;
+	MoveTimeStampHead = 0;
+	NumMoveTimeStamps = 0;
+	DecimatedPositions.Reset();
+	DecimatedTimes.Reset();
+
+	// every pool slot is free again, the entries that held one are dead
+	for (FLCCompactSavedPosition& Entry : CompactEntries)
+	{
+		Entry.Flags &= ~Flag_Overflow;
+	}
+	FreeOverflow.Reset();
+	for (int32 Slot = OverflowPool.Num() - 1; Slot >= 0; Slot--)
+	{
+		FreeOverflow.Add((uint16)Slot);
+	}
+}
+
+SIZE_T FLCSavedPositionHistory::GetAllocatedSize() const
+{
+	return Entries.GetAllocatedSize() + CompactEntries.GetAllocatedSize() + Blocks.GetAllocatedSize() + OverflowPool.GetAllocatedSize()
+		+ FreeOverflow.GetAllocatedSize() + BlockBounds.GetAllocatedSize() + MoveTimeStamps.GetAllocatedSize();
+}
+
+void FLCSavedPositionHistory::Add(const FSavedPosition& InPosition)
+{
+	check(Capacity() > 0);
+
+	AddMoveTimeStamp(InPosition);
+
+	int32 Physical;
+	if (DecimationTolerance > 0.f && TryDropNewest(InPosition))
+	{
+		// the newest entry is on the way to the new one, take its place
+		Physical = (Head + Count - 1) & IndexMask;
+	}
+	else
+	{
+		DecimatedPositions.Reset();
+		DecimatedTimes.Reset();
+
+		if (Count == Capacity())
+		{
+			// full, the new entry takes the place of the oldest one
+			Physical = Head;
+			Head = (Head + 1) & IndexMask;
+			NumOverwritten++;
+		}
+		else
+		{
+			Physical = (Head + Count) & IndexMask;
+			Count++;
+		}
+	}
+
+	if (bCompact)
+	{
+		AddCompact(Physical, InPosition);
+	}
+	else
+	{
+		Entries[Physical] = InPosition;
+	}
+
+	UpdateBounds(Physical);
+}
+
+void FLCSavedPositionHistory::AddMoveTimeStamp(const FSavedPosition& InPosition)
+{
+	// with no move between two positions they share a timestamp, the move was performed before the first
+	const int32 Mask = MoveTimeStamps.Num() - 1;
+	if (NumMoveTimeStamps > 0 && MoveTimeStamps[(MoveTimeStampHead + NumMoveTimeStamps - 1) & Mask].TimeStamp == InPosition.TimeStamp)
+	{
+		return;
+	}
+
+	if (NumMoveTimeStamps == MoveTimeStamps.Num())
+	{
+		MoveTimeStampHead = (MoveTimeStampHead + 1) & Mask;
+		NumMoveTimeStamps--;
+	}
+	MoveTimeStamps[(MoveTimeStampHead + NumMoveTimeStamps) & Mask] = { InPosition.TimeStamp, InPosition.Time };
+	NumMoveTimeStamps++;
+}
+
+bool FLCSavedPositionHistory::TryDropNewest(const FSavedPosition& InPosition)
+{
+	if (Count < 2 || DecimatedTimes.Num() >= MaxDecimatedRun)
+	{
+		return false;
+	}
+
+	// a teleport and the position before it bound the path, and restarted timestamps can't be interpolated across
+	const FSavedPosition Newest = (*this)[Count - 1];
+	const FSavedPosition Previous = (*this)[Count - 2];
+	if (Newest.bTeleported || InPosition.bTeleported || InPosition.TimeStamp < Newest.TimeStamp || InPosition.Time <= Previous.Time)
+	{
+		return false;
+	}
+
+	// the error of a dropped position is measured at its own time, the way GetPositionAtTime would rebuild it
+	const float ToleranceSquared = FMath::Square(DecimationTolerance);
+	auto IsOnPath = [&](const FVector& Position, float Time)
+	{
+		return FVector::DistSquared(InterpolatePosition(Previous, InPosition, Time, bHermite), Position) <= ToleranceSquared;
+	};
+
+	if (!IsOnPath(Newest.Position, Newest.Time))
+	{
+		return false;
+	}
+	for (int32 Index = 0; Index < DecimatedTimes.Num(); Index++)
+	{
+		if (!IsOnPath(DecimatedPositions[Index], DecimatedTimes[Index]))
+		{
+			return false;
+		}
+	}
+
+	DecimatedPositions.Add(Newest.Position);
+	DecimatedTimes.Add(Newest.Time);
+	return true;
+}
+
+void FLCSavedPositionHistory::UpdateBounds(int32 Physical)
+{
+	const int32 BlockSize = 1 << BlockShift;
+	const int32 BlockStart = Physical & ~(BlockSize - 1);
+	FBox& Bounds = BlockBounds[Physical >> BlockShift];
+
+	// the decoded position, compact entries are off by up to 1/16 cm and the query reads the decoded ones
+	const FVector Position = GetPosition(Count - 1);
+
+	if (Physical == BlockStart || Count == 1)
+	{
+		// drop the overwritten entries: keep the live ones and the first entry of the next block, where the
+		// path of the last one goes
+		Bounds = FBox(Position, Position);
+		const int32 BlockEnd = FMath::Min(BlockStart + BlockSize, Capacity());
+		for (int32 Other = BlockStart; Other <= BlockEnd; Other++)
+		{
+			const int32 Index = (Other - Head) & IndexMask;
+			if (Other != Physical && Index < Count)
+			{
+				Bounds += GetPosition(Index);
+				if (bHermite && Other < BlockEnd && Index + 1 < Count)
+				{
+					AddCurveBounds(Index, Bounds);
+				}
+			}
+		}
+	}
+	else
+	{
+		Bounds += Position;
+	}
+
+	if (Count > 1)
+	{
+		// the path from the previous entry ends here
+		const int32 Previous = (Physical - 1) & IndexMask;
+		FBox& PreviousBounds = BlockBounds[Previous >> BlockShift];
+		if ((Previous >> BlockShift) != (Physical >> BlockShift))
+		{
+			PreviousBounds += Position;
+		}
+		if (bHermite)
+		{
+			AddCurveBounds(Count - 2, PreviousBounds);
+		}
+	}
+}
+
+void FLCSavedPositionHistory::AddCurveBounds(int32 Index, FBox& Bounds) const
+{
+	const FSavedPosition Start = (*this)[Index];
+	const FSavedPosition End = (*this)[Index + 1];
+	if (End.bTeleported)
+	{
+		return;
+	}
+
+	// the curve lies within the hull of its Bezier control points, the ends are a third of the tangents away
+	const float Third = (End.Time - Start.Time) / 3.f;
+	Bounds += Start.Position + Start.Velocity * Third;
+	Bounds += End.Position - End.Velocity * Third;
+}
+
+void FLCSavedPositionHistory::AddCompact(int32 Physical, const FSavedPosition& InPosition)
+{
+	const int32 BlockSize = 1 << BlockShift;
+	const int32 BlockStart = Physical & ~(BlockSize - 1);
+
+	// the entry written over gives its overflow slot back first, moving the block to a new anchor may need it
+	ReleaseOverflow(Physical);
+
+	// entries are written in physical order, so the previous entry shares the anchor unless a new block starts here
+	// or the history was emptied in between
+	if (Physical == BlockStart || Count == 1)
+	{
+		// whatever is still live in the block are the oldest entries, move them over to the new anchor
+		TArray<TPair<int32, FQuantizedPosition>, TInlineAllocator<1 << BlockShift>> LiveEntries;
+		const int32 BlockEnd = FMath::Min(BlockStart + BlockSize, Capacity());
+		for (int32 Other = BlockStart; Other < BlockEnd; Other++)
+		{
+			if (Other != Physical && ((Other - Head) & IndexMask) < Count && (CompactEntries[Other].Flags & Flag_Overflow) == 0)
+			{
+				LiveEntries.Emplace(Other, GetQuantized(Other));
+			}
+		}
+
+		Blocks[Physical >> BlockShift] = Quantize(InPosition);
+
+		for (const TPair<int32, FQuantizedPosition>& Live : LiveEntries)
+		{
+			// making room in the overflow pool for an earlier one may have dropped it
+			if (((Live.Key - Head) & IndexMask) >= Count)
+			{
+				continue;
+			}
+
+			const FLCCompactSavedPosition& Entry = CompactEntries[Live.Key];
+			if (!StoreRelative(Live.Key, Live.Value, Entry.Yaw, Entry.Pitch, Entry.Flags))
+			{
+				StoreOverflow(Live.Key, Dequantize(Live.Value, Entry.Yaw, Entry.Pitch, Entry.Flags), Entry.Flags);
+			}
+		}
+	}
+
+	Encode(Physical, InPosition);
+}
+
+void FLCSavedPositionHistory::Encode(int32 Physical, const FSavedPosition& InPosition)
+{
+	const uint16 Yaw = FRotator::CompressAxisToShort(InPosition.Rotation.Yaw);
+	const uint16 Pitch = FRotator::CompressAxisToShort(InPosition.Rotation.Pitch);
+	const uint8 Flags = InPosition.bTeleported ? Flag_Teleported : 0;
+	if (!StoreRelative(Physical, Quantize(InPosition), Yaw, Pitch, Flags))
+	{
+		// Physical is the newest entry, it is never the one dropped to make room
+		verify(StoreOverflow(Physical, InPosition, Flags));
+	}
+}
+
+bool FLCSavedPositionHistory::StoreOverflow(int32 Physical, const FSavedPosition& InPosition, uint8 Flags)
+{
+	// the pool is allocated with the history, when it is full the oldest entries go, like a full history
+	while (FreeOverflow.Num() == 0)
+	{
+		check(Count > 1);
+		const bool bDropsPhysical = Head == Physical;
+		PopOldest();
+		NumOverwritten++;
+		if (bDropsPhysical)
+		{
+			return false;
+		}
+	}
+
+	const uint16 Slot = FreeOverflow.Pop(false);
+	OverflowPool[Slot] = InPosition;
+
+	FLCCompactSavedPosition& Entry = CompactEntries[Physical];
+	Entry.Offset[0] = (int16)Slot;
+	Entry.Flags = (uint8)(Flags | Flag_Overflow);
+	return true;
+}
+
+void FLCSavedPositionHistory::ReleaseOverflow(int32 Physical)
+{
+	FLCCompactSavedPosition& Entry = CompactEntries[Physical];
+	if (Entry.Flags & Flag_Overflow)
+	{
+		FreeOverflow.Add((uint16)Entry.Offset[0]);
+		Entry.Flags &= ~Flag_Overflow;
+	}
+}
+
+bool FLCSavedPositionHistory::StoreRelative(int32 Physical, const FQuantizedPosition& Quantized, uint16 Yaw, uint16 Pitch, uint8 Flags)
+{
+	const FQuantizedPosition& Anchor = Blocks[Physical >> BlockShift];
+	const int32 OffsetX = Quantized.Position[0] - Anchor.Position[0];
+	const int32 OffsetY = Quantized.Position[1] - Anchor.Position[1];
+	const int32 OffsetZ = Quantized.Position[2] - Anchor.Position[2];
+	const int64 TimeTicks = Quantized.Time - Anchor.Time;
+	const int64 TimeStampTicks = Quantized.TimeStampOffset - Anchor.TimeStampOffset;
+
+	using namespace LCSavedPositionHistory;
+	if (!FitsInt16(OffsetX) || !FitsInt16(OffsetY) || !FitsInt16(OffsetZ) || !FitsInt16(TimeTicks) || !FitsInt16(TimeStampTicks)
+		|| !FitsInt16(Quantized.Velocity[0]) || !FitsInt16(Quantized.Velocity[1]) || !FitsInt16(Quantized.Velocity[2]))
+	{
+		return false;
+	}
+
+	FLCCompactSavedPosition& Entry = CompactEntries[Physical];
+	Entry.Offset[0] = (int16)OffsetX;
+	Entry.Offset[1] = (int16)OffsetY;
+	Entry.Offset[2] = (int16)OffsetZ;
+	Entry.Velocity[0] = (int16)Quantized.Velocity[0];
+	Entry.Velocity[1] = (int16)Quantized.Velocity[1];
+	Entry.Velocity[2] = (int16)Quantized.Velocity[2];
+	Entry.Yaw = Yaw;
+	Entry.Pitch = Pitch;
+	Entry.TimeTicks = (int16)TimeTicks;
+	Entry.TimeStampTicks = (int16)TimeStampTicks;
+	Entry.Flags = (uint8)(Flags & ~Flag_Overflow);
+	return true;
+}
+
+FLCSavedPositionHistory::FQuantizedPosition FLCSavedPositionHistory::GetQuantized(int32 Physical) const
+{
+	const FLCCompactSavedPosition& Entry = CompactEntries[Physical];
+	const FQuantizedPosition& Anchor = Blocks[Physical >> BlockShift];
+
+	FQuantizedPosition Result;
+	Result.Position[0] = Anchor.Position[0] + Entry.Offset[0];
+	Result.Position[1] = Anchor.Position[1] + Entry.Offset[1];
+	Result.Position[2] = Anchor.Position[2] + Entry.Offset[2];
+	Result.Velocity[0] = Entry.Velocity[0];
+	Result.Velocity[1] = Entry.Velocity[1];
+	Result.Velocity[2] = Entry.Velocity[2];
+	Result.Time = Anchor.Time + Entry.TimeTicks;
+	Result.TimeStampOffset = Anchor.TimeStampOffset + Entry.TimeStampTicks;
+	return Result;
+}
+
+FLCSavedPositionHistory::FQuantizedPosition FLCSavedPositionHistory::Quantize(const FSavedPosition& InPosition)
+{
+	using namespace LCSavedPositionHistory;
+
+	FQuantizedPosition Result;
+	Result.Position[0] = FMath::RoundToInt(InPosition.Position.X * PositionScale);
+	Result.Position[1] = FMath::RoundToInt(InPosition.Position.Y * PositionScale);
+	Result.Position[2] = FMath::RoundToInt(InPosition.Position.Z * PositionScale);
+	Result.Velocity[0] = FMath::RoundToInt(InPosition.Velocity.X);
+	Result.Velocity[1] = FMath::RoundToInt(InPosition.Velocity.Y);
+	Result.Velocity[2] = FMath::RoundToInt(InPosition.Velocity.Z);
+	Result.Time = (int64)FMath::RoundToDouble(InPosition.Time * TimeScale);
+	Result.TimeStampOffset = (int64)FMath::RoundToDouble(((double)InPosition.TimeStamp - InPosition.Time) * TimeScale);
+	return Result;
+}
+
+FSavedPosition FLCSavedPositionHistory::Dequantize(const FQuantizedPosition& Quantized, uint16 Yaw, uint16 Pitch, uint8 Flags)
+{
+	using namespace LCSavedPositionHistory;
+
+	const double Time = Quantized.Time * TimeInvScale;
+	return FSavedPosition(
+		FVector(Quantized.Position[0], Quantized.Position[1], Quantized.Position[2]) * PositionInvScale,
+		FRotator(FRotator::DecompressAxisFromShort(Pitch), FRotator::DecompressAxisFromShort(Yaw), 0.f),
+		(Flags & Flag_Teleported) != 0,
+		(float)Time,
+		(float)(Time + Quantized.TimeStampOffset * TimeInvScale),
+		FVector(Quantized.Velocity[0], Quantized.Velocity[1], Quantized.Velocity[2]));
+}
+
+FSavedPosition FLCSavedPositionHistory::Decode(int32 Physical) const
+{
+	const FLCCompactSavedPosition& Entry = CompactEntries[Physical];
+	if (Entry.Flags & Flag_Overflow)
+	{
+		return GetOverflow(Physical);
+	}
+	return Dequantize(GetQuantized(Physical), Entry.Yaw, Entry.Pitch, Entry.Flags);
+}
+
+FVector FLCSavedPositionHistory::DecodePosition(int32 Physical) const
+{
+	const FLCCompactSavedPosition& Entry = CompactEntries[Physical];
+	if (Entry.Flags & Flag_Overflow)
+	{
+		return GetOverflow(Physical).Position;
+	}
+
+	const FQuantizedPosition& Anchor = Blocks[Physical >> BlockShift];
+	return FVector(Anchor.Position[0] + Entry.Offset[0], Anchor.Position[1] + Entry.Offset[1], Anchor.Position[2] + Entry.Offset[2])
+		* LCSavedPositionHistory::PositionInvScale;
+}
+
+float FLCSavedPositionHistory::DecodeTime(int32 Physical) const
+{
+	const FLCCompactSavedPosition& Entry = CompactEntries[Physical];
+	if (Entry.Flags & Flag_Overflow)
+	{
+		return GetOverflow(Physical).Time;
+	}
+	return (float)((Blocks[Physical >> BlockShift].Time + Entry.TimeTicks) * LCSavedPositionHistory::TimeInvScale);
+}
+
+void FLCSavedPositionHistory::PopOldest()
+{
+	if (Count > 0)
+	{
+		if (bCompact)
+		{
+			ReleaseOverflow(Head);
+		}
+		Head = (Head + 1) & IndexMask;
+		Count--;
+	}
+	if (Count < 2)
+	{
+		// the entry the dropped positions were measured from is gone
+		DecimatedPositions.Reset();
+		DecimatedTimes.Reset();
+	}
+}
+
+void FLCSavedPositionHistory::PopOlderThan(float MinTime)
+{
+	while (Count > 1 && GetTime(1) < MinTime)
+	{
+		PopOldest();
+	}
+}
+
+int32 FLCSavedPositionHistory::FindLastBefore(float TargetTime, int32* InOutHint) const
+{
+	if (InOutHint)
+	{
+		const int32 Hint = *InOutHint;
+		if (Hint >= 0 && Hint < Count && GetTime(Hint) < TargetTime && (Hint == Count - 1 || GetTime(Hint + 1) >= TargetTime))
+		{
+			return Hint;
+		}
+	}
+
+	// find the first entry that is not older than TargetTime, the one before it is the answer
+	int32 Low = 0;
+	int32 High = Count;
+	while (Low < High)
+	{
+		const int32 Mid = Low + (High - Low) / 2;
+		if (GetTime(Mid) < TargetTime)
+		{
+			Low = Mid + 1;
+		}
+		else
+		{
+			High = Mid;
+		}
+	}
+
+	const int32 Result = Low - 1;
+	if (InOutHint)
+	{
+		*InOutHint = Result;
+	}
+	return Result;
+}
+
+FVector FLCSavedPositionHistory::GetPositionAtTime(float TargetTime, int32* InOutHint) const
+{
+	if (Count == 0)
+	{
+		return FVector::ZeroVector;
+	}
+
+	const int32 Index = FindLastBefore(TargetTime, InOutHint);
+	if (Index == INDEX_NONE)
+	{
+		// everything we have is newer than the target time, use the oldest position
+		return GetPosition(0);
+	}
+
+	// decode the two entries once, compact histories pay for every access
+	const FSavedPosition Before = (*this)[Index];
+	if (Index == Count - 1)
+	{
+		return Before.Position;
+	}
+
+	// the character was at Before until it teleported to After
+	const FSavedPosition After = (*this)[Index + 1];
+	if (After.bTeleported)
+	{
+		return TargetTime < After.Time ? Before.Position : After.Position;
+	}
+	return InterpolatePosition(Before, After, TargetTime, bHermite);
+}
+
+FVector FLCSavedPositionHistory::InterpolatePosition(const FSavedPosition& A, const FSavedPosition& B, float Time, bool bHermite)
+{
+	const float Duration = B.Time - A.Time;
+	if (Duration <= 0.f)
+	{
+		return B.Position;
+	}
+
+	const float Alpha = (Time - A.Time) / Duration;
+	if (!bHermite)
+	{
+		return A.Position + Alpha * (B.Position - A.Position);
+	}
+
+	// the curve's parameter runs over Duration seconds, the tangents are the velocities scaled to match
+	return FMath::CubicInterp(A.Position, A.Velocity * Duration, B.Position, B.Velocity * Duration, Alpha);
+}
+
+int32 FLCSavedPositionHistory::FindClosest(const FVector& Position) const
+{
+	int32 ClosestIndex = INDEX_NONE;
+	float MinDistanceSquared = MAX_flt;
+	for (int32 Index = Count - 1; Index >= 0; Index--)
+	{
+		const float DistanceSquared = FVector::DistSquared(GetPosition(Index), Position);
+		if (DistanceSquared < MinDistanceSquared)
+		{
+			MinDistanceSquared = DistanceSquared;
+			ClosestIndex = Index;
+		}
+	}
+	return ClosestIndex;
+}
+
+bool FLCSavedPositionHistory::FindClosestTime(const FVector& Position, FLCClosestSavedPosition& OutClosest, float MinTime, float MaxTime) const
+{
+	if (Count == 0 || MaxTime < MinTime)
+	{
+		return false;
+	}
+
+	// entries whose path segment reaches into [MinTime, MaxTime]: from the last one before MinTime to the
+	// last one not after MaxTime
+	const int32 First = FMath::Max(FindLastBefore(MinTime), 0);
+	int32 Last = FindLastBefore(MaxTime);
+	if (Last + 1 < Count && GetTime(Last + 1) == MaxTime)
+	{
+		Last++;
+	}
+	if (Last < First)
+	{
+		return false;
+	}
+
+	// visit the blocks nearest first, so most of them are rejected by their bounds
+	struct FCandidate
+	{
+		float DistanceSquared;
+		int32 First;
+		int32 Last;
+	};
+	TArray<FCandidate, TInlineAllocator<16>> Candidates;
+	for (int32 Index = First; Index <= Last;)
+	{
+		const int32 Physical = (Head + Index) & IndexMask;
+		const int32 BlockEnd = Index + ((1 << BlockShift) - (Physical & ((1 << BlockShift) - 1)));
+		const int32 CandidateLast = FMath::Min(BlockEnd - 1, Last);
+		Candidates.Add({ BlockBounds[Physical >> BlockShift].ComputeSquaredDistanceToPoint(Position), Index, CandidateLast });
+		Index = CandidateLast + 1;
+	}
+	Candidates.Sort([](const FCandidate& A, const FCandidate& B) { return A.DistanceSquared < B.DistanceSquared; });
+
+	OutClosest = FLCClosestSavedPosition();
+	for (const FCandidate& Candidate : Candidates)
+	{
+		if (Candidate.DistanceSquared >= OutClosest.DistanceSquared)
+		{
+			break;
+		}
+
+		FSavedPosition Start = (*this)[Candidate.First];
+		for (int32 Index = Candidate.First; Index <= Candidate.Last; Index++)
+		{
+			auto Consider = [&OutClosest, &Position, Index](const FVector& Closest, float Time)
+			{
+				const float DistanceSquared = FVector::DistSquared(Closest, Position);
+				if (DistanceSquared < OutClosest.DistanceSquared)
+				{
+					OutClosest.Index = Index;
+					OutClosest.Time = Time;
+					OutClosest.Position = Closest;
+					OutClosest.DistanceSquared = DistanceSquared;
+				}
+			};
+
+			const bool bHasEnd = Index < Count - 1;
+			const FSavedPosition End = bHasEnd ? (*this)[Index + 1] : Start;
+
+			// like GetPositionAtTime, there is no path into a teleported entry
+			if (bHasEnd && !End.bTeleported && End.Time > Start.Time)
+			{
+				// the path as straight pieces, one or a few along the Hermite curve; for each the part inside the
+				// time range, then the point of it closest to Position
+				const int32 NumPieces = bHermite ? LCSavedPositionHistory::HermitePieces : 1;
+				const float PieceDuration = (End.Time - Start.Time) / NumPieces;
+				FVector PieceStart = Start.Position;
+				for (int32 Piece = 0; Piece < NumPieces; Piece++)
+				{
+					const float PieceStartTime = Start.Time + Piece * PieceDuration;
+					const FVector PieceEnd = Piece == NumPieces - 1 ? End.Position : InterpolatePosition(Start, End, PieceStartTime + PieceDuration, true);
+					const float MinAlpha = FMath::Max((MinTime - PieceStartTime) / PieceDuration, 0.f);
+					const float MaxAlpha = FMath::Min((MaxTime - PieceStartTime) / PieceDuration, 1.f);
+					if (MinAlpha <= MaxAlpha)
+					{
+						const FVector Segment = PieceEnd - PieceStart;
+						const float LengthSquared = Segment.SizeSquared();
+						const float Alpha = FMath::Clamp(LengthSquared > KINDA_SMALL_NUMBER ? ((Position - PieceStart) | Segment) / LengthSquared : 0.f, MinAlpha, MaxAlpha);
+						Consider(PieceStart + Alpha * Segment, PieceStartTime + Alpha * PieceDuration);
+					}
+					PieceStart = PieceEnd;
+				}
+			}
+			else if (Start.Time >= MinTime && Start.Time <= MaxTime)
+			{
+				Consider(Start.Position, Start.Time);
+			}
+
+			if (!bHasEnd)
+			{
+				break;
+			}
+			Start = End;
+		}
+	}
+	return OutClosest.Index != INDEX_NONE;
+}
+
+bool FLCSavedPositionHistory::MapTimeStampToTime(float TimeStamp, float& OutTime, FVector* OutPosition) const
+{
+	if (Count == 0)
+	{
+		return false;
+	}
+
+	// timestamps go back to zero when the client resets them, so walk back from the newest move instead of
+	// searching; shots are recent, the match is usually one of the last few moves
+	const int32 Mask = MoveTimeStamps.Num() - 1;
+	// move times are the ones added, compact entry times are rounded to a tick
+	const float OldestTime = GetTime(0) - (bCompact ? (float)LCSavedPositionHistory::TimeInvScale : 0.f);
+	for (int32 Index = NumMoveTimeStamps - 1; Index >= 0; Index--)
+	{
+		const FMoveTimeStamp& Move = MoveTimeStamps[(MoveTimeStampHead + Index) & Mask];
+		if (Move.Time < OldestTime)
+		{
+			// the positions of this move are gone
+			return false;
+		}
+
+		if (Move.TimeStamp <= TimeStamp)
+		{
+			if (Move.TimeStamp == TimeStamp)
+			{
+				OutTime = Move.Time;
+			}
+			else if (Index == NumMoveTimeStamps - 1)
+			{
+				return false;
+			}
+			else
+			{
+				const FMoveTimeStamp& Next = MoveTimeStamps[(MoveTimeStampHead + Index + 1) & Mask];
+				const float Alpha = (TimeStamp - Move.TimeStamp) / (Next.TimeStamp - Move.TimeStamp);
+				OutTime = FMath::Lerp(Move.Time, Next.Time, Alpha);
+			}
+
+			if (OutPosition)
+			{
+				*OutPosition = GetPositionAtTime(OutTime);
+			}
+			return true;
+		}
+
+		if (Index > 0 && MoveTimeStamps[(MoveTimeStampHead + Index - 1) & Mask].TimeStamp > Move.TimeStamp)
+		{
+			// the client reset its timestamps here, older moves are on a different clock
+			return false;
+		}
+	}
+	return false;
+}
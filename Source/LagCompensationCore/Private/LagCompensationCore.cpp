@@ -0,0 +1,8 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "LagCompensationCore.h"
+#include "Modules/ModuleManager.h"
+
+IMPLEMENT_MODULE( FDefaultModuleImpl, LagCompensationCore );
+
+DEFINE_LOG_CATEGORY(LogLagCompensationCore);
@@ -0,0 +1,75 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCClientMoveHistory.h"
+#include "LCSavedPositionHistory.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace LCClientMoveHistoryTests
+{
+	constexpr uint32 TestFlags = EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCClientMoveHistoryBetweenSamplesTest, "LagCompensation.Core.ClientMoveHistory.BetweenSamples",
+	LCClientMoveHistoryTests::TestFlags)
+
+bool FLCClientMoveHistoryBetweenSamplesTest::RunTest(const FString& Parameters)
+{
+	FLCSavedPositionHistory SavedMoves;
+	SavedMoves.Reserve(16);
+	FLCClientMoveHistory Moves;
+	Moves.Reserve(16);
+
+	// the server samples a position after move 1.00, then performs moves until the next sample: two in one
+	// tick, then one the client combined 1.04 into
+	SavedMoves.Add(FSavedPosition(FVector(0.f, 0.f, 0.f), FRotator::ZeroRotator, false, 10.f, 1.00f));
+	Moves.Add(1.00f, 10.f, FVector(0.f, 0.f, 0.f));
+	Moves.Add(1.01f, 10.01f, FVector(10.f, 0.f, 0.f));
+	Moves.Add(1.02f, 10.02f, FVector(20.f, 0.f, 0.f));
+	Moves.Add(1.03f, 10.02f, FVector(30.f, 0.f, 0.f));
+	Moves.Add(1.05f, 10.04f, FVector(50.f, 0.f, 0.f));
+	Moves.Add(1.05f, 10.05f, FVector(60.f, 0.f, 0.f));
+	TestEqual(TEXT("A repeated timestamp is not recorded"), Moves.Num(), 5);
+
+	float Time;
+	FVector Location;
+	TestFalse(TEXT("Saved positions only know the sampled move"), SavedMoves.MapTimeStampToTime(1.02f, Time));
+
+	TestTrue(TEXT("Move after the sample"), Moves.Find(1.02f, Time, Location));
+	TestEqual(TEXT("Its server time"), Time, 10.02f);
+	TestEqual(TEXT("Its location"), Location, FVector(20.f, 0.f, 0.f));
+
+	TestTrue(TEXT("Second move of a tick"), Moves.Find(1.03f, Time, Location));
+	TestEqual(TEXT("Its server time"), Time, 10.02f);
+	TestEqual(TEXT("Its location"), Location, FVector(30.f, 0.f, 0.f));
+
+	TestTrue(TEXT("Combined move"), Moves.Find(1.04f, Time, Location));
+	TestEqual(TEXT("Its server time"), Time, 10.03f, 0.0001f);
+	TestEqual(TEXT("Its location"), Location, FVector(40.f, 0.f, 0.f), 0.01f);
+
+	TestFalse(TEXT("A move that has not arrived"), Moves.Find(1.06f, Time, Location));
+	TestTrue(TEXT("is after the newest"), Moves.IsAfterNewest(1.06f));
+	TestFalse(TEXT("Older than every move"), Moves.Find(0.99f, Time, Location));
+	TestFalse(TEXT("which is not after the newest"), Moves.IsAfterNewest(0.99f));
+
+	// the client resets its timestamps, the moves from before are no longer found
+	Moves.Add(0.01f, 10.06f, FVector(70.f, 0.f, 0.f));
+	Moves.Add(0.02f, 10.07f, FVector(80.f, 0.f, 0.f));
+	TestTrue(TEXT("Move after a reset"), Moves.Find(0.02f, Time, Location) && Time == 10.07f);
+	TestFalse(TEXT("Move before a reset"), Moves.Find(1.02f, Time, Location));
+	TestFalse(TEXT("Between a reset and the first move after it"), Moves.Find(0.005f, Time, Location));
+
+	// a full ring overwrites the oldest moves
+	for (int32 Index = 0; Index < 32; Index++)
+	{
+		Moves.Add(1.f + Index * 0.01f, 20.f + Index * 0.01f, FVector::ZeroVector);
+	}
+	TestEqual(TEXT("Ring capacity"), Moves.Num(), 16);
+	TestFalse(TEXT("Overwritten move"), Moves.Find(1.f, Time, Location));
+	TestTrue(TEXT("Oldest kept move"), Moves.Find(1.f + 16 * 0.01f, Time, Location));
+	return true;
+}
+
+#endif
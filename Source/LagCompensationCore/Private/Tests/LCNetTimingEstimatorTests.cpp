@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCNetTimingEstimator.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace LCNetTimingEstimatorTests
+{
+	constexpr uint32 TestFlags = EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter;
+
+	/** A client sending moves at 60 Hz over a link with a fixed base delay, uniform jitter and a spike every 50 moves. */
+	struct FTrace
+	{
+		FTrace() : Random(1234), ClockOffset(12.345f), BaseOneWayDelay(0.04f), MaxJitter(0.01f), SpikeDelay(0.15f), NextMove(0) {}
+
+		FRandomStream Random;
+		float ClockOffset;
+		float BaseOneWayDelay;
+		float MaxJitter;
+		float SpikeDelay;
+		int32 NextMove;
+
+		void Feed(FLCNetTimingEstimator& Estimator, int32 NumMoves)
+		{
+			for (int32 Move = 0; Move < NumMoves; Move++, NextMove++)
+			{
+				const float ClientTimeStamp = NextMove / 60.f;
+				const float Jitter = (NextMove % 50 == 49) ? SpikeDelay : Random.FRandRange(0.f, MaxJitter);
+				Estimator.AddSample(ClientTimeStamp, ClientTimeStamp + ClockOffset + BaseOneWayDelay + Jitter);
+			}
+		}
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCNetTimingEstimatorConvergenceTest, "LagCompensation.Core.NetTimingEstimator.Convergence",
+	LCNetTimingEstimatorTests::TestFlags)
+
+bool FLCNetTimingEstimatorConvergenceTest::RunTest(const FString& Parameters)
+{
+	using namespace LCNetTimingEstimatorTests;
+
+	FTrace Trace;
+	FLCNetTimingEstimator Estimator(256);
+	Estimator.SetRoundTripTime(2.f * Trace.BaseOneWayDelay);
+
+	// one window of moves is enough, spikes don't pull the clock offset
+	Trace.Feed(Estimator, 256);
+	TestEqual(TEXT("Window is full"), Estimator.GetNumSamples(), 256);
+	TestEqual(TEXT("Clock offset"), Estimator.GetClockOffset(), Trace.ClockOffset, 0.001f);
+	TestEqual(TEXT("Median jitter"), Estimator.GetJitter(0.5f), 0.5f * Trace.MaxJitter, 0.0015f);
+	TestEqual(TEXT("Median one-way delay"), Estimator.GetOneWayDelay(0.5f), Trace.BaseOneWayDelay + 0.5f * Trace.MaxJitter, 0.0015f);
+	TestTrue(TEXT("Spikes only show in the top percentile"), Estimator.GetJitter(0.9f) <= Trace.MaxJitter && Estimator.GetJitter(1.f) >= Trace.SpikeDelay - 0.001f);
+
+	// the route gets slower: the old fast samples age out of the window and the estimate follows
+	Trace.BaseOneWayDelay = 0.07f;
+	Estimator.SetRoundTripTime(2.f * Trace.BaseOneWayDelay);
+	Trace.Feed(Estimator, 256);
+	TestEqual(TEXT("Clock offset after a route change"), Estimator.GetClockOffset(), Trace.ClockOffset, 0.001f);
+	TestEqual(TEXT("One-way delay after a route change"), Estimator.GetOneWayDelay(0.5f), Trace.BaseOneWayDelay + 0.5f * Trace.MaxJitter, 0.0015f);
+
+	// the client resets its clock: nothing from the old clock is kept, a few moves are enough again
+	Trace.NextMove = 0;
+	Trace.ClockOffset = 40.f;
+	Trace.Feed(Estimator, 32);
+	TestEqual(TEXT("Window restarts on a clock reset"), Estimator.GetNumSamples(), 32);
+	TestEqual(TEXT("Clock offset after a clock reset"), Estimator.GetClockOffset(), Trace.ClockOffset, Trace.MaxJitter);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
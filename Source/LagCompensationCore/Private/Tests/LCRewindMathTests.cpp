@@ -0,0 +1,164 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCRewindMath.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace LCRewindMathTests
+{
+	constexpr uint32 TestFlags = EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter;
+
+	/** Hits closer than this to the capsule's surface are grazing, the vector and scalar math may round them apart. */
+	constexpr float GrazingDistance = 0.05f;
+
+	bool IsGrazing(const FVector& Start, const FVector& End, const FLCCapsuleBatch& Capsules, int32 Index)
+	{
+		const float Radius = Capsules.Radius[Index];
+		const float CylinderHalfHeight = FMath::Max(Capsules.HalfHeight[Index] - Radius, 0.f);
+		const FVector Bottom = Capsules.GetCenter(Index) - FVector(0.f, 0.f, CylinderHalfHeight);
+		const FVector Top = Capsules.GetCenter(Index) + FVector(0.f, 0.f, CylinderHalfHeight);
+
+		FVector OnSegment, OnAxis;
+		FMath::SegmentDistToSegmentSafe(Start, End, Bottom, Top, OnSegment, OnAxis);
+		return FMath::Abs(FVector::Dist(OnSegment, OnAxis) - Radius) < GrazingDistance
+			|| FMath::Abs(FMath::PointDistToSegment(Start, Bottom, Top) - Radius) < GrazingDistance
+			|| FMath::Abs(FMath::PointDistToSegment(End, Bottom, Top) - Radius) < GrazingDistance;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCRewindMathSegmentCapsuleTest, "LagCompensation.Core.RewindMath.SegmentCapsule", LCRewindMathTests::TestFlags)
+
+bool FLCRewindMathSegmentCapsuleTest::RunTest(const FString& Parameters)
+{
+	float Time = 0.f;
+	const FVector Center(0.f, 0.f, 100.f);
+
+	TestTrue(TEXT("Through the side"), FLCRewindMath::SegmentCapsuleIntersection(FVector(-100.f, 0.f, 100.f), FVector(100.f, 0.f, 100.f), Center, 34.f, 88.f, Time));
+	TestEqual(TEXT("Side contact"), Time, 66.f / 200.f, 0.0001f);
+	TestTrue(TEXT("Through the top hemisphere"), FLCRewindMath::SegmentCapsuleIntersection(FVector(0.f, 0.f, 300.f), FVector(0.f, 0.f, 100.f), Center, 34.f, 88.f, Time));
+	TestEqual(TEXT("Top contact"), Time, 112.f / 200.f, 0.0001f);
+	TestTrue(TEXT("Starting inside"), FLCRewindMath::SegmentCapsuleIntersection(Center, Center + FVector(500.f, 0.f, 0.f), Center, 34.f, 88.f, Time) && Time == 0.f);
+	TestFalse(TEXT("Passing above"), FLCRewindMath::SegmentCapsuleIntersection(FVector(-100.f, 0.f, 200.f), FVector(100.f, 0.f, 200.f), Center, 34.f, 88.f, Time));
+	TestFalse(TEXT("Stopping short"), FLCRewindMath::SegmentCapsuleIntersection(FVector(-100.f, 0.f, 100.f), FVector(-50.f, 0.f, 100.f), Center, 34.f, 88.f, Time));
+
+	// an oriented capsule lying along X is hit from above at its middle
+	TestTrue(TEXT("Oriented capsule"), FLCRewindMath::SegmentOrientedCapsuleIntersection(FVector(0.f, 0.f, 100.f), FVector(0.f, 0.f, -100.f), FVector::ZeroVector, FVector(1.f, 0.f, 0.f), 10.f, 50.f, Time));
+	TestEqual(TEXT("Oriented contact"), Time, 90.f / 200.f, 0.0001f);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCRewindMathBatchTest, "LagCompensation.Core.RewindMath.BatchMatchesScalar", LCRewindMathTests::TestFlags)
+
+bool FLCRewindMathBatchTest::RunTest(const FString& Parameters)
+{
+	using namespace LCRewindMathTests;
+
+	// 13 capsules: three vector groups of four and a scalar remainder
+	FRandomStream Random(1234);
+	FLCCapsuleBatch Capsules;
+	Capsules.SetNum(13);
+	for (int32 Index = 0; Index < Capsules.Num(); Index++)
+	{
+		Capsules.Set(Index, FVector(Random.FRandRange(-1000.f, 1000.f), Random.FRandRange(-1000.f, 1000.f), Random.FRandRange(0.f, 200.f)),
+			Random.FRandRange(20.f, 40.f), Random.FRandRange(60.f, 100.f));
+	}
+
+	TArray<FLCCapsuleHit> Hits;
+	int32 NumCompared = 0;
+	for (int32 Shot = 0; Shot < 2000; Shot++)
+	{
+		const FVector Start(Random.FRandRange(-1500.f, 1500.f), Random.FRandRange(-1500.f, 1500.f), Random.FRandRange(0.f, 200.f));
+		const FVector End = Start + Random.GetUnitVector() * Random.FRandRange(100.f, 3000.f);
+		const int32 IgnoreIndex = Shot % 17 == 0 ? Shot % Capsules.Num() : INDEX_NONE;
+
+		bool bGrazing = false;
+		for (int32 Index = 0; Index < Capsules.Num(); Index++)
+		{
+			bGrazing |= IsGrazing(Start, End, Capsules, Index);
+		}
+		if (bGrazing)
+		{
+			continue;
+		}
+		NumCompared++;
+
+		// scalar reference, every capsule on its own
+		TArray<FLCCapsuleHit> Expected;
+		for (int32 Index = 0; Index < Capsules.Num(); Index++)
+		{
+			float Time;
+			if (Index != IgnoreIndex && FLCRewindMath::SegmentCapsuleIntersection(Start, End, Capsules.GetCenter(Index), Capsules.Radius[Index], Capsules.HalfHeight[Index], Time))
+			{
+				Expected.Add({ Index, Time });
+			}
+		}
+		Expected.StableSort([](const FLCCapsuleHit& A, const FLCCapsuleHit& B) { return A.Time < B.Time; });
+
+		FLCRewindMath::SegmentCapsuleBatchIntersections(Start, End, Capsules, IgnoreIndex, Hits);
+		if (!TestEqual(TEXT("Number of capsules hit"), Hits.Num(), Expected.Num()))
+		{
+			return false;
+		}
+		for (int32 Hit = 0; Hit < Hits.Num(); Hit++)
+		{
+			if (!TestEqual(TEXT("Capsule hit, in order"), Hits[Hit].Index, Expected[Hit].Index) || !TestEqual(TEXT("Hit time"), Hits[Hit].Time, Expected[Hit].Time, 0.001f))
+			{
+				return false;
+			}
+		}
+
+		float Time = -1.f;
+		const int32 First = FLCRewindMath::SegmentCapsuleBatchIntersection(Start, End, Capsules, IgnoreIndex, Time);
+		if (!TestEqual(TEXT("First capsule hit"), First, Expected.Num() > 0 ? Expected[0].Index : (int32)INDEX_NONE)
+			|| (First != INDEX_NONE && !TestEqual(TEXT("First hit time"), Time, Expected[0].Time, 0.001f)))
+		{
+			return false;
+		}
+	}
+
+	TestTrue(TEXT("Most shots are not grazing"), NumCompared > 1800);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCRewindMathCharacterTest, "LagCompensation.Core.RewindMath.OverlappingCharacters", LCRewindMathTests::TestFlags)
+
+bool FLCRewindMathCharacterTest::RunTest(const FString& Parameters)
+{
+	// a wide capsule A the shot enters first, and B standing inside it; A's only hitbox is on its far side
+	FLCCapsuleBatch Capsules;
+	Capsules.SetNum(2);
+	Capsules.Set(0, FVector(400.f, 0.f, 100.f), 100.f, 150.f);
+	Capsules.Set(1, FVector(460.f, 0.f, 100.f), 34.f, 88.f);
+
+	TArray<FLCHitboxCapsule> Hitboxes;
+	Hitboxes.SetNum(2);
+	Hitboxes[0].Center = FVector(490.f, 0.f, 100.f);
+	Hitboxes[1].Center = FVector(460.f, 0.f, 100.f);
+	for (FLCHitboxCapsule& Sphere : Hitboxes)
+	{
+		Sphere.Axis = FVector(0.f, 0.f, 1.f);
+		Sphere.Radius = 5.f;
+		Sphere.HalfHeight = 5.f;
+		Sphere.Zone = 0;
+	}
+	const TArray<int32> HitboxStart = { 0, 1, 2 };
+
+	const FVector Start(0.f, 0.f, 100.f);
+	const FVector End(1000.f, 0.f, 100.f);
+	float Time = 0.f;
+	int32 Hitbox = INDEX_NONE;
+	TestEqual(TEXT("The earliest hitbox wins over the capsule entered first"), FLCRewindMath::SegmentCharacterIntersection(Start, End, Capsules, Hitboxes, HitboxStart, INDEX_NONE, Time, Hitbox), 1);
+	TestEqual(TEXT("B's hitbox"), Hitbox, 1);
+	TestEqual(TEXT("B's hitbox contact"), Time, 455.f / 1000.f, 0.0001f);
+
+	// with B's hitbox out of the way A's far one is hit
+	Hitboxes[1].Center.Z = 300.f;
+	TestEqual(TEXT("A behind a miss"), FLCRewindMath::SegmentCharacterIntersection(Start, End, Capsules, Hitboxes, HitboxStart, INDEX_NONE, Time, Hitbox), 0);
+	TestEqual(TEXT("A's hitbox"), Hitbox, 0);
+	TestEqual(TEXT("A's hitbox contact"), Time, 485.f / 1000.f, 0.0001f);
+	return true;
+}
+
+#endif
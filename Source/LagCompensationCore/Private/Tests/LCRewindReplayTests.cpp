@@ -0,0 +1,120 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCRewindLog.h"
+#include "LCRewindReplay.h"
+#include "HAL/FileManager.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/Paths.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace LCRewindReplayTests
+{
+	constexpr uint32 TestFlags = EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter;
+
+	/** A shot from the shooter along X at height Z, tested against the victim rewound to VictimX with a hitbox at HitboxZ. */
+	FLCRecordedShot MakeShot(float ServerTime, float Z, float VictimX, float HitboxZ, uint16 HitId)
+	{
+		FLCRecordedShot Shot;
+		Shot.ShooterId = 0;
+		Shot.VictimId = 1;
+		Shot.HitId = HitId;
+		Shot.ServerTime = ServerTime;
+		Shot.RewindTime = Shot.BucketTime = ServerTime - 0.1f;
+		Shot.StartLocation = FVector(0.f, 0.f, Z);
+		Shot.EndLocation = FVector(2000.f, 0.f, Z);
+		Shot.ClientPosition = FVector(VictimX, 0.f, 100.f);
+		Shot.bTracedWorld = HitId != MAX_uint16;
+
+		Shot.CapsuleIds.Add(1);
+		Shot.Capsules.SetNum(1);
+		Shot.Capsules.Set(0, FVector(VictimX, 0.f, 100.f), 34.f, 88.f);
+
+		FLCHitboxCapsule& Hitbox = Shot.Hitboxes.AddDefaulted_GetRef();
+		Hitbox.Center = FVector(VictimX, 0.f, HitboxZ);
+		Hitbox.Axis = FVector(0.f, 0.f, 1.f);
+		Hitbox.Radius = 10.f;
+		Hitbox.HalfHeight = 10.f;
+		Hitbox.Zone = 1;
+		Shot.HitboxStart = { 0, 1 };
+		return Shot;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCRewindReplayRecordedStateTest, "LagCompensation.Core.RewindReplay.RecordedState", LCRewindReplayTests::TestFlags)
+
+bool FLCRewindReplayRecordedStateTest::RunTest(const FString& Parameters)
+{
+	using namespace LCRewindReplayTests;
+
+	const FString Filename = FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("RewindReplayTest.lcrl"));
+	{
+		FLCRewindLogWriter Writer(1024);
+		if (!TestTrue(TEXT("Log created"), Writer.Open(Filename)))
+		{
+			return false;
+		}
+
+		Writer.AddCharacter(0, TEXT("Shooter"), 34.f, 88.f);
+		Writer.AddCharacter(1, TEXT("Victim"), 34.f, 88.f);
+		for (int32 Index = 0; Index < 60; Index++)
+		{
+			const float Time = Index / 60.f;
+			Writer.AddPosition(0, FSavedPosition(FVector::ZeroVector, FRotator::ZeroRotator, false, Time, Time, FVector::ZeroVector));
+			Writer.AddPosition(1, FSavedPosition(FVector(500.f, 0.f, 100.f), FRotator::ZeroRotator, false, Time, Time, FVector::ZeroVector));
+		}
+
+		// the server's bucket had the victim at 1000, not where its saved positions put it; the replay must use the bucket
+		Writer.AddShot(MakeShot(0.5f, 120.f, 1000.f, 120.f, 1));
+
+		// through the capsule but past the only hitbox
+		Writer.AddShot(MakeShot(0.6f, 60.f, 1000.f, 120.f, MAX_uint16));
+
+		// on the hitbox, but the server's trace found a wall in front of it
+		FLCRecordedShot Blocked = MakeShot(0.7f, 120.f, 1000.f, 120.f, MAX_uint16);
+		Blocked.bTracedWorld = true;
+		Blocked.BlockTime = 0.2f;
+		Writer.AddShot(Blocked);
+
+		Writer.Close();
+	}
+
+	FLCRewindReplayResult Result;
+	const bool bReplayed = FLCRewindReplay::Run(Filename, FLCRewindReplaySettings(), Result);
+	IFileManager::Get().Delete(*Filename);
+	if (!TestTrue(TEXT("Replayed"), bReplayed))
+	{
+		return false;
+	}
+
+	TestEqual(TEXT("Shots"), Result.NumShots, 3);
+	TestEqual(TEXT("Recorded hits"), Result.RecordedHits, 1);
+	TestEqual(TEXT("Replayed hits"), Result.ReplayedHits, 1);
+	TestEqual(TEXT("Changed verdicts"), Result.ChangedVerdicts, 0);
+	TestEqual(TEXT("Untraced hits"), Result.UntracedHits, 0);
+
+	// moving the recorded state by the victim's history keeps it in place, the victim stood still
+	FLCRewindReplaySettings Offset;
+	Offset.RewindOffset = 0.05f;
+	FLCRewindReplayResult OffsetResult;
+	{
+		FLCRewindLogWriter Writer(1024);
+		Writer.Open(Filename);
+		Writer.AddCharacter(0, TEXT("Shooter"), 34.f, 88.f);
+		Writer.AddCharacter(1, TEXT("Victim"), 34.f, 88.f);
+		for (int32 Index = 0; Index < 60; Index++)
+		{
+			const float Time = Index / 60.f;
+			Writer.AddPosition(1, FSavedPosition(FVector(1000.f, 0.f, 100.f), FRotator::ZeroRotator, false, Time, Time, FVector::ZeroVector));
+		}
+		Writer.AddShot(MakeShot(0.5f, 120.f, 1000.f, 120.f, 1));
+		Writer.Close();
+	}
+	FLCRewindReplay::Run(Filename, Offset, OffsetResult);
+	IFileManager::Get().Delete(*Filename);
+	TestEqual(TEXT("Offset replay keeps the hitbox hit"), OffsetResult.ChangedVerdicts, 0);
+	return true;
+}
+
+#endif
@@ -0,0 +1,427 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LCSavedPositionHistory.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace LCSavedPositionHistoryTests
+{
+	constexpr uint32 TestFlags = EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter;
+
+	/** Compact reconstruction bounds, see FLCSavedPositionHistory. Timestamps are two rounded tick counts. */
+	constexpr float PositionTolerance = 1.f / 16.f;
+	constexpr float TimeTolerance = 0.0002f;
+
+	FSavedPosition MakePosition(const FVector& Position, float Time, float TimeStamp, bool bTeleported = false)
+	{
+		return FSavedPosition(Position, FRotator(0.f, 90.f, 0.f), bTeleported, Time, TimeStamp, FVector(300.f, 0.f, 0.f));
+	}
+
+	/** Two seconds of 60 Hz samples along a path, with the client move timestamps jittering against server time. */
+	TArray<FSavedPosition> MakePath(TFunctionRef<FSavedPosition(float)> Sample)
+	{
+		FRandomStream Random(42);
+		TArray<FSavedPosition> Path;
+		for (int32 Index = 0; Index < 120; Index++)
+		{
+			FSavedPosition& Position = Path.Add_GetRef(Sample(Index / 60.f));
+			Position.TimeStamp = 3.f + Position.Time + Random.FRandRange(0.f, 0.004f);
+		}
+		return Path;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCSavedPositionHistoryPositionAtTimeTest, "LagCompensation.Core.SavedPositionHistory.GetPositionAtTime",
+	LCSavedPositionHistoryTests::TestFlags)
+
+bool FLCSavedPositionHistoryPositionAtTimeTest::RunTest(const FString& Parameters)
+{
+	using namespace LCSavedPositionHistoryTests;
+
+	for (const bool bCompact : { false, true })
+	{
+		FLCSavedPositionHistory History;
+		History.Reserve(16, bCompact);
+		TestEqual(TEXT("Empty history"), History.GetPositionAtTime(1.f), FVector::ZeroVector);
+
+		History.Add(MakePosition(FVector(0.f, 0.f, 0.f), 0.f, 0.f));
+		History.Add(MakePosition(FVector(100.f, 0.f, 0.f), 1.f, 1.f));
+		History.Add(MakePosition(FVector(100.f, 100.f, 0.f), 2.f, 2.f));
+		History.Add(MakePosition(FVector(1000.f, 0.f, 0.f), 3.f, 3.f, true));
+
+		TestEqual(TEXT("Between entries"), History.GetPositionAtTime(0.5f), FVector(50.f, 0.f, 0.f), PositionTolerance);
+		TestEqual(TEXT("Second segment"), History.GetPositionAtTime(1.25f), FVector(100.f, 25.f, 0.f), PositionTolerance);
+		TestEqual(TEXT("On an entry"), History.GetPositionAtTime(1.f), FVector(100.f, 0.f, 0.f), PositionTolerance);
+		TestEqual(TEXT("Before the oldest entry"), History.GetPositionAtTime(-1.f), FVector::ZeroVector, PositionTolerance);
+		TestEqual(TEXT("After the newest entry"), History.GetPositionAtTime(5.f), FVector(1000.f, 0.f, 0.f), PositionTolerance);
+		TestEqual(TEXT("No path into a teleport"), History.GetPositionAtTime(2.5f), FVector(100.f, 100.f, 0.f), PositionTolerance);
+
+		// the hint gives the same answers, whether it is right, stale or out of range
+		int32 Hint = INDEX_NONE;
+		TestEqual(TEXT("Hinted lookup"), History.GetPositionAtTime(1.5f, &Hint), FVector(100.f, 50.f, 0.f), PositionTolerance);
+		TestEqual(TEXT("Hint is the entry before the time"), Hint, 1);
+		TestEqual(TEXT("Hinted lookup, same time"), History.GetPositionAtTime(1.5f, &Hint), FVector(100.f, 50.f, 0.f), PositionTolerance);
+		TestEqual(TEXT("Hinted lookup, stale hint"), History.GetPositionAtTime(0.5f, &Hint), FVector(50.f, 0.f, 0.f), PositionTolerance);
+		Hint = 42;
+		TestEqual(TEXT("Hinted lookup, hint out of range"), History.GetPositionAtTime(1.5f, &Hint), FVector(100.f, 50.f, 0.f), PositionTolerance);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCSavedPositionHistoryFindClosestTest, "LagCompensation.Core.SavedPositionHistory.FindClosest",
+	LCSavedPositionHistoryTests::TestFlags)
+
+bool FLCSavedPositionHistoryFindClosestTest::RunTest(const FString& Parameters)
+{
+	using namespace LCSavedPositionHistoryTests;
+
+	for (const bool bCompact : { false, true })
+	{
+		FLCSavedPositionHistory History;
+		History.Reserve(64, bCompact);
+		TestEqual(TEXT("Empty history"), History.FindClosest(FVector::ZeroVector), (int32)INDEX_NONE);
+
+		// a line along X, an entry every 10 cm
+		for (int32 Index = 0; Index < 40; Index++)
+		{
+			History.Add(MakePosition(FVector(Index * 10.f, 0.f, 0.f), Index * 0.1f, Index * 0.1f));
+		}
+
+		TestEqual(TEXT("Nearest entry"), History.FindClosest(FVector(123.f, 50.f, 0.f)), 12);
+		TestEqual(TEXT("Past the end"), History.FindClosest(FVector(1000.f, 0.f, 0.f)), 39);
+		TestEqual(TEXT("Before the start"), History.FindClosest(FVector(-1000.f, 0.f, 0.f)), 0);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCSavedPositionHistoryFindClosestTimeTest, "LagCompensation.Core.SavedPositionHistory.FindClosestTime",
+	LCSavedPositionHistoryTests::TestFlags)
+
+bool FLCSavedPositionHistoryFindClosestTimeTest::RunTest(const FString& Parameters)
+{
+	using namespace LCSavedPositionHistoryTests;
+
+	// a circle of 500 cm at 600 cm/s sampled at 10 Hz, 60 cm chords that miss the arc by 0.9 cm
+	const auto Circle = [](float Time, float Radius)
+	{
+		const float Angle = 1.2f * Time;
+		return FSavedPosition(FVector(FMath::Cos(Angle), FMath::Sin(Angle), 0.f) * Radius, FRotator::ZeroRotator, false, Time,
+			Time, FVector(-FMath::Sin(Angle), FMath::Cos(Angle), 0.f) * 600.f);
+	};
+
+	for (const bool bCompact : { false, true })
+	{
+		for (const bool bHermite : { false, true })
+		{
+			FLCSavedPositionHistory History;
+			History.Reserve(32, bCompact);
+			History.SetHermiteInterpolation(bHermite);
+			for (int32 Index = 0; Index < 20; Index++)
+			{
+				History.Add(Circle(Index * 0.1f, 500.f));
+			}
+
+			const FString What = FString::Printf(TEXT("%s%s"), bCompact ? TEXT("Compact") : TEXT("Full"), bHermite ? TEXT(", Hermite") : TEXT(""));
+			const float Tolerance = bCompact ? 4.f * PositionTolerance : 0.05f;
+			float MaxCurveError = 0.f;
+			float MaxArcError = 0.f;
+			float MaxTimeError = 0.f;
+			for (int32 Query = 1; Query < 37; Query++)
+			{
+				const float Time = Query * 0.05f + 0.013f;
+				FLCClosestSavedPosition Closest;
+				if (!TestTrue(FString::Printf(TEXT("%s: found"), *What), History.FindClosestTime(Circle(Time, 550.f).Position, Closest, Time - 0.1f, Time + 0.1f)))
+				{
+					break;
+				}
+
+				// the answer lies on the path GetPositionAtTime follows, whichever it is
+				MaxCurveError = FMath::Max(MaxCurveError, FVector::Dist(Closest.Position, History.GetPositionAtTime(Closest.Time)));
+
+				// 50 cm outside the arc: the Hermite curve follows the arc, the chords run inside it
+				MaxArcError = FMath::Max(MaxArcError, FMath::Abs(FMath::Sqrt(Closest.DistanceSquared) - 50.f));
+				MaxTimeError = FMath::Max(MaxTimeError, FMath::Abs(Closest.Time - Time));
+			}
+			TestTrue(FString::Printf(TEXT("%s: on the interpolated path, off by %.3f cm"), *What, MaxCurveError), MaxCurveError <= Tolerance);
+			TestTrue(FString::Printf(TEXT("%s: time off by %.4f s"), *What, MaxTimeError), MaxTimeError <= 0.002f + TimeTolerance);
+			if (bHermite)
+			{
+				TestTrue(FString::Printf(TEXT("%s: on the arc, off by %.3f cm"), *What, MaxArcError), MaxArcError <= Tolerance);
+			}
+			else
+			{
+				TestTrue(FString::Printf(TEXT("%s: inside the arc by %.3f cm"), *What, MaxArcError), MaxArcError > 0.5f);
+			}
+		}
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCSavedPositionHistoryPopOlderThanTest, "LagCompensation.Core.SavedPositionHistory.PopOlderThan",
+	LCSavedPositionHistoryTests::TestFlags)
+
+bool FLCSavedPositionHistoryPopOlderThanTest::RunTest(const FString& Parameters)
+{
+	using namespace LCSavedPositionHistoryTests;
+
+	FLCSavedPositionHistory History;
+	History.Reserve(16);
+	for (int32 Index = 0; Index < 10; Index++)
+	{
+		History.Add(MakePosition(FVector(Index * 10.f, 0.f, 0.f), (float)Index, (float)Index));
+	}
+
+	// the newest entry older than the time stays, the position at the time is interpolated from it
+	History.PopOlderThan(4.5f);
+	TestEqual(TEXT("Entries left"), History.Num(), 6);
+	TestEqual(TEXT("Oldest entry kept for interpolation"), History.GetTime(0), 4.f);
+	TestEqual(TEXT("Position at the cutoff"), History.GetPositionAtTime(4.5f), FVector(45.f, 0.f, 0.f), PositionTolerance);
+
+	History.PopOlderThan(5.5f);
+	TestEqual(TEXT("Oldest entry after a second pop"), History.GetTime(0), 5.f);
+
+	History.PopOlderThan(100.f);
+	TestEqual(TEXT("The newest entry is never popped"), History.Num(), 1);
+	TestEqual(TEXT("Newest entry"), History.GetTime(0), 9.f);
+	TestEqual(TEXT("Popping is not overwriting"), History.GetNumOverwritten(), 0);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCSavedPositionHistoryRingWrapTest, "LagCompensation.Core.SavedPositionHistory.RingWrap",
+	LCSavedPositionHistoryTests::TestFlags)
+
+bool FLCSavedPositionHistoryRingWrapTest::RunTest(const FString& Parameters)
+{
+	using namespace LCSavedPositionHistoryTests;
+
+	for (const bool bCompact : { false, true })
+	{
+		FLCSavedPositionHistory History;
+		History.Reserve(5, bCompact);
+		TestEqual(TEXT("Capacity rounds up to a power of two"), History.Capacity(), 8);
+
+		for (int32 Index = 0; Index < 20; Index++)
+		{
+			History.Add(MakePosition(FVector(Index * 10.f, 0.f, 0.f), (float)Index, (float)Index));
+		}
+
+		// the oldest entries were overwritten, the rest is still oldest first across the end of the storage
+		TestEqual(TEXT("Full history"), History.Num(), 8);
+		TestEqual(TEXT("Overwritten entries"), History.GetNumOverwritten(), 12);
+		for (int32 Index = 0; Index < History.Num(); Index++)
+		{
+			TestEqual(TEXT("Entry time"), History.GetTime(Index), 12.f + Index);
+		}
+		TestEqual(TEXT("Last"), History.Last().Time, 19.f);
+		TestEqual(TEXT("Lookup across the wrap"), History.FindLastBefore(15.5f), 3);
+		TestEqual(TEXT("Interpolation across the wrap"), History.GetPositionAtTime(15.5f), FVector(155.f, 0.f, 0.f), PositionTolerance);
+
+		float Time;
+		TestFalse(TEXT("Overwritten timestamps are gone"), History.MapTimeStampToTime(5.f, Time));
+		TestTrue(TEXT("Live timestamps map"), History.MapTimeStampToTime(16.f, Time) && Time == 16.f);
+
+		// emptied and refilled, the overwrite count starts over
+		History.Reset();
+		History.Add(MakePosition(FVector::ZeroVector, 100.f, 100.f));
+		TestEqual(TEXT("Reset history"), History.Num(), 1);
+		TestEqual(TEXT("Reset overwrite count"), History.GetNumOverwritten(), 0);
+		TestEqual(TEXT("Entry after a reset"), History.GetTime(0), 100.f);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCSavedPositionHistoryDecimationTest, "LagCompensation.Core.SavedPositionHistory.Decimation",
+	LCSavedPositionHistoryTests::TestFlags)
+
+bool FLCSavedPositionHistoryDecimationTest::RunTest(const FString& Parameters)
+{
+	using namespace LCSavedPositionHistoryTests;
+
+	const float Tolerance = 1.f;
+
+	struct FCase
+	{
+		const TCHAR* Name;
+		TArray<FSavedPosition> Path;
+
+		/** Most entries a history of the path may keep, it must at least drop something. */
+		int32 MaxEntries;
+	};
+	TArray<FCase> Cases;
+
+	Cases.Add({ TEXT("Straight"), MakePath([](float Time)
+	{
+		return FSavedPosition(FVector(600.f * Time, 100.f, 0.f), FRotator::ZeroRotator, false, Time, 0.f, FVector(600.f, 0.f, 0.f));
+	}), 16 });
+
+	// a circle of 500 cm at 600 cm/s, a turn of 1.2 radians per second
+	Cases.Add({ TEXT("Curved"), MakePath([](float Time)
+	{
+		const float Angle = 1.2f * Time;
+		return FSavedPosition(FVector(FMath::Cos(Angle), FMath::Sin(Angle), 0.f) * 500.f, FRotator::ZeroRotator, false, Time,
+			0.f, FVector(-FMath::Sin(Angle), FMath::Cos(Angle), 0.f) * 600.f);
+	}), 40 });
+
+	// running straight, then teleported across the map halfway through
+	Cases.Add({ TEXT("Teleport"), MakePath([](float Time)
+	{
+		const bool bAfter = Time >= 1.f;
+		const FVector Start = bAfter ? FVector(10000.f, 0.f, 0.f) : FVector::ZeroVector;
+		return FSavedPosition(Start + FVector(0.f, 600.f * Time, 0.f), FRotator::ZeroRotator, Time == 1.f, Time, 0.f, FVector(0.f, 600.f, 0.f));
+	}), 32 });
+
+	for (const FCase& Case : Cases)
+	{
+		for (const bool bCompact : { false, true })
+		{
+			for (const bool bHermite : { false, true })
+			{
+				FLCSavedPositionHistory History;
+				History.Reserve(Case.Path.Num(), bCompact);
+				History.SetDecimationTolerance(Tolerance);
+				History.SetHermiteInterpolation(bHermite);
+				for (const FSavedPosition& Position : Case.Path)
+				{
+					History.Add(Position);
+				}
+
+				const FString What = FString::Printf(TEXT("%s%s%s"), Case.Name, bCompact ? TEXT(", compact") : TEXT(""), bHermite ? TEXT(", Hermite") : TEXT(""));
+				TestTrue(FString::Printf(TEXT("%s: decimated"), *What), History.Num() <= Case.MaxEntries);
+
+				// every sample, kept or not, is rebuilt within the tolerance; in compact mode the entries the path runs
+				// between and the dropped sample it was measured against are each rounded on every axis
+				const float MaxAllowedError = Tolerance + (bCompact ? 4.f * PositionTolerance : 0.01f);
+				float MaxError = 0.f;
+				bool bTimeStampsMap = true;
+				for (const FSavedPosition& Position : Case.Path)
+				{
+					MaxError = FMath::Max(MaxError, FVector::Dist(History.GetPositionAtTime(Position.Time), Position.Position));
+
+					// and the move timestamps of dropped samples still map to their own server time
+					float Time;
+					bTimeStampsMap &= History.MapTimeStampToTime(Position.TimeStamp, Time) && Time == Position.Time;
+				}
+				TestTrue(FString::Printf(TEXT("%s: error %.3f cm within the tolerance"), *What, MaxError), MaxError <= MaxAllowedError);
+				TestTrue(FString::Printf(TEXT("%s: timestamps map"), *What), bTimeStampsMap);
+			}
+		}
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCSavedPositionHistoryCompactBlocksTest, "LagCompensation.Core.SavedPositionHistory.CompactBlockBoundaries",
+	LCSavedPositionHistoryTests::TestFlags)
+
+bool FLCSavedPositionHistoryCompactBlocksTest::RunTest(const FString& Parameters)
+{
+	using namespace LCSavedPositionHistoryTests;
+
+	// a curved path over several laps of the ring, so blocks are re-anchored while older entries are still live
+	FLCSavedPositionHistory History;
+	History.Reserve(32, true);
+	TArray<FSavedPosition> Added;
+	for (int32 Index = 0; Index < 100; Index++)
+	{
+		const float Time = Index / 60.f;
+		Added.Add(MakePosition(FVector(FMath::Cos(Time) * 500.f, FMath::Sin(Time) * 500.f, 90.f + Index * 0.3f), Time, Time + 0.5f));
+		History.Add(Added.Last());
+
+		const int32 Oldest = Added.Num() - History.Num();
+		for (int32 Entry = 0; Entry < History.Num(); Entry++)
+		{
+			const FSavedPosition Expected = Added[Oldest + Entry];
+			const FSavedPosition Actual = History[Entry];
+			if (!TestEqual(TEXT("Position survives re-anchoring"), Actual.Position, Expected.Position, PositionTolerance)
+				|| !TestEqual(TEXT("Time survives re-anchoring"), Actual.Time, Expected.Time, TimeTolerance)
+				|| !TestEqual(TEXT("TimeStamp survives re-anchoring"), Actual.TimeStamp, Expected.TimeStamp, TimeTolerance))
+			{
+				return false;
+			}
+		}
+	}
+
+	TestEqual(TEXT("Full history keeps its capacity"), History.Num(), 32);
+	TestEqual(TEXT("Every entry past the capacity overwrote one"), History.GetNumOverwritten(), 100 - 32);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCSavedPositionHistoryOverflowPoolTest, "LagCompensation.Core.SavedPositionHistory.OverflowPool",
+	LCSavedPositionHistoryTests::TestFlags)
+
+bool FLCSavedPositionHistoryOverflowPoolTest::RunTest(const FString& Parameters)
+{
+	using namespace LCSavedPositionHistoryTests;
+
+	// 100 m apart, every entry but the block anchors is too far from its anchor for the encoding
+	FLCSavedPositionHistory History;
+	History.Reserve(64, true);
+	const SIZE_T AllocatedSize = History.GetAllocatedSize();
+
+	TArray<FSavedPosition> Added;
+	for (int32 Index = 0; Index < 200; Index++)
+	{
+		Added.Add(MakePosition(FVector(Index * 10000.f, 0.f, 0.f), Index * 0.125f, Index * 0.125f, true));
+		History.Add(Added.Last());
+
+		if (!TestEqual(TEXT("Every added entry is kept or counted as overwritten"), History.Num() + History.GetNumOverwritten(), Added.Num()))
+		{
+			return false;
+		}
+
+		// whatever is left is the newest entries, exactly as added
+		const int32 Oldest = Added.Num() - History.Num();
+		for (int32 Entry = 0; Entry < History.Num(); Entry++)
+		{
+			if (!TestEqual(TEXT("Overflowed position"), History.GetPosition(Entry), Added[Oldest + Entry].Position, PositionTolerance)
+				|| !TestEqual(TEXT("Overflowed time"), History.GetTime(Entry), Added[Oldest + Entry].Time, TimeTolerance))
+			{
+				return false;
+			}
+		}
+	}
+
+	TestTrue(TEXT("A full overflow pool drops the oldest entries"), History.Num() < 64);
+	TestEqual(TEXT("The overflow pool never grows"), History.GetAllocatedSize(), AllocatedSize);
+
+	// after a reset every pool slot is available again
+	History.Reset();
+	for (int32 Index = 0; Index < 16; Index++)
+	{
+		History.Add(MakePosition(FVector(Index * 10000.f, 0.f, 0.f), Index * 0.125f, Index * 0.125f, true));
+	}
+	TestEqual(TEXT("Reset frees the overflow pool"), History.Num(), 16);
+	TestEqual(TEXT("Reset clears the overwrite count"), History.GetNumOverwritten(), 0);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLCSavedPositionHistoryLongUptimeTest, "LagCompensation.Core.SavedPositionHistory.LongUptime",
+	LCSavedPositionHistoryTests::TestFlags)
+
+bool FLCSavedPositionHistoryLongUptimeTest::RunTest(const FString& Parameters)
+{
+	using namespace LCSavedPositionHistoryTests;
+
+	// 69 hours of server time is 2.5e9 ticks of 0.1 ms, past what 32 bit anchors can hold
+	const float BaseTime = 250000.f;
+	FLCSavedPositionHistory History;
+	History.Reserve(64, true);
+	for (int32 Index = 0; Index < 40; Index++)
+	{
+		History.Add(MakePosition(FVector(Index * 10.f, 0.f, 0.f), BaseTime + Index * 0.125f, Index * 0.125f));
+	}
+
+	for (int32 Index = 0; Index < History.Num(); Index++)
+	{
+		TestEqual(TEXT("Time past 59 hours"), History.GetTime(Index), BaseTime + Index * 0.125f);
+		TestEqual(TEXT("TimeStamp far from the time"), History[Index].TimeStamp, Index * 0.125f);
+	}
+
+	float Time = 0.f;
+	TestTrue(TEXT("Timestamps map back to server time"), History.MapTimeStampToTime(2.5f, Time));
+	TestEqual(TEXT("Mapped server time"), Time, BaseTime + 2.5f);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
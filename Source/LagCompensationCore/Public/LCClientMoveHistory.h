@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Ring buffer of the client moves the server performed: timestamp, server time and location after each, oldest first. */
+class LAGCOMPENSATIONCORE_API FLCClientMoveHistory
+{
+public:
+	FLCClientMoveHistory() : Head(0), Count(0), IndexMask(0) {}
+
+	/** Allocates room for at least MinCapacity moves (rounded up to a power of two) and clears the history. */
+	void Reserve(int32 MinCapacity);
+
+	void Reset();
+
+	/** Records a move performed at server time Time. A move with the newest timestamp again is ignored. */
+	void Add(float TimeStamp, float Time, const FVector& Location);
+
+	/**
+	 * Server time and location of the move with TimeStamp. A move the client combined into a later one is not
+	 * recorded itself, its timestamp is interpolated between the moves around it.
+	 * @return false if TimeStamp is newer than every move, or older than the oldest one or a timestamp reset
+	 */
+	bool Find(float TimeStamp, float& OutTime, FVector& OutLocation) const;
+
+	/** Whether TimeStamp is newer than every recorded move, so the move may still be on its way. */
+	bool IsAfterNewest(float TimeStamp) const { return Count == 0 || TimeStamp > GetMove(Count - 1).TimeStamp; }
+
+	int32 Num() const { return Count; }
+
+	SIZE_T GetAllocatedSize() const { return Moves.GetAllocatedSize(); }
+
+private:
+	struct FMove
+	{
+		float TimeStamp;
+		float Time;
+		FVector Location;
+	};
+
+	/** Move Index moves after the oldest. */
+	const FMove& GetMove(int32 Index) const { return Moves[(Head + Index) & IndexMask]; }
+
+	TArray<FMove> Moves;
+
+	/** Physical index of the oldest move. */
+	int32 Head;
+
+	int32 Count;
+
+	/** Capacity - 1, capacity is a power of two. */
+	int32 IndexMask;
+};
@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Server-side estimate of a client's clock offset and one-way delay from the timestamps of its moves. */
+class LAGCOMPENSATIONCORE_API FLCNetTimingEstimator
+{
+public:
+	explicit FLCNetTimingEstimator(int32 InWindowSize = 256);
+
+	/** Adds a move. A client timestamp older than the previous one means the client reset its clock, which restarts the window. */
+	void AddSample(float ClientTimeStamp, float ServerTime);
+
+	/** Sets the round trip time measured on the connection, in seconds. */
+	void SetRoundTripTime(float InRoundTripTime) { RoundTripTime = FMath::Max(InRoundTripTime, 0.f); }
+
+	void Reset();
+
+	int32 GetNumSamples() const { return NumSamples; }
+
+	/** Server time minus client time. */
+	float GetClockOffset() const;
+
+	/** Delay of a client move on its way to the server, in seconds, at Percentile (0 to 1) of the window. */
+	float GetOneWayDelay(float Percentile) const;
+
+	/** Jitter of the one-way delay at Percentile (0 to 1) of the window, in seconds. */
+	float GetJitter(float Percentile) const;
+
+	/** Converts a client timestamp to server time. */
+	float ClientToServerTime(float ClientTimeStamp) const { return ClientTimeStamp + GetClockOffset(); }
+
+private:
+	/** Sorts the window into SortedOffsets if samples were added since the last query. */
+	void UpdateSorted() const;
+
+	/** ServerTime - ClientTimeStamp of the most recent moves, ring buffer. */
+	TArray<float> Offsets;
+
+	int32 NextSample;
+	int32 NumSamples;
+
+	float LastClientTimeStamp;
+	float RoundTripTime;
+
+	mutable TArray<float> SortedOffsets;
+	mutable bool bSortedDirty;
+};
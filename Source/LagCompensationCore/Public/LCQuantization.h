@@ -0,0 +1,26 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Fixed point and unit vector packing used to keep rewind data small. */
+struct LAGCOMPENSATIONCORE_API FLCQuantization
+{
+	/** Rounds Value * Scale to the nearest int16, clamping out of range values. */
+	static FORCEINLINE int16 ToFixed16(float Value, float Scale)
+	{
+		return (int16)FMath::Clamp(FMath::RoundToInt(Value * Scale), -32767, 32767);
+	}
+
+	static FORCEINLINE float FromFixed16(int16 Value, float InvScale)
+	{
+		return Value * InvScale;
+	}
+
+	/** Packs a unit vector into two int16 using the octahedral mapping. */
+	static void EncodeUnitVector(const FVector& Vector, int16& OutX, int16& OutY);
+
+	/** Unpacks a unit vector packed by EncodeUnitVector. */
+	static FVector DecodeUnitVector(int16 X, int16 Y);
+};
@@ -0,0 +1,186 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LCRewindMath.h"
+#include "LCSavedPositionHistory.h"
+
+class IFileHandle;
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/** A shot as the server received and judged it. Character ids are the ones given to FLCRewindLogWriter::AddCharacter. */
+struct FLCRecordedShot
+{
+	FLCRecordedShot()
+		: ShooterId(0), VictimId(MAX_uint16), HitId(MAX_uint16), ServerTime(0.f), ClientTimeStamp(0.f), PredictionAmount(0.f), RewindTime(0.f)
+		, StartLocation(FVector::ZeroVector), EndLocation(FVector::ZeroVector), ClientPosition(FVector::ZeroVector), BucketTime(0.f), BlockTime(1.f), bTracedWorld(false)
+	{
+	}
+
+	uint16 ShooterId;
+
+	/** Character the client said it hit, MAX_uint16 for none. */
+	uint16 VictimId;
+
+	/** Character the server hit, MAX_uint16 for none. */
+	uint16 HitId;
+
+	/** Server time the shot arrived at. */
+	float ServerTime;
+
+	float ClientTimeStamp;
+	float PredictionAmount;
+
+	/** Server time the shot was validated at. */
+	float RewindTime;
+
+	FVector StartLocation;
+	FVector EndLocation;
+
+	/** Victim location on the shooting client. */
+	FVector ClientPosition;
+
+	/** RewindTime rounded to the validation bucket, the time the characters below were rewound to. */
+	float BucketTime;
+
+	/** Fraction of the segment where world geometry blocked the shot, 1 if nothing did or the world was not traced. */
+	float BlockTime;
+
+	/** The server only traces the world for shots that hit a character. */
+	bool bTracedWorld;
+
+	/**
+	 * The rewound characters the server tested the shot against, with their hitboxes as
+	 * FLCRewindMath::SegmentCharacterIntersection takes them (HitboxStart is empty if hitboxes were not recorded).
+	 */
+	TArray<uint16> CapsuleIds;
+	FLCCapsuleBatch Capsules;
+	TArray<FLCHitboxCapsule> Hitboxes;
+	TArray<int32> HitboxStart;
+};
+
+enum class ELCRewindLogRecord : uint8
+{
+	/** A character appeared: id, name, capsule radius and half height. */
+	Character,
+
+	/** A saved position of a character. */
+	Position,
+
+	/** A validated shot and the rewound characters it was tested against. */
+	Shot,
+};
+
+/** One record of a rewind log, only the fields of its Type are set. */
+struct FLCRewindLogRecord
+{
+	ELCRewindLogRecord Type;
+	uint16 Id;
+
+	FString Name;
+	float Radius;
+	float HalfHeight;
+
+	FSavedPosition Position;
+
+	FLCRecordedShot Shot;
+};
+
+/** Append-only binary log of server saved positions and shots, written in self-contained chunks. */
+class LAGCOMPENSATIONCORE_API FLCRewindLogWriter
+{
+public:
+	explicit FLCRewindLogWriter(int32 InChunkSize = 64 * 1024);
+	~FLCRewindLogWriter();
+
+	/** Creates Filename, overwriting it. */
+	bool Open(const FString& Filename);
+
+	/** Writes the last chunk and the index. */
+	void Close();
+
+	bool IsOpen() const { return File.IsValid(); }
+
+	void AddCharacter(uint16 Id, const FString& Name, float Radius, float HalfHeight);
+	void AddPosition(uint16 Id, const FSavedPosition& Position);
+	void AddShot(const FLCRecordedShot& Shot);
+
+	/** Bytes written to the file so far. */
+	int64 GetFileSize() const { return FileSize; }
+
+private:
+	/** Starts a new chunk when the current one is full. Time is the time of the record about to be added. */
+	void BeginRecord(float Time);
+
+	void WriteCharacter(uint16 Id);
+
+	void FlushChunk();
+
+	struct FCharacterInfo
+	{
+		FString Name;
+		float Radius;
+		float HalfHeight;
+	};
+
+	struct FChunkIndexEntry
+	{
+		int64 Offset;
+		float StartTime;
+		float EndTime;
+	};
+
+	TUniquePtr<IFileHandle> File;
+	int64 FileSize;
+
+	int32 ChunkSize;
+	TArray<uint8> ChunkData;
+	int32 ChunkRecords;
+	float ChunkStartTime;
+	float ChunkEndTime;
+
+	TMap<uint16, FCharacterInfo> Characters;
+	TArray<FChunkIndexEntry> Index;
+};
+
+/** Reads a rewind log through a memory mapping of the file. */
+class LAGCOMPENSATIONCORE_API FLCRewindLogReader
+{
+public:
+	FLCRewindLogReader();
+	~FLCRewindLogReader();
+
+	bool Open(const FString& Filename);
+	void Close();
+
+	int32 GetNumChunks() const { return Chunks.Num(); }
+	float GetChunkStartTime(int32 Chunk) const { return Chunks[Chunk].StartTime; }
+	float GetChunkEndTime(int32 Chunk) const { return Chunks[Chunk].EndTime; }
+
+	/** First chunk with records at or after Time, GetNumChunks() if there is none. */
+	int32 FindChunk(float Time) const;
+
+	/** Calls Visitor with every record of Chunk, in the order they were written. */
+	bool ReadChunk(int32 Chunk, TFunctionRef<void(const FLCRewindLogRecord&)> Visitor) const;
+
+private:
+	/** Finds the chunks from the index, or from the chunk headers if the log was not closed. */
+	void BuildIndex();
+
+	struct FChunk
+	{
+		int64 Offset;
+		int64 Size;
+		float StartTime;
+		float EndTime;
+	};
+
+	TUniquePtr<IMappedFileHandle> MappedFile;
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+	const uint8* Data;
+	int64 DataSize;
+
+	TArray<FChunk> Chunks;
+};
@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Vertical capsules in structure-of-arrays layout, as consumed by the batch intersection kernel. */
+struct LAGCOMPENSATIONCORE_API FLCCapsuleBatch
+{
+	TArray<float> CenterX;
+	TArray<float> CenterY;
+	TArray<float> CenterZ;
+	TArray<float> Radius;
+	TArray<float> HalfHeight;
+
+	int32 Num() const { return CenterX.Num(); }
+
+	/** Resizes all columns, contents are left uninitialized. */
+	void SetNum(int32 NewNum);
+
+	void Set(int32 Index, const FVector& Center, float InRadius, float InHalfHeight)
+	{
+		CenterX[Index] = Center.X;
+		CenterY[Index] = Center.Y;
+		CenterZ[Index] = Center.Z;
+		Radius[Index] = InRadius;
+		HalfHeight[Index] = InHalfHeight;
+	}
+
+	FVector GetCenter(int32 Index) const { return FVector(CenterX[Index], CenterY[Index], CenterZ[Index]); }
+};
+
+/** A capsule of a batch touched by a segment, Time is the fraction of the segment at the first point of contact. */
+struct FLCCapsuleHit
+{
+	int32 Index;
+	float Time;
+};
+
+/** A capsule attached to a bone, rewound to world space. */
+struct FLCHitboxCapsule
+{
+	FVector Center;
+
+	/** Unit axis of the capsule. */
+	FVector Axis;
+
+	float Radius;
+	float HalfHeight;
+
+	/** Part of the body, an ELCHitZone of the game module. */
+	uint8 Zone;
+};
+
+/**
+ * Geometry used to validate shots against rewound characters without touching the physics scene.
+ * Character capsules are always upright, so capsules here are vertical unless an axis is given, described
+ * by their center, radius and half height (including the hemispheres, same as UCapsuleComponent).
+ */
+struct LAGCOMPENSATIONCORE_API FLCRewindMath
+{
+	/**
+	 * Intersects the segment Start-End with a vertical capsule.
+	 * @param OutTime	fraction of the segment at the first point of contact, 0 if Start is inside the capsule
+	 * @return true if the segment touches the capsule
+	 */
+	static bool SegmentCapsuleIntersection(const FVector& Start, const FVector& End, const FVector& Center, float Radius, float HalfHeight, float& OutTime);
+
+	/** Same as SegmentCapsuleIntersection for a capsule along the unit vector Axis, such as a bone hitbox. */
+	static bool SegmentOrientedCapsuleIntersection(const FVector& Start, const FVector& End, const FVector& Center, const FVector& Axis, float Radius, float HalfHeight, float& OutTime);
+
+	/**
+	 * Finds the capsule of the batch that the segment Start-End touches first.
+	 * Capsules are tested four at a time with the platform vector registers (SSE or NEON, scalar where the
+	 * platform has no vector intrinsics); the remainder goes through SegmentCapsuleIntersection.
+	 * @param IgnoreIndex	capsule that is never reported as hit (usually the shooter's own)
+	 * @param OutTime		fraction of the segment at the first point of contact
+	 * @return index of the capsule hit first, or INDEX_NONE
+	 */
+	static int32 SegmentCapsuleBatchIntersection(const FVector& Start, const FVector& End, const FLCCapsuleBatch& Capsules, int32 IgnoreIndex, float& OutTime);
+
+	/**
+	 * Same as SegmentCapsuleBatchIntersection, but reports every capsule the segment touches, first contact first.
+	 * Used when the capsule hit first can turn out to be a miss, such as when it is refined against hitboxes.
+	 * @return number of capsules hit
+	 */
+	static int32 SegmentCapsuleBatchIntersections(const FVector& Start, const FVector& End, const FLCCapsuleBatch& Capsules, int32 IgnoreIndex, TArray<FLCCapsuleHit>& OutHits);
+
+	/**
+	 * Tests a shot against rewound characters the way the server validates it. Without hitboxes (HitboxStart empty)
+	 * the capsule touched first is hit. Otherwise the capsules the segment touches are refined against their
+	 * hitboxes [HitboxStart[i], HitboxStart[i + 1]) and the earliest hitbox hit wins, whichever capsule the shot
+	 * entered first; a capsule without hitboxes is hit by itself.
+	 * @param OutTime	fraction of the segment at the point of contact
+	 * @param OutHitbox	index of the hitbox hit, INDEX_NONE if a capsule was hit
+	 * @return index of the capsule of the character hit, or INDEX_NONE
+	 */
+	static int32 SegmentCharacterIntersection(const FVector& Start, const FVector& End, const FLCCapsuleBatch& Capsules, const TArray<FLCHitboxCapsule>& Hitboxes,
+		const TArray<int32>& HitboxStart, int32 IgnoreIndex, float& OutTime, int32& OutHitbox);
+
+	/** Intersects the segment Start + t * Delta, t in [0, 1], with a sphere. Same conventions as above. */
+	static bool SegmentSphereIntersection(const FVector& Start, const FVector& Delta, const FVector& Center, float Radius, float& OutTime);
+};
@@ -0,0 +1,73 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** What a replay changes relative to the recorded match. */
+struct FLCRewindReplaySettings
+{
+	FLCRewindReplaySettings()
+		: FromTime(0.f), ToTime(MAX_flt), RewindOffset(0.f), MaxSavedPositionAge(1.f), PositionSampleRate(60.f), bCompactSavedPositions(false), SavedPositionTolerance(1.f), bHermiteSavedPositions(true)
+	{
+	}
+
+	/** Server time range of the shots to replay. */
+	float FromTime;
+	float ToTime;
+
+	/**
+	 * Added to the recorded rewind time of every shot, in seconds. 0 replays the rewound state the server
+	 * recorded for each shot as it is.
+	 */
+	float RewindOffset;
+
+	/** Same as the character settings of the same name, they only matter with a RewindOffset. */
+	float MaxSavedPositionAge;
+	float PositionSampleRate;
+	bool bCompactSavedPositions;
+	float SavedPositionTolerance;
+	bool bHermiteSavedPositions;
+};
+
+struct FLCRewindReplayResult
+{
+	FLCRewindReplayResult()
+		: NumPositions(0), NumShots(0), RecordedHits(0), ReplayedHits(0), ChangedVerdicts(0), ClientAgreed(0), UntracedHits(0)
+		, RewindErrorSum(0.0), RewindErrorShots(0), ReplayedTime(0.f), WallTime(0.0)
+	{
+	}
+
+	int32 NumPositions;
+	int32 NumShots;
+
+	/** Shots the server hit someone with in the match, and in the replay. */
+	int32 RecordedHits;
+	int32 ReplayedHits;
+
+	/** Shots whose replayed target differs from the recorded one. */
+	int32 ChangedVerdicts;
+
+	/** Shots where the replay hit the character the client said it hit, or both missed. */
+	int32 ClientAgreed;
+
+	/** Replayed hits on shots the server missed, so it never traced the world for them; they may be behind a wall. */
+	int32 UntracedHits;
+
+	/** Distance between the client side and the replayed position of victims the replay hit too. */
+	double RewindErrorSum;
+	int32 RewindErrorShots;
+
+	/** Server time covered by the replayed shots, and how long the replay took. */
+	float ReplayedTime;
+	double WallTime;
+};
+
+/**
+ * Replays an FLCRewindLogWriter log: tests every shot against the rewound state the server recorded for it,
+ * optionally moved by RewindOffset along the saved positions.
+ */
+struct LAGCOMPENSATIONCORE_API FLCRewindReplay
+{
+	static bool Run(const FString& Filename, const FLCRewindReplaySettings& Settings, FLCRewindReplayResult& OutResult);
+};
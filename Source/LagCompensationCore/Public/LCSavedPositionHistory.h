@@ -0,0 +1,330 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LCSavedPositionHistory.generated.h"
+
+USTRUCT(BlueprintType)
+struct LAGCOMPENSATIONCORE_API FSavedPosition
+{
+	GENERATED_USTRUCT_BODY()
+
+	FSavedPosition() : Position(FVector(0.f)), Velocity(FVector(0.f)), Rotation(FRotator(0.f)), bTeleported(false), Time(0.f), TimeStamp(0.f) {};
+
+	FSavedPosition(FVector InPos, FRotator InRot, bool InTeleported, float InTime, float InTimeStamp, FVector InVelocity = FVector(0.f)) : Position(InPos), Velocity(InVelocity), Rotation(InRot), bTeleported(InTeleported), Time(InTime), TimeStamp(InTimeStamp) {};
+
+	/** Position of player at time Time. */
+	UPROPERTY()
+	FVector Position;
+
+	/** Velocity of player at time Time, the tangent of Hermite interpolation. */
+	UPROPERTY()
+	FVector Velocity;
+
+	/** Rotation of player at time Time. */
+	UPROPERTY()
+	FRotator Rotation;
+
+	/** true if teleport occurred getting to current position (so don't interpolate) */
+	UPROPERTY()
+	bool bTeleported;
+
+	/** Current server world time when this position was updated. */
+	float Time;
+
+	/** Client timestamp associated with this position. */
+	float TimeStamp;
+};
+
+/**
+ * Compact encoding of an FSavedPosition, 22 bytes instead of 48.
+ * Position and times are relative to the anchor of the block the entry lives in; roll is not kept.
+ */
+struct FLCCompactSavedPosition
+{
+	/** Position - block anchor, in 1/8 cm steps. */
+	int16 Offset[3];
+
+	/** Velocity in cm/s. */
+	int16 Velocity[3];
+
+	/** FRotator::CompressAxisToShort of yaw and pitch. */
+	uint16 Yaw;
+	uint16 Pitch;
+
+	/** Time - block anchor time, in 0.1 ms ticks. */
+	int16 TimeTicks;
+
+	/** (TimeStamp - Time) - (block anchor TimeStamp - anchor Time), in 0.1 ms ticks. */
+	int16 TimeStampTicks;
+
+	/** FLCSavedPositionHistory::EFlags. */
+	uint8 Flags;
+};
+
+/** Point of a saved position history closest to a given position, see FLCSavedPositionHistory::FindClosestTime. */
+struct FLCClosestSavedPosition
+{
+	FLCClosestSavedPosition() : Index(INDEX_NONE), Time(0.f), Position(FVector::ZeroVector), DistanceSquared(MAX_flt) {}
+
+	/** Entry the closest point follows, the point lies between it and the next entry. */
+	int32 Index;
+
+	/** Server time the character was at Position, interpolated between the two entries. */
+	float Time;
+
+	FVector Position;
+	float DistanceSquared;
+};
+
+/**
+ * Fixed-capacity ring buffer of saved positions, oldest first. Adding to a full history overwrites the oldest entry.
+ * Entries can be stored compactly (see Reserve), decimated (see SetDecimationTolerance) and interpolated
+ * along Hermite curves (see SetHermiteInterpolation).
+ */
+class LAGCOMPENSATIONCORE_API FLCSavedPositionHistory
+{
+public:
+	FLCSavedPositionHistory() : Head(0), Count(0), IndexMask(0), NumOverwritten(0), MoveTimeStampHead(0), NumMoveTimeStamps(0), bCompact(false), bHermite(false), DecimationTolerance(0.f) {}
+
+	/**
+	 * Allocates room for at least MinCapacity entries (rounded up to a power of two) and clears the history.
+	 * @param bInCompact	store entries with the compact encoding
+	 */
+	void Reserve(int32 MinCapacity, bool bInCompact = false);
+
+	/** Removes all entries, keeping the allocation. Also clears the overwrite count. */
+	void Reset();
+
+	/** Positions that are at most this far (in cm) from the interpolated path are not kept, 0 keeps them all. */
+	void SetDecimationTolerance(float Tolerance) { DecimationTolerance = FMath::Max(Tolerance, 0.f); }
+
+	float GetDecimationTolerance() const { return DecimationTolerance; }
+
+	/** Interpolate between entries along the cubic Hermite curve of their positions and velocities. */
+	void SetHermiteInterpolation(bool bInHermite) { bHermite = bInHermite; }
+
+	bool IsHermiteInterpolation() const { return bHermite; }
+
+	/** Position between A and B at Time, A.Time <= Time <= B.Time, interpolated linearly or along the Hermite curve. */
+	static FVector InterpolatePosition(const FSavedPosition& A, const FSavedPosition& B, float Time, bool bHermite);
+
+	/**
+	 * Appends a position as the newest entry, overwriting the oldest one if the history is full.
+	 * With a decimation tolerance the position may replace the newest entry instead.
+	 */
+	void Add(const FSavedPosition& InPosition);
+
+	/** Removes the oldest entry. */
+	void PopOldest();
+
+	/** Removes the entries older than MinTime, except the newest of them, which is kept for interpolation. */
+	void PopOlderThan(float MinTime);
+
+	int32 Num() const { return Count; }
+
+	int32 Capacity() const { return IndexMask > 0 ? IndexMask + 1 : 0; }
+
+	bool IsEmpty() const { return Count == 0; }
+
+	bool IsCompact() const { return bCompact; }
+
+	/**
+	 * Entries lost because the history or its overflow pool was full when a position was added. Anything
+	 * above zero means the history is too small for the time it is meant to cover.
+	 */
+	int32 GetNumOverwritten() const { return NumOverwritten; }
+
+	/** Bytes used by the entries, including block anchors and full precision fallbacks. */
+	SIZE_T GetAllocatedSize() const;
+
+	/** Returns the entry at Index, where 0 is the oldest and Num() - 1 the newest. */
+	FSavedPosition operator[](int32 Index) const
+	{
+		checkSlow(Index >= 0 && Index < Count);
+		const int32 Physical = (Head + Index) & IndexMask;
+		return bCompact ? Decode(Physical) : Entries[Physical];
+	}
+
+	/** Position of the entry at Index, cheaper than decoding the whole entry. */
+	FVector GetPosition(int32 Index) const
+	{
+		checkSlow(Index >= 0 && Index < Count);
+		const int32 Physical = (Head + Index) & IndexMask;
+		return bCompact ? DecodePosition(Physical) : Entries[Physical].Position;
+	}
+
+	/** Time of the entry at Index, cheaper than decoding the whole entry. */
+	float GetTime(int32 Index) const
+	{
+		checkSlow(Index >= 0 && Index < Count);
+		const int32 Physical = (Head + Index) & IndexMask;
+		return bCompact ? DecodeTime(Physical) : Entries[Physical].Time;
+	}
+
+	/**
+	 * Returns the index of the newest entry older than TargetTime, or INDEX_NONE if there is none.
+	 * Entry times are monotonic so this is a binary search. InOutHint, if given, is checked first and
+	 * receives the result, which makes repeated lookups for the same time O(1).
+	 */
+	int32 FindLastBefore(float TargetTime, int32* InOutHint = nullptr) const;
+
+	/**
+	 * Returns the position at TargetTime, interpolated between the entries around it. Before the oldest entry
+	 * this is the oldest position, after the newest one the newest position. Zero if the history is empty.
+	 * @param InOutHint	see FindLastBefore
+	 */
+	FVector GetPositionAtTime(float TargetTime, int32* InOutHint = nullptr) const;
+
+	/** Returns the index of the entry closest to Position, or INDEX_NONE if the history is empty. */
+	int32 FindClosest(const FVector& Position) const;
+
+	/**
+	 * Finds where along the recorded path the character came closest to Position, between MinTime and MaxTime.
+	 * The path is the one GetPositionAtTime follows: straight segments between consecutive entries, or with
+	 * Hermite interpolation the curves between them, each followed by 8 straight pieces. Blocks of entries whose
+	 * bounds are farther than the best answer so far are skipped.
+	 * @return false if no entry lies in the time range
+	 */
+	bool FindClosestTime(const FVector& Position, FLCClosestSavedPosition& OutClosest, float MinTime = -MAX_flt, float MaxTime = MAX_flt) const;
+
+	/**
+	 * Maps a client move timestamp to the server time the move was recorded at, interpolating between the
+	 * moves around it. Every added position counts, decimated or not. Only the moves since the client last
+	 * reset its timestamps are searched.
+	 * @param OutPosition	if given, receives the position at TimeStamp
+	 * @return false if TimeStamp is older than the oldest entry or newer than the newest position added
+	 */
+	bool MapTimeStampToTime(float TimeStamp, float& OutTime, FVector* OutPosition = nullptr) const;
+
+	/** Returns the newest entry. */
+	FSavedPosition Last() const
+	{
+		return (*this)[Count - 1];
+	}
+
+private:
+	enum EFlags : uint8
+	{
+		Flag_Teleported = 1 << 0,
+
+		/** The entry did not fit the encoding, it is in OverflowPool at the index stored in Offset[0]. */
+		Flag_Overflow = 1 << 1,
+	};
+
+	/**
+	 * Position in 1/8 cm grid units, velocity in cm/s and times in 0.1 ms ticks, as integers. Used for block anchors.
+	 * Times are 64 bit, 32 bit ticks would wrap after 59 hours of server time.
+	 */
+	struct FQuantizedPosition
+	{
+		int32 Position[3];
+		int32 Velocity[3];
+		int64 Time;
+
+		/** TimeStamp - Time. */
+		int64 TimeStampOffset;
+	};
+
+	/** Server time the first position of a client move was added at. */
+	struct FMoveTimeStamp
+	{
+		float TimeStamp;
+		float Time;
+	};
+
+	/** Positions dropped in a row at most, so a long straight run still has entries to search. */
+	static constexpr int32 MaxDecimatedRun = 16;
+
+	/** log2 of the number of entries per block, of compact encoding and of BlockBounds. */
+	static constexpr int32 BlockShift = 4;
+
+	/**
+	 * Grows the bounds of the block Physical is in, and of the block of the entry before it, whose path
+	 * segment now ends at Physical. Rebuilds the bounds from the live entries when Physical starts its block.
+	 */
+	void UpdateBounds(int32 Physical);
+
+	/** Grows Bounds by the Hermite curve from the entry at Index to the next one. */
+	void AddCurveBounds(int32 Index, FBox& Bounds) const;
+
+	/**
+	 * Whether InPosition can replace the newest entry: the newest entry and the positions it replaced before
+	 * lie within DecimationTolerance of the line from the entry before it to InPosition. Remembers the newest
+	 * entry as dropped when it can.
+	 */
+	bool TryDropNewest(const FSavedPosition& InPosition);
+
+	/** Remembers the move timestamp of InPosition if it starts a new move. */
+	void AddMoveTimeStamp(const FSavedPosition& InPosition);
+
+	/** Writes InPosition to Physical in compact form, re-anchoring its block when Physical starts it. */
+	void AddCompact(int32 Physical, const FSavedPosition& InPosition);
+
+	/** Encodes InPosition against the anchor of its block, falling back to the overflow pool if it does not fit. */
+	void Encode(int32 Physical, const FSavedPosition& InPosition);
+
+	/**
+	 * Moves the entry at Physical to the overflow pool. Drops the oldest entries, never the newest, while the
+	 * pool is full; returns false if that dropped Physical itself.
+	 */
+	bool StoreOverflow(int32 Physical, const FSavedPosition& InPosition, uint8 Flags);
+
+	/** Returns the overflow pool slot of the entry at Physical, if it has one, to the free list. */
+	void ReleaseOverflow(int32 Physical);
+
+	const FSavedPosition& GetOverflow(int32 Physical) const
+	{
+		return OverflowPool[(uint16)CompactEntries[Physical].Offset[0]];
+	}
+
+	/** Stores Quantized relative to the anchor of its block, returns false if the offsets do not fit. */
+	bool StoreRelative(int32 Physical, const FQuantizedPosition& Quantized, uint16 Yaw, uint16 Pitch, uint8 Flags);
+
+	/** Absolute quantized values of a compact, non overflow entry. */
+	FQuantizedPosition GetQuantized(int32 Physical) const;
+
+	static FQuantizedPosition Quantize(const FSavedPosition& InPosition);
+	static FSavedPosition Dequantize(const FQuantizedPosition& Quantized, uint16 Yaw, uint16 Pitch, uint8 Flags);
+
+	FSavedPosition Decode(int32 Physical) const;
+	FVector DecodePosition(int32 Physical) const;
+	float DecodeTime(int32 Physical) const;
+
+	/** Full mode storage. */
+	TArray<FSavedPosition> Entries;
+
+	/** Compact mode storage: entries, one anchor per block, the entries that did not fit and the free slots among them. */
+	TArray<FLCCompactSavedPosition> CompactEntries;
+	TArray<FQuantizedPosition> Blocks;
+	TArray<FSavedPosition> OverflowPool;
+	TArray<uint16> FreeOverflow;
+
+	/** Bounds of the entries of each block and of the paths leaving them, curves included, for FindClosestTime. */
+	TArray<FBox> BlockBounds;
+
+	/** Physical index of the oldest entry. */
+	int32 Head;
+
+	int32 Count;
+
+	/** Capacity - 1, capacity is always a power of two. */
+	int32 IndexMask;
+
+	int32 NumOverwritten;
+
+	/** Ring of move timestamps, oldest first, with the same capacity as the entries. */
+	TArray<FMoveTimeStamp> MoveTimeStamps;
+	int32 MoveTimeStampHead;
+	int32 NumMoveTimeStamps;
+
+	bool bCompact;
+	bool bHermite;
+
+	float DecimationTolerance;
+
+	/** Positions and times dropped since the entry before the newest one, oldest first. */
+	TArray<FVector> DecimatedPositions;
+	TArray<float> DecimatedTimes;
+};
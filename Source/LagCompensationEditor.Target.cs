@@ -9,6 +9,6 @@ public class LagCompensationEditorTarget : TargetRules
 	{
 		Type = TargetType.Editor;
 		DefaultBuildSettings = BuildSettingsVersion.V2;
-		ExtraModuleNames.Add("LagCompensation");
+		ExtraModuleNames.AddRange( new string[] { "LagCompensationCore", "LagCompensation" } );
 	}
 }